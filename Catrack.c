@@ -5,13 +5,25 @@
  *
  *  Author:  Gene Myers
  *  Date  :  June 2014
+ *  Modify:  The output offsets of every block are computed first, so that the blocks can
+ *             then be rebased and copied into place by -T threads, the data being copied
+ *             within the kernel (copy_file_range) where possible.  Block tracks are deleted
+ *             with -d.
  *
  ********************************************************************************************/
 
+#ifdef __linux__
+#define _GNU_SOURCE
+#endif
+
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
+#include <errno.h>
+#include <fcntl.h>
 #include <unistd.h>
+#include <sys/stat.h>
+#include <pthread.h>
 
 #include "DB.h"
 
@@ -21,29 +33,215 @@
 #define PATHSEP "/"
 #endif
 
-static char *Usage = "[-v] <path:db> <track:name>";
+static char *Usage = "[-vd] [-T<int(1)>] <path:db> <track:name>";
+
+#define ANNO_CHUNK  0x100000   //  # of anno records rebased at a time
+#define COPY_CHUNK  0x400000   //  Size of the buffer for copying data through user space
+
+static int NTHREADS;
+
+  //  A block track and where its parts go in the merged track: its anno records [0,tracklen)
+  //    go at offset aout of the .anno file increased by doff, and its data [0,dlen) goes at
+  //    offset doff of the .data file.  The files of a block are only open while it is being
+  //    examined or merged, so any number of blocks can be merged under any limit on open files.
+
+typedef struct
+  { int    data;        //  Block has a .data file
+    int    tracklen;
+    int64  dlen;
+    int64  aout;
+    int64  doff;
+  } Block;
+
+  //  Thread tid merges blocks tid, tid+NTHREADS, ... into the open output files, opening
+  //    the files of block b, <prefix><b+1>.<track>.[anno|data], in turn
+
+typedef struct
+  { Block *block;
+    int    nblocks;
+    char  *prefix;
+    char  *track;
+    int    tid;
+    int    size;       //  Size of an anno record
+    int    aout;       //  Output .anno and .data files
+    int    dout;
+    char  *buffer;     //  Work buffer of COPY_CHUNK bytes (>= ANNO_CHUNK records)
+    char  *name;       //  Buffer for the name of a block track file
+    int    error;
+  } Merge_Arg;
+
+static int Write_All(int fd, char *buf, int64 len, int64 off)
+{ int64 n;
+
+  while (len > 0)
+    { n = pwrite(fd,buf,len,off);
+      if (n <= 0)
+        return (1);
+      buf += n;
+      off += n;
+      len -= n;
+    }
+  return (0);
+}
+
+static int Read_All(int fd, char *buf, int64 len, int64 off)
+{ int64 n;
+
+  while (len > 0)
+    { n = pread(fd,buf,len,off);
+      if (n <= 0)
+        return (1);
+      buf += n;
+      off += n;
+      len -= n;
+    }
+  return (0);
+}
+
+  //  Copy bytes [0,len) of file in to offset off of file out, within the kernel if possible
+
+static int Copy_Data(int in, int out, int64 len, int64 off, char *buf)
+{ int64 o, n;
+
+  o = 0;
+  n = 0;
+#ifdef __linux__
+  { loff_t ioff, ooff;
+
+    ioff = 0;
+    ooff = off;
+    while (o < len)
+      { n = copy_file_range(in,&ioff,out,&ooff,len-o,0);
+        if (n <= 0)
+          break;
+        o += n;
+      }
+    if (o >= len)
+      return (0);
+    if (n == 0 || (errno != ENOSYS && errno != EXDEV && errno != EINVAL && errno != EOPNOTSUPP))
+      return (1);
+  }
+#endif
+
+  for ( ; o < len; o += n)
+    { n = len-o;
+      if (n > COPY_CHUNK)
+        n = COPY_CHUNK;
+      if (Read_All(in,buf,n,o) || Write_All(out,buf,n,off+o))
+        return (1);
+    }
+  return (0);
+}
+
+static void *merge_thread(void *arg)
+{ Merge_Arg *parm = (Merge_Arg *) arg;
+  int        size = parm->size;
+  char      *buf  = parm->buffer;
+  char      *name = parm->name;
+  int        afd, dfd;
+  int        b;
+
+  parm->error = 1;
+  for (b = parm->tid; b < parm->nblocks; b += NTHREADS)
+    { Block *blk = parm->block + b;
+      int    i, n, k;
+
+      sprintf(name,"%s%d.%s.anno",parm->prefix,b+1,parm->track);
+      afd = open(name,O_RDONLY);
+      if (afd < 0)
+        { fprintf(stderr,"%s: Cannot open %s for 'r'\n",Prog_Name,name);
+          return (NULL);
+        }
+      dfd = -1;
+      if (blk->data)
+        { sprintf(name,"%s%d.%s.data",parm->prefix,b+1,parm->track);
+          dfd = open(name,O_RDONLY);
+          if (dfd < 0)
+            { fprintf(stderr,"%s: Cannot open %s for 'r'\n",Prog_Name,name);
+              goto close;
+            }
+        }
+
+      for (i = 0; i < blk->tracklen; i += n)
+        { n = blk->tracklen - i;
+          if (n > ANNO_CHUNK)
+            n = ANNO_CHUNK;
+          if (Read_All(afd,buf,((int64) size)*n,2*sizeof(int)+((int64) size)*i))
+            { fprintf(stderr,"%s: Cannot read .anno of track block %d\n",Prog_Name,b+1);
+              goto close;
+            }
+          if (dfd >= 0)
+            { if (size == 4)
+                { int *anno4 = (int *) buf;
+                  for (k = 0; k < n; k++)
+                    anno4[k] += blk->doff;
+                }
+              else
+                { int64 *anno8 = (int64 *) buf;
+                  for (k = 0; k < n; k++)
+                    anno8[k] += blk->doff;
+                }
+            }
+          if (Write_All(parm->aout,buf,((int64) size)*n,blk->aout+((int64) size)*i))
+            { fprintf(stderr,"%s: Cannot write merged .anno file\n",Prog_Name);
+              goto close;
+            }
+        }
+
+      if (dfd >= 0 && Copy_Data(dfd,parm->dout,blk->dlen,blk->doff,buf))
+        { fprintf(stderr,"%s: Cannot copy .data of track block %d\n",Prog_Name,b+1);
+          goto close;
+        }
+
+      close(afd);
+      if (dfd >= 0)
+        close(dfd);
+    }
+  parm->error = 0;
+  return (NULL);
+
+close:
+  close(afd);
+  if (dfd >= 0)
+    close(dfd);
+  return (NULL);
+}
 
 int main(int argc, char *argv[])
-{ char *prefix;
-  FILE *aout, *dout;
-  int   VERBOSE;
+{ char  *prefix;
+  int    aout, dout;
+  int    VERBOSE, DELETE;
+  Block *block;
+  int    nblocks, tracksiz;
+  int    afd, dfd;
 
   //  Process arguments
 
   { int   i, j, k;
     int   flags[128];
+    char *eptr;
 
     ARG_INIT("Catrack")
 
+    NTHREADS = 1;
+
     j = 1;
     for (i = 1; i < argc; i++)
       if (argv[i][0] == '-')
-        { ARG_FLAGS("v") }
+        switch (argv[i][1])
+        { default:
+            ARG_FLAGS("vd")
+            break;
+          case 'T':
+            ARG_POSITIVE(NTHREADS,"Number of threads")
+            break;
+        }
       else
         argv[j++] = argv[i];
     argc = j;
 
     VERBOSE = flags['v'];
+    DELETE  = flags['d'];
 
     if (argc != 3)
       { fprintf(stderr,"Usage: %s %s\n",Prog_Name,Usage);
@@ -59,186 +257,284 @@ int main(int argc, char *argv[])
     free(pwd);
     free(root);
 
-    aout = fopen(Catenate(prefix,argv[2],".","anno"),"r");
-    if (aout != NULL)
+    if (access(Catenate(prefix,argv[2],".","anno"),F_OK) == 0)
       { fprintf(stderr,"%s: Track file %s%s.anno already exists!\n",Prog_Name,prefix,argv[2]);
-        fclose(aout);
         exit (1);
       }
 
-    dout = fopen(Catenate(prefix,argv[2],".","data"),"r");
-    if (dout != NULL)
+    if (access(Catenate(prefix,argv[2],".","data"),F_OK) == 0)
       { fprintf(stderr,"%s: Track file %s%s.data already exists!\n",Prog_Name,prefix,argv[2]);
-        fclose(aout);
         exit (1);
       }
 
-    aout = Fopen(Catenate(prefix,argv[2],".","anno"),"w");
-    if (aout == NULL)
-      exit (1);
-    dout = NULL;
+    aout = open(Catenate(prefix,argv[2],".","anno"),O_WRONLY|O_CREAT|O_TRUNC,0666);
+    if (aout < 0)
+      { fprintf(stderr,"%s: Cannot open %s%s.anno for 'w'\n",Prog_Name,prefix,argv[2]);
+        exit (1);
+      }
+    dout = -1;
   }
- 
-  { int   tracktot, tracksiz;
+
+  afd = dfd = -1;
+
+  //  Open the block tracks 1, 2, ... in turn until one does not exist, checking that they all
+  //    encode the same kind of track data, and determine where the parts of each go in the
+  //    merged track, closing each block's files again.  Then set the merged files to their
+  //    final sizes.
+
+  { int   tracktot, head[2];
     int64 trackoff;
-    int   nfiles;
-    char  data[1024];
     void *anno;
+    int   bmax;
 
     anno     = NULL;
     trackoff = 0;
     tracktot = tracksiz = 0;
-    fwrite(&tracktot,sizeof(int),1,aout);
-    fwrite(&tracksiz,sizeof(int),1,aout);
 
-    nfiles = 0;
+    bmax  = 0;
+    block = NULL;
+
+    nblocks = 0;
     while (1)
-      { FILE *afile, *dfile;
-        int   i, size, tracklen;
+      { Block *blk;
+        int    size;
 
-        afile = fopen(Numbered_Suffix(prefix,nfiles+1,Catenate(".",argv[2],".","anno")),"r");
-        if (afile == NULL)
-          break;
-        dfile = fopen(Numbered_Suffix(prefix,nfiles+1,Catenate(".",argv[2],".","data")),"r");
+        afd = open(Numbered_Suffix(prefix,nblocks+1,Catenate(".",argv[2],".","anno")),O_RDONLY);
+        if (afd < 0)
+          { if (errno == ENOENT)
+              break;
+            fprintf(stderr,"%s: Cannot open %s%d.%s.anno for 'r' (%s)\n",
+                           Prog_Name,prefix,nblocks+1,argv[2],strerror(errno));
+            goto error;
+          }
+        dfd = open(Numbered_Suffix(prefix,nblocks+1,Catenate(".",argv[2],".","data")),O_RDONLY);
+        if (dfd < 0 && errno != ENOENT)
+          { fprintf(stderr,"%s: Cannot open %s%d.%s.data for 'r' (%s)\n",
+                           Prog_Name,prefix,nblocks+1,argv[2],strerror(errno));
+            goto error;
+          }
+
+        if (nblocks >= bmax)
+          { bmax  = 1.2*nblocks + 100;
+            block = (Block *) Realloc(block,sizeof(Block)*bmax,"Allocating block list");
+            if (block == NULL)
+              goto error;
+          }
+        blk = block + nblocks;
+        blk->data = (dfd >= 0);
 
         if (VERBOSE)
-          { fprintf(stderr,"Concatenating %s.%d.%s ...",prefix,nfiles+1,argv[2]);
+          { fprintf(stderr,"Concatenating %s%d.%s ...\n",prefix,nblocks+1,argv[2]);
             fflush(stderr);
           }
-  
-        fread(&tracklen,sizeof(int),1,afile);
-        fread(&size,sizeof(int),1,afile);
-        if (nfiles == 0)
+
+        if (Read_All(afd,(char *) head,2*sizeof(int),0))
+          { fprintf(stderr,"%s: Cannot read .anno of track block %d\n",Prog_Name,nblocks+1);
+            nblocks += 1;
+            goto error;
+          }
+        blk->tracklen = head[0];
+        size = head[1];
+        nblocks += 1;
+
+        if (nblocks == 1)
           { tracksiz = size;
-            if (dfile != NULL)
-              { dout = Fopen(Catenate(prefix,argv[2],".","data"),"w");
-                if (dout == NULL)
-                  { fclose(afile);
-                    fclose(dfile);
-                    goto error;
-                  }
-              }
-            else
+            if (dfd < 0)
               { anno = Malloc(size,"Allocating annotation record");
                 if (anno == NULL)
-                  { fclose(afile);
-                    goto error;
-                  }
+                  goto error;
               }
           }
         else
           { int escape = 1;
             if (tracksiz != size)
               { fprintf(stderr,"%s: Track block %d does not have the same annotation size (%d)",
-                               Prog_Name,nfiles+1,size);
+                               Prog_Name,nblocks,size);
                 fprintf(stderr," as previous blocks (%d)\n",tracksiz);
               }
-            else if (dfile == NULL && dout != NULL)
+            else if (dfd < 0 && anno == NULL)
               fprintf(stderr,"%s: Track block %d does not have data but previous blocks do\n",
-                             Prog_Name,nfiles+1);
-            else if (dfile != NULL && dout == NULL)
+                             Prog_Name,nblocks);
+            else if (dfd >= 0 && anno != NULL)
               fprintf(stderr,"%s: Track block %d has data but previous blocks do not\n",
-                             Prog_Name,nfiles+1);
+                             Prog_Name,nblocks);
             else
                escape = 0;
             if (escape)
-              { fclose(afile);
-                if (dfile != NULL) fclose(dfile);
-                if (anno != NULL) free(anno);
-                goto error;
-              }
+              goto error;
           }
-  
-        if (dfile != NULL)
-          { int64 dlen;
 
-            if (size == 4)
+        //  The length of the block's data is its last anno entry, and for a track without
+        //    data the record of the last read of the last block is repeated to terminate the
+        //    merged track (as it always has been)
+
+        blk->aout = 2*sizeof(int) + ((int64) size)*tracktot;
+        blk->doff = trackoff;
+        blk->dlen = 0;
+        if (dfd >= 0)
+          { if (size == 4)
               { int anno4;
-  
-                for (i = 0; i < tracklen; i++)
-                  { fread(&anno4,sizeof(int),1,afile);
-                    anno4 += trackoff;
-                    fwrite(&anno4,sizeof(int),1,aout);
-                  }
-                fread(&anno4,sizeof(int),1,afile);
-                dlen = anno4;
+
+                if (Read_All(afd,(char *) &anno4,size,2*sizeof(int)+((int64) size)*blk->tracklen))
+                  goto bad_block;
+                blk->dlen = anno4;
               }
             else
               { int64 anno8;
-  
-                for (i = 0; i < tracklen; i++)
-                  { fread(&anno8,sizeof(int64),1,afile);
-                    anno8 += trackoff;
-                    fwrite(&anno8,sizeof(int64),1,aout);
-                  }
-                fread(&anno8,sizeof(int64),1,afile);
-                dlen = anno8;
-              }
-            trackoff += dlen;
 
-            for (i = 1024; i < dlen; i += 1024)
-              { fread(data,1024,1,dfile);
-                fwrite(data,1024,1,dout);
-              }
-            i -= 1024;
-            if (i < dlen)
-              { fread(data,dlen-i,1,dfile);
-                fwrite(data,dlen-i,1,dout);
+                if (Read_All(afd,(char *) &anno8,size,2*sizeof(int)+((int64) size)*blk->tracklen))
+                  goto bad_block;
+                blk->dlen = anno8;
               }
           }
         else
-          { for (i = 0; i < tracklen; i++)
-              { fread(anno,size,1,afile);
-                fwrite(anno,size,1,aout);
-              }
+          { if (blk->tracklen > 0 &&
+                  Read_All(afd,anno,size,2*sizeof(int)+((int64) size)*(blk->tracklen-1)))
+              goto bad_block;
           }
-  
-        tracktot += tracklen;
-        nfiles   += 1;
-        if (dfile != NULL) fclose(dfile);
-        fclose(afile);
+
+        close(afd);
+        if (dfd >= 0)
+          close(dfd);
+        afd = dfd = -1;
+
+        trackoff += blk->dlen;
+        tracktot += blk->tracklen;
       }
-  
-    if (nfiles == 0)
+
+    if (nblocks == 0)
       { fprintf(stderr,"%s: Couldn't find first track block %s1.%s.anno\n",
                        Prog_Name,prefix,argv[2]);
         goto error;
       }
-    else
-      { if (dout != NULL)
-          { if (tracksiz == 4)
-              { int anno4 = trackoff;
-                fwrite(&anno4,sizeof(int),1,aout);
-              }
-            else
-              { int64 anno8 = trackoff;
-                fwrite(&anno8,sizeof(int64),1,aout);
-              }
-          }
-        else
-          { fwrite(anno,tracksiz,1,aout);
-            free(anno);
-          }
-        rewind(aout);
-        fwrite(&tracktot,sizeof(int),1,aout);
-        fwrite(&tracksiz,sizeof(int),1,aout);
+
+    //  Write the header and the final anno record of the merged track, and size its files
+
+    { int64 aend;
+
+      head[0] = tracktot;
+      head[1] = tracksiz;
+      aend    = 2*sizeof(int) + ((int64) tracksiz)*tracktot;
+      if (Write_All(aout,(char *) head,2*sizeof(int),0))
+        goto write_error;
+      if (anno == NULL)
+        { if (tracksiz == 4)
+            { int anno4 = trackoff;
+              if (Write_All(aout,(char *) &anno4,sizeof(int),aend))
+                goto write_error;
+            }
+          else
+            { int64 anno8 = trackoff;
+              if (Write_All(aout,(char *) &anno8,sizeof(int64),aend))
+                goto write_error;
+            }
+
+          dout = open(Catenate(prefix,argv[2],".","data"),O_WRONLY|O_CREAT|O_TRUNC,0666);
+          if (dout < 0)
+            { fprintf(stderr,"%s: Cannot open %s%s.data for 'w'\n",Prog_Name,prefix,argv[2]);
+              goto error;
+            }
+          if (ftruncate(dout,trackoff) < 0)
+            goto write_error;
+        }
+      else
+        { if (Write_All(aout,anno,tracksiz,aend))
+            goto write_error;
+          free(anno);
+        }
+    }
+  }
+
+  //  Rebase and copy the blocks into place with NTHREADS threads
+
+  { Merge_Arg *parm;
+    pthread_t *threads;
+    int        t, u;
+
+    parm    = (Merge_Arg *) Malloc(sizeof(Merge_Arg)*NTHREADS,"Allocating thread records");
+    threads = (pthread_t *) Malloc(sizeof(pthread_t)*NTHREADS,"Allocating threads");
+    if (parm == NULL || threads == NULL)
+      goto error;
+
+    for (t = 0; t < NTHREADS; t++)
+      { parm[t].block   = block;
+        parm[t].nblocks = nblocks;
+        parm[t].prefix  = prefix;
+        parm[t].track   = argv[2];
+        parm[t].tid     = t;
+        parm[t].size    = tracksiz;
+        parm[t].aout    = aout;
+        parm[t].dout    = dout;
+        parm[t].buffer  = (char *) Malloc(COPY_CHUNK+((int64) tracksiz)*ANNO_CHUNK,
+                                          "Allocating copy buffer");
+        parm[t].name    = (char *) Malloc(strlen(prefix)+strlen(argv[2])+30,
+                                          "Allocating file name");
+        if (parm[t].buffer == NULL || parm[t].name == NULL)
+          goto error;
+      }
+
+    for (t = 1; t < NTHREADS; t++)
+      if (pthread_create(threads+t,NULL,merge_thread,parm+t) != 0)
+        break;
+    for (u = t; u < NTHREADS; u++)      //  Run here any range no thread could be created for
+      merge_thread(parm+u);
+    merge_thread(parm);
+    for (u = 1; u < t; u++)
+      pthread_join(threads[u],NULL);
+
+    for (t = 0; t < NTHREADS; t++)
+      { if (parm[t].error)
+          goto error;
+        free(parm[t].buffer);
+        free(parm[t].name);
       }
+    free(threads);
+    free(parm);
   }
-  
-  fclose(aout);
-  if (dout != NULL)
-    fclose(dout);
+
+  free(block);
+
+  if (close(aout) < 0 || (dout >= 0 && close(dout) < 0))
+    { fprintf(stderr,"%s: Cannot close merged track files\n",Prog_Name);
+      aout = dout = -1;
+      goto remove;
+    }
+
+  //  With -d, remove the block tracks now that the merged track is complete
+
+  if (DELETE)
+    { int b;
+
+      for (b = 1; b <= nblocks; b++)
+        { unlink(Numbered_Suffix(prefix,b,Catenate(".",argv[2],".","anno")));
+          unlink(Numbered_Suffix(prefix,b,Catenate(".",argv[2],".","data")));
+        }
+    }
+
   free(prefix);
 
   exit (0);
 
+bad_block:
+  fprintf(stderr,"%s: Track block %d is truncated\n",Prog_Name,nblocks);
+  goto error;
+
+write_error:
+  fprintf(stderr,"%s: Cannot write merged track %s%s\n",Prog_Name,prefix,argv[2]);
+
 error:
-  fclose(aout);
+  if (afd >= 0)
+    close(afd);
+  if (dfd >= 0)
+    close(dfd);
+
+remove:
+  if (aout >= 0)
+    close(aout);
+  if (dout >= 0)
+    close(dout);
   unlink(Catenate(prefix,argv[2],".","anno"));
-  if (dout != NULL)
-    { fclose(dout);
-      unlink(Catenate(prefix,argv[2],".","data"));
-    }
+  unlink(Catenate(prefix,argv[2],".","data"));
   free(prefix);
 
   exit (1);
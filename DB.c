@@ -18,6 +18,10 @@
 #include <ctype.h>
 #include <unistd.h>
 #include <dirent.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <pthread.h>
 
 #include "DB.h"
 
@@ -208,12 +212,135 @@ void Print_Number(int64 num, int width, FILE *out)
  *
  ********************************************************************************************/
 
-//  Compress read into 2-bits per base (from [0-3] per byte representation
+//  On x86_64 the bulk of a read is packed, unpacked, or converted from letters to numbers with
+//    SSE2 kernels (always present), or AVX2 kernels if the cpu has them (determined on first
+//    use).  Other targets, and the last few bytes of a read, use table-driven scalar loops.
+
+static char Unpack_Table[3][256][4];   //  [ascii][byte] -> the 4 symbols it encodes
+static pthread_once_t Kernels_Once = PTHREAD_ONCE_INIT;   //  Tables & cpu check done once
+
+static char Unpack_Letter[3][4] = { { 0, 1, 2, 3 }, { 'a', 'c', 'g', 't' }, { 'A', 'C', 'G', 'T' } };
+
+static char Number[256] =
+    { 0, 0, 0, 0, 0, 0, 0, 0,
+      0, 0, 0, 0, 0, 0, 0, 0,
+      0, 0, 0, 0, 0, 0, 0, 0,
+      0, 0, 0, 0, 0, 0, 0, 0,
+      0, 0, 0, 0, 0, 0, 0, 0,
+      0, 0, 0, 0, 0, 0, 0, 0,
+      0, 0, 0, 0, 0, 0, 0, 0,
+      0, 0, 0, 0, 0, 0, 0, 0,
+      0, 0, 0, 1, 0, 0, 0, 2,
+      0, 0, 0, 0, 0, 0, 0, 0,
+      0, 0, 0, 0, 3, 0, 0, 0,
+      0, 0, 0, 0, 0, 0, 0, 0,
+      0, 0, 0, 1, 0, 0, 0, 2,
+      0, 0, 0, 0, 0, 0, 0, 0,
+      0, 0, 0, 0, 3, 0, 0, 0,
+      0, 0, 0, 0, 0, 0, 0, 0,
+    };
+
+#if defined(__GNUC__) && defined(__x86_64__)
+
+#include <immintrin.h>
+
+#define READ_SIMD
+
+static int Read_Avx2 = 0;
+
+#endif
+
+static void Init_Kernels()
+{ int a, b;
+
+  for (a = 0; a < 3; a++)
+    for (b = 0; b < 256; b++)
+      { Unpack_Table[a][b][0] = Unpack_Letter[a][(b >> 6) & 0x3];
+        Unpack_Table[a][b][1] = Unpack_Letter[a][(b >> 4) & 0x3];
+        Unpack_Table[a][b][2] = Unpack_Letter[a][(b >> 2) & 0x3];
+        Unpack_Table[a][b][3] = Unpack_Letter[a][b & 0x3];
+      }
+#ifdef READ_SIMD
+  __builtin_cpu_init();
+  Read_Avx2 = __builtin_cpu_supports("avx2");
+#endif
+}
+
+//  Compress read into 2-bits per base (from [0-3] per byte representation).  Packing runs
+//    from the start of the read so the bulk can be done 64 (SSE2) or 128 (AVX2) bases at
+//    a time in place.
+
+#ifdef READ_SIMD
+
+  //  Pack the 64*nblk bytes s[0..64*nblk-1] into s[0..16*nblk-1].  Within each 16-bit word
+  //    (s0,s1) becomes 4*s0+s1, and then within each 32-bit word (p0,p1) becomes 16*p0+p1,
+  //    whose low bytes are then gathered by two saturating packs.
+
+static void Pack_Blocks_SSE2(char *s, int nblk)
+{ __m128i lo8, lo16;
+  __m128i x[4];
+  int     k, j;
+
+  lo8  = _mm_set1_epi16(0x00ff);
+  lo16 = _mm_set1_epi32(0x000000ff);
+
+  for (k = 0; k < nblk; k++)
+    { for (j = 0; j < 4; j++)
+        { x[j] = _mm_loadu_si128((__m128i *) (s + 64*k + 16*j));
+          x[j] = _mm_and_si128(_mm_add_epi16(_mm_slli_epi16(x[j],2),_mm_srli_epi16(x[j],8)),lo8);
+          x[j] = _mm_and_si128(_mm_add_epi32(_mm_slli_epi32(x[j],4),_mm_srli_epi32(x[j],16)),lo16);
+        }
+      _mm_storeu_si128((__m128i *) (s + 16*k),
+                       _mm_packus_epi16(_mm_packs_epi32(x[0],x[1]),_mm_packs_epi32(x[2],x[3])));
+    }
+}
+
+  //  Pack the 128*nblk bytes s[0..128*nblk-1] into s[0..32*nblk-1].  Same idea with pmaddubsw
+  //    and pmaddwd, but the packs work within 128-bit lanes so a final dword permute is needed.
+
+__attribute__((target("avx2")))
+static void Pack_Blocks_AVX2(char *s, int nblk)
+{ __m256i w2, w4, perm;
+  __m256i x[4];
+  int     k, j;
+
+  w2   = _mm256_set1_epi16(0x0104);
+  w4   = _mm256_set1_epi32(0x00010010);
+  perm = _mm256_setr_epi32(0,4,1,5,2,6,3,7);
+
+  for (k = 0; k < nblk; k++)
+    { for (j = 0; j < 4; j++)
+        { x[j] = _mm256_loadu_si256((__m256i *) (s + 128*k + 32*j));
+          x[j] = _mm256_madd_epi16(_mm256_maddubs_epi16(x[j],w2),w4);
+        }
+      x[0] = _mm256_packus_epi16(_mm256_packs_epi32(x[0],x[1]),_mm256_packs_epi32(x[2],x[3]));
+      _mm256_storeu_si256((__m256i *) (s + 32*k),_mm256_permutevar8x32_epi32(x[0],perm));
+    }
+}
+
+#endif
 
 void Compress_Read(int len, char *s)
-{ int   i, c, d;
+{ int   i, c, d, k;
   char *s0, *s1, *s2, *s3;
 
+  pthread_once(&Kernels_Once,Init_Kernels);
+
+#ifdef READ_SIMD
+  if (Read_Avx2)
+    { k = (len >> 7);
+      Pack_Blocks_AVX2(s,k);
+      k <<= 7;
+    }
+  else
+    { k = (len >> 6);
+      Pack_Blocks_SSE2(s,k);
+      k <<= 6;
+    }
+#else
+  k = 0;
+#endif
+
   s0 = s;
   s1 = s0+1;
   s2 = s1+1;
@@ -223,38 +350,177 @@ void Compress_Read(int len, char *s)
   d = s2[len];
   s0[len] = s1[len] = s2[len] = 0;
 
-  for (i = 0; i < len; i += 4)
+  s += (k >> 2);
+  for (i = k; i < len; i += 4)
     *s++ = (s0[i] << 6) | (s1[i] << 4) | (s2[i] << 2) | s3[i];
 
   s1[len] = c;
   s2[len] = d;
 }
 
-//  Uncompress read form 2-bits per base into [0-3] per byte representation
-
-void Uncompress_Read(int len, char *s)
-{ int   i, tlen, byte;
-  char *s0, *s1, *s2, *s3;
-  char *t;
+//  Uncompress read from 2-bits per base into [0-3] per byte representation, or directly into
+//    lower (ascii = 1) or upper (ascii = 2) case letters.  Each compressed byte becomes 4
+//    bytes so the expansion runs from the end of the read to the start, in place.  The bulk
+//    of a read is expanded 16 (SSE2) or 32 (AVX2) compressed bytes at a time, and the
+//    remainder 1 byte at a time with a 256-entry table of 4 byte expansions.
+
+#ifdef READ_SIMD
+
+  //  Expand the 16*nblk bytes s[0..16*nblk-1] into s[0..64*nblk-1], block by block from the end
+
+static void Unpack_Blocks_SSE2(char *s, int nblk, int ascii)
+{ __m128i mask, one, two, three, base, dc, dg, dt;
+  __m128i x, p0, p1, p2, p3, a, b, c, d;
+  char   *t;
+  int     k;
+
+  mask  = _mm_set1_epi8(3);
+  one   = _mm_set1_epi8(1);
+  two   = _mm_set1_epi8(2);
+  three = _mm_set1_epi8(3);
+  base  = _mm_set1_epi8(Unpack_Letter[ascii][0]);
+  dc    = _mm_set1_epi8(Unpack_Letter[ascii][1] - Unpack_Letter[ascii][0]);
+  dg    = _mm_set1_epi8(Unpack_Letter[ascii][2] - Unpack_Letter[ascii][0]);
+  dt    = _mm_set1_epi8(Unpack_Letter[ascii][3] - Unpack_Letter[ascii][0]);
+
+#define SSE2_LETTER(v)									\
+  if (ascii)										\
+    v = _mm_add_epi8(_mm_add_epi8(base,_mm_and_si128(_mm_cmpeq_epi8(v,one),dc)),	\
+                     _mm_add_epi8(_mm_and_si128(_mm_cmpeq_epi8(v,two),dg),		\
+                                  _mm_and_si128(_mm_cmpeq_epi8(v,three),dt)));
+
+  for (k = nblk-1; k >= 0; k--)
+    { x  = _mm_loadu_si128((__m128i *) (s + 16*k));
+      p3 = _mm_and_si128(x,mask);
+      p2 = _mm_and_si128(_mm_srli_epi16(x,2),mask);
+      p1 = _mm_and_si128(_mm_srli_epi16(x,4),mask);
+      p0 = _mm_and_si128(_mm_srli_epi16(x,6),mask);
+
+      a = _mm_unpacklo_epi8(p0,p1);
+      b = _mm_unpackhi_epi8(p0,p1);
+      c = _mm_unpacklo_epi8(p2,p3);
+      d = _mm_unpackhi_epi8(p2,p3);
+
+      p0 = _mm_unpacklo_epi16(a,c);
+      p1 = _mm_unpackhi_epi16(a,c);
+      p2 = _mm_unpacklo_epi16(b,d);
+      p3 = _mm_unpackhi_epi16(b,d);
+
+      SSE2_LETTER(p0)
+      SSE2_LETTER(p1)
+      SSE2_LETTER(p2)
+      SSE2_LETTER(p3)
+
+      t = s + 64*k;
+      _mm_storeu_si128((__m128i *) t,p0);
+      _mm_storeu_si128((__m128i *) (t+16),p1);
+      _mm_storeu_si128((__m128i *) (t+32),p2);
+      _mm_storeu_si128((__m128i *) (t+48),p3);
+    }
+}
 
-  s0 = s;
-  s1 = s0+1;
-  s2 = s1+1;
-  s3 = s2+1;
+  //  Expand the 32*nblk bytes s[0..32*nblk-1] into s[0..128*nblk-1], block by block from the end
+
+__attribute__((target("avx2")))
+static void Unpack_Blocks_AVX2(char *s, int nblk, int ascii)
+{ __m256i mask, table;
+  __m256i x, p0, p1, p2, p3, a, b, c, d;
+  char   *t;
+  int     k;
+
+  mask  = _mm256_set1_epi8(3);
+  table = _mm256_setr_epi8(Unpack_Letter[ascii][0], Unpack_Letter[ascii][1],
+                           Unpack_Letter[ascii][2], Unpack_Letter[ascii][3],
+                           0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+                           Unpack_Letter[ascii][0], Unpack_Letter[ascii][1],
+                           Unpack_Letter[ascii][2], Unpack_Letter[ascii][3],
+                           0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0);
+
+  for (k = nblk-1; k >= 0; k--)
+    { x  = _mm256_loadu_si256((__m256i *) (s + 32*k));
+      p3 = _mm256_and_si256(x,mask);
+      p2 = _mm256_and_si256(_mm256_srli_epi16(x,2),mask);
+      p1 = _mm256_and_si256(_mm256_srli_epi16(x,4),mask);
+      p0 = _mm256_and_si256(_mm256_srli_epi16(x,6),mask);
+
+      a = _mm256_unpacklo_epi8(p0,p1);     //  The unpacks work within each 128-bit lane so
+      b = _mm256_unpackhi_epi8(p0,p1);     //    lane 0 holds bytes 0-15 and lane 1 bytes 16-31
+      c = _mm256_unpacklo_epi8(p2,p3);
+      d = _mm256_unpackhi_epi8(p2,p3);
+
+      p0 = _mm256_unpacklo_epi16(a,c);     //  bytes 0-3 | 16-19
+      p1 = _mm256_unpackhi_epi16(a,c);     //  bytes 4-7 | 20-23
+      p2 = _mm256_unpacklo_epi16(b,d);     //  bytes 8-11 | 24-27
+      p3 = _mm256_unpackhi_epi16(b,d);     //  bytes 12-15 | 28-31
 
-  tlen = (len-1)/4;
+      if (ascii)
+        { p0 = _mm256_shuffle_epi8(table,p0);
+          p1 = _mm256_shuffle_epi8(table,p1);
+          p2 = _mm256_shuffle_epi8(table,p2);
+          p3 = _mm256_shuffle_epi8(table,p3);
+        }
 
-  t = s+tlen;
-  for (i = tlen*4; i >= 0; i -= 4)
-    { byte = *t--;
-      s0[i] = ((byte >> 6) & 0x3);
-      s1[i] = ((byte >> 4) & 0x3);
-      s2[i] = ((byte >> 2) & 0x3);
-      s3[i] = (byte & 0x3);
+      t = s + 128*k;
+      _mm256_storeu_si256((__m256i *) t,_mm256_permute2x128_si256(p0,p1,0x20));
+      _mm256_storeu_si256((__m256i *) (t+32),_mm256_permute2x128_si256(p2,p3,0x20));
+      _mm256_storeu_si256((__m256i *) (t+64),_mm256_permute2x128_si256(p0,p1,0x31));
+      _mm256_storeu_si256((__m256i *) (t+96),_mm256_permute2x128_si256(p2,p3,0x31));
     }
-  s[len] = 4;
 }
 
+#endif
+
+void Uncompress_Read_Ascii(int len, char *s, int ascii)
+{ int   k, clen;
+  uint8 *t;
+
+  if (ascii < 0 || ascii > 2)
+    ascii = 2;
+  pthread_once(&Kernels_Once,Init_Kernels);
+
+  clen = COMPRESSED_LEN(len);
+  t    = (uint8 *) s;
+
+  //  Only full bytes are expanded 4 symbols at a time so that nothing is written beyond
+  //    s[len] (another thread may own the bytes just beyond it, see Read_All_Sequences_Parallel)
+
+#ifdef READ_SIMD
+  if (Read_Avx2)
+    k = ((len >> 2) >> 5) << 5;
+  else
+    k = ((len >> 2) >> 4) << 4;
+#else
+  k = 0;
+#endif
+
+  { char (*table)[4] = Unpack_Table[ascii];
+    int    i;
+
+    i = clen-1;
+    if ((len & 0x3) != 0)
+      { memcpy(s + 4*i,table[t[i]],len & 0x3);
+        i -= 1;
+      }
+    for ( ; i >= k; i--)
+      memcpy(s + 4*i,table[t[i]],4);
+  }
+
+#ifdef READ_SIMD
+  if (Read_Avx2)
+    Unpack_Blocks_AVX2(s,k >> 5,ascii);
+  else
+    Unpack_Blocks_SSE2(s,k >> 4,ascii);
+#endif
+
+  if (ascii)
+    s[len] = '\0';
+  else
+    s[len] = 4;
+}
+
+void Uncompress_Read(int len, char *s)
+{ Uncompress_Read_Ascii(len,s,0); }
+
 //  Convert read in [0-3] representation to ascii representation (end with '\n')
 
 void Lower_Read(char *s)
@@ -273,33 +539,139 @@ void Upper_Read(char *s)
   *s = '\0';
 }
 
-//  Convert read in ascii representation to [0-3] representation (end with 4)
+//  Convert read in ascii representation to [0-3] representation (end with 4).  A letter maps
+//    to 1, 2, or 3 iff it is c, g, or t in either case, and everything else to 0.  Setting
+//    the 0x20 bit maps C, G, T to c, g, t and no other byte onto them, so the SIMD kernels need
+//    only 3 compares per vector.  The kernels also tally the 1's, 2's, and 3's in byte
+//    counters that are flushed (with psadbw) before they can overflow.
+
+#ifdef READ_SIMD
+
+static void Number_Blocks_SSE2(char *s, int nblk, int64 *count)
+{ __m128i low, lc, lg, lt, one, two, three, zero;
+  __m128i x, mc, mg, mt, nc, ng, nt;
+  int     k, e;
+
+  low   = _mm_set1_epi8(0x20);
+  lc    = _mm_set1_epi8('c');
+  lg    = _mm_set1_epi8('g');
+  lt    = _mm_set1_epi8('t');
+  one   = _mm_set1_epi8(1);
+  two   = _mm_set1_epi8(2);
+  three = _mm_set1_epi8(3);
+  zero  = _mm_setzero_si128();
+
+#define SSE2_SUM(v)  \
+  (v = _mm_sad_epu8(v,zero), _mm_cvtsi128_si64(v) + _mm_cvtsi128_si64(_mm_unpackhi_epi64(v,v)))
+
+  for (k = 0; k < nblk; k = e)
+    { e = k + 255;
+      if (e > nblk)
+        e = nblk;
+      nc = ng = nt = zero;
+      for ( ; k < e; k++)
+        { x  = _mm_or_si128(_mm_loadu_si128((__m128i *) (s + 16*k)),low);
+          mc = _mm_cmpeq_epi8(x,lc);
+          mg = _mm_cmpeq_epi8(x,lg);
+          mt = _mm_cmpeq_epi8(x,lt);
+          x  = _mm_or_si128(_mm_or_si128(_mm_and_si128(mc,one),_mm_and_si128(mg,two)),
+                            _mm_and_si128(mt,three));
+          _mm_storeu_si128((__m128i *) (s + 16*k),x);
+          nc = _mm_sub_epi8(nc,mc);
+          ng = _mm_sub_epi8(ng,mg);
+          nt = _mm_sub_epi8(nt,mt);
+        }
+      count[1] += SSE2_SUM(nc);
+      count[2] += SSE2_SUM(ng);
+      count[3] += SSE2_SUM(nt);
+    }
+  count[0] += 16ll*nblk - (count[1] + count[2] + count[3]);
+}
 
-void Number_Read(char *s)
-{ static char number[128] =
-    { 0, 0, 0, 0, 0, 0, 0, 0,
-      0, 0, 0, 0, 0, 0, 0, 0,
-      0, 0, 0, 0, 0, 0, 0, 0,
-      0, 0, 0, 0, 0, 0, 0, 0,
-      0, 0, 0, 0, 0, 0, 0, 0,
-      0, 0, 0, 0, 0, 0, 0, 0,
-      0, 0, 0, 0, 0, 0, 0, 0,
-      0, 0, 0, 0, 0, 0, 0, 0,
-      0, 0, 0, 1, 0, 0, 0, 2,
-      0, 0, 0, 0, 0, 0, 0, 0,
-      0, 0, 0, 0, 3, 0, 0, 0,
-      0, 0, 0, 0, 0, 0, 0, 0,
-      0, 0, 0, 1, 0, 0, 0, 2,
-      0, 0, 0, 0, 0, 0, 0, 0,
-      0, 0, 0, 0, 3, 0, 0, 0,
-      0, 0, 0, 0, 0, 0, 0, 0,
-    };
+__attribute__((target("avx2")))
+static void Number_Blocks_AVX2(char *s, int nblk, int64 *count)
+{ __m256i low, lc, lg, lt, one, two, three, zero;
+  __m256i x, mc, mg, mt, nc, ng, nt;
+  int     k, e;
+
+  low   = _mm256_set1_epi8(0x20);
+  lc    = _mm256_set1_epi8('c');
+  lg    = _mm256_set1_epi8('g');
+  lt    = _mm256_set1_epi8('t');
+  one   = _mm256_set1_epi8(1);
+  two   = _mm256_set1_epi8(2);
+  three = _mm256_set1_epi8(3);
+  zero  = _mm256_setzero_si256();
+
+#define AVX2_SUM(v)								\
+  (v = _mm256_sad_epu8(v,zero),							\
+   _mm256_extract_epi64(v,0) + _mm256_extract_epi64(v,1) +			\
+   _mm256_extract_epi64(v,2) + _mm256_extract_epi64(v,3))
+
+  for (k = 0; k < nblk; k = e)
+    { e = k + 255;
+      if (e > nblk)
+        e = nblk;
+      nc = ng = nt = zero;
+      for ( ; k < e; k++)
+        { x  = _mm256_or_si256(_mm256_loadu_si256((__m256i *) (s + 32*k)),low);
+          mc = _mm256_cmpeq_epi8(x,lc);
+          mg = _mm256_cmpeq_epi8(x,lg);
+          mt = _mm256_cmpeq_epi8(x,lt);
+          x  = _mm256_or_si256(_mm256_or_si256(_mm256_and_si256(mc,one),
+                                               _mm256_and_si256(mg,two)),
+                               _mm256_and_si256(mt,three));
+          _mm256_storeu_si256((__m256i *) (s + 32*k),x);
+          nc = _mm256_sub_epi8(nc,mc);
+          ng = _mm256_sub_epi8(ng,mg);
+          nt = _mm256_sub_epi8(nt,mt);
+        }
+      count[1] += AVX2_SUM(nc);
+      count[2] += AVX2_SUM(ng);
+      count[3] += AVX2_SUM(nt);
+    }
+  count[0] += 32ll*nblk - (count[1] + count[2] + count[3]);
+}
+
+#endif
+
+void Number_Read_Count(int len, char *s, int64 *count)
+{ int64 n[4];
+  int   i, k;
+
+  pthread_once(&Kernels_Once,Init_Kernels);
+
+  n[0] = n[1] = n[2] = n[3] = 0;
+
+#ifdef READ_SIMD
+  if (Read_Avx2)
+    { k = (len >> 5);
+      Number_Blocks_AVX2(s,k,n);
+      k <<= 5;
+    }
+  else
+    { k = (len >> 4);
+      Number_Blocks_SSE2(s,k,n);
+      k <<= 4;
+    }
+#else
+  k = 0;
+#endif
+
+  for (i = k; i < len; i++)
+    { s[i] = Number[(uint8) s[i]];
+      n[(int) s[i]] += 1;
+    }
+  s[len] = 4;
 
-  for ( ; *s != '\0'; s++)
-    *s = number[(int) *s];
-  *s = 4;
+  if (count != NULL)
+    for (i = 0; i < 4; i++)
+      count[i] += n[i];
 }
 
+void Number_Read(char *s)
+{ Number_Read_Count(strlen(s),s,NULL); }
+
 
 /*******************************************************************************************
  *
@@ -307,16 +679,570 @@ void Number_Read(char *s)
  *
  ********************************************************************************************/
 
+//  When a DB is mapped, db->bases points at a HITS_MAP record giving the read-only
+//    mappings of the .bps file and of the .idx file (the latter private so that the read
+//    records can be modified in place by Trim_DB, Load_QVs, etc.)
+
+typedef struct
+  { char  *bps;    //  Mapping of the .bps file (NULL if the file is empty)
+    int64  blen;   //  Its length in bytes
+    void  *idx;    //  Mapping of the .idx file
+    int64  ilen;   //  Its length in bytes
+  } HITS_MAP;
+
+static void *Map_File(char *name, int64 *len, int writable)
+{ struct stat info;
+  void       *map;
+  int         fd;
+
+  if ((fd = open(name,O_RDONLY)) < 0)
+    { fprintf(stderr,"%s: Cannot open %s for 'r'\n",Prog_Name,name);
+      return (NULL);
+    }
+  if (fstat(fd,&info) < 0)
+    { fprintf(stderr,"%s: Cannot stat %s\n",Prog_Name,name);
+      close(fd);
+      return (NULL);
+    }
+  *len = info.st_size;
+  if (*len == 0)
+    map = NULL;
+  else
+    { if (writable)
+        map = mmap(NULL,*len,PROT_READ|PROT_WRITE,MAP_PRIVATE,fd,0);
+      else
+        map = mmap(NULL,*len,PROT_READ,MAP_SHARED,fd,0);
+      if (map == MAP_FAILED)
+        { fprintf(stderr,"%s: Cannot memory map %s\n",Prog_Name,name);
+          map = NULL;
+        }
+    }
+  close(fd);
+  return (map);
+}
+
+//  Release the mappings of a mapped db, the read records having been copied elsewhere or
+//    being no longer needed.
+
+static void Unmap_DB(HITS_DB *db)
+{ HITS_MAP *map = (HITS_MAP *) db->bases;
+
+  if (map->bps != NULL)
+    munmap(map->bps,map->blen);
+  munmap(map->idx,map->ilen);
+  free(map);
+  db->bases  = NULL;
+  db->mapped = 0;
+}
+
+//  The summary (.stats) codes its histograms as varints of at most MAX_VARINT bytes
+
+#define MAX_VARINT  10
+
+static inline uint8 *Put_Varint(uint8 *p, uint64 v)
+{ while (v >= 0x80)
+    { *p++ = (uint8) (v | 0x80);
+      v >>= 7;
+    }
+  *p++ = (uint8) v;
+  return (p);
+}
+
+static inline uint8 *Get_Varint(uint8 *p, uint64 *v)
+{ uint64 x;
+  int    s;
+
+  if (*p < 0x80)
+    { *v = *p;
+      return (p+1);
+    }
+  x = 0;
+  for (s = 0; *p >= 0x80; s += 7)
+    x |= ((uint64) (*p++ & 0x7f)) << s;
+  *v = x | (((uint64) *p++) << s);
+  return (p);
+}
+
+//  Set stamp[0..2] to the size and modification time (sec,nsec) of file name, by which
+//    the .bdir and .stats files tell if the file they were derived from has since changed.
+
+static int Stamp_File(char *name, int64 *stamp)
+{ struct stat info;
+
+  if (stat(name,&info) < 0)
+    return (1);
+  stamp[0] = info.st_size;
+#ifdef __APPLE__
+  stamp[1] = info.st_mtimespec.tv_sec;
+  stamp[2] = info.st_mtimespec.tv_nsec;
+#else
+  stamp[1] = info.st_mtim.tv_sec;
+  stamp[2] = info.st_mtim.tv_nsec;
+#endif
+  return (0);
+}
+
+int Write_Block_Directory(char *path, HITS_DB *db)
+{ HITS_BDIR   head;
+  HITS_BLOCK *block;
+  HITS_READ  *reads;
+  char       *pwd, *root, *bname;
+  FILE       *dbvis, *bdir;
+  char        buffer[2*MAX_NAME+100];
+  int         nfiles, b, i, r, status;
+  int         ofirst, bfirst, olast, blast;
+
+  if (db->part > 0 || db->trimmed || db->loaded)
+    { fprintf(stderr,"%s: A block directory is made from an entire, untrimmed DB\n",Prog_Name);
+      return (1);
+    }
+
+  status = 1;
+  block  = NULL;
+  pwd    = PathTo(path);
+  root   = Root(path,".db");
+  if ((dbvis = Fopen(Catenate(pwd,"/",root,".db"),"r")) == NULL)
+    goto exit;
+
+  bzero(&head,sizeof(HITS_BDIR));
+  head.magic   = BDIR_MAGIC;
+  head.version = BDIR_VERSION;
+  if (Stamp_File(Catenate(pwd,"/",root,".db"),head.stamp))
+    { fprintf(stderr,"%s: Cannot stat %s/%s.db\n",Prog_Name,pwd,root);
+      goto exit1;
+    }
+
+  fscanf(dbvis,DB_NFILE,&nfiles);
+  for (i = 0; i < nfiles; i++)
+    fgets(buffer,2*MAX_NAME+100,dbvis);
+  if (fscanf(dbvis,DB_NBLOCK,&head.nblocks) != 1)
+    { fprintf(stderr,"%s: DB has not been partitioned\n",Prog_Name);
+      goto exit1;
+    }
+  fscanf(dbvis,DB_PARAMS,&head.size,&head.cutoff,&head.all);
+
+  block = (HITS_BLOCK *) Malloc(sizeof(HITS_BLOCK)*(head.nblocks+1),
+                                "Allocating block directory");
+  if (block == NULL)
+    goto exit1;
+  bzero(block,sizeof(HITS_BLOCK)*(head.nblocks+1));
+
+  reads = db->reads;
+  fscanf(dbvis,DB_BDATA,&ofirst,&bfirst);
+  for (b = 0; b < head.nblocks; b++)
+    { if (fscanf(dbvis,DB_BDATA,&olast,&blast) != 2 || olast < ofirst || olast > db->oreads)
+        { fprintf(stderr,"%s: Partition of %s/%s.db is corrupt\n",Prog_Name,pwd,root);
+          goto exit1;
+        }
+      block[b].ofirst = ofirst;
+      block[b].olast  = olast;
+      block[b].bfirst = bfirst;
+      block[b].blast  = blast;
+      if (olast > ofirst)
+        { block[b].bbeg = reads[ofirst].boff;
+          block[b].bend = reads[ofirst].boff;
+        }
+      for (i = ofirst; i < olast; i++)          //  The reads need not be in .bps order
+        { r = reads[i].end - reads[i].beg;      //    (see DBrepack)
+          block[b].totlen += r;
+          if (r > block[b].maxlen)
+            block[b].maxlen = r;
+          if (reads[i].boff < block[b].bbeg)
+            block[b].bbeg = reads[i].boff;
+          if (reads[i].boff + COMPRESSED_LEN(r) > block[b].bend)
+            block[b].bend = reads[i].boff + COMPRESSED_LEN(r);
+        }
+      ofirst = olast;
+      bfirst = blast;
+    }
+
+  bname = Catenate(pwd,PATHSEP,root,".bdir");
+  if ((bdir = Fopen(bname,"w")) == NULL)
+    goto exit1;
+  fwrite(&head,sizeof(HITS_BDIR),1,bdir);
+  fwrite(block,sizeof(HITS_BLOCK),head.nblocks,bdir);
+  if (fclose(bdir) != 0)
+    { fprintf(stderr,"%s: Could not write %s\n",Prog_Name,bname);
+      unlink(bname);
+      goto exit1;
+    }
+  status = 0;
+
+exit1:
+  fclose(dbvis);
+exit:
+  free(block);
+  free(root);
+  free(pwd);
+  return (status);
+}
+
+//  Get the header of the block directory of the DB pwd/root and the record of block part
+//    if part > 0, returning non-zero if there is no current directory or no such block.
+
+static int Read_Block_Directory(char *pwd, char *root, int part,
+                                HITS_BDIR *head, HITS_BLOCK *block)
+{ int64 stamp[3];
+  FILE *bdir;
+  int   ok;
+
+  if (Stamp_File(Catenate(pwd,"/",root,".db"),stamp))
+    return (1);
+  if ((bdir = fopen(Catenate(pwd,PATHSEP,root,".bdir"),"r")) == NULL)
+    return (1);
+  ok = (fread(head,sizeof(HITS_BDIR),1,bdir) == 1 && head->magic == BDIR_MAGIC
+          && head->version == BDIR_VERSION && head->stamp[0] == stamp[0]
+          && head->stamp[1] == stamp[1] && head->stamp[2] == stamp[2]
+          && part <= head->nblocks);
+  if (ok && part > 0)
+    { fseeko(bdir,sizeof(HITS_BDIR) + sizeof(HITS_BLOCK)*(part-1),SEEK_SET);
+      ok = (fread(block,sizeof(HITS_BLOCK),1,bdir) == 1);
+    }
+  fclose(bdir);
+  return ( ! ok);
+}
+
+//  A summary file .stats has a header, the file offsets of its nunit+1 units, and then for
+//    each unit a STATS_UNIT record followed by its 4 histograms count[0], count[1],
+//    wells[0], and wells[1], each hlen[h] bytes of varint pairs giving the difference of a
+//    length from the previous length with a non-zero count, and its count.
+
+#define STATS_MAGIC    0x74617473   //  "stat"
+#define STATS_VERSION  1
+
+typedef struct
+  { int   magic;
+    int   version;
+    int64 istamp[3];   //  Size and modification time (sec,nsec) of the .idx when written
+    int64 sstamp[3];   //  Size and modification time (sec,nsec) of the stub when written
+    int   nfiles;
+    int   nblocks;
+  } STATS_HEADER;
+
+typedef struct
+  { int   first, last;
+    int   nreads;
+    int   maxlen;
+    int64 totlen;
+    int   hlen[4];
+  } STATS_UNIT;
+
+//  Set unit to the summary of reads[first..last) and encode its histograms into buf,
+//    returning the number of bytes.  hist[0..3] are zeroed arrays of counts over [0,maxlen]
+//    of the db, and are zeroed again on return.
+
+static int64 Summarize_Reads(HITS_READ *reads, int first, int last, int64 **hist,
+                             STATS_UNIT *unit, uint8 *buf)
+{ int    i, h, l, p, rlen, maxlen;
+  int    gmax[2];
+  int64  totlen;
+  uint8 *ptr, *beg;
+
+  totlen  = 0;
+  maxlen  = 0;
+  gmax[0] = gmax[1] = -1;
+  for (i = first; i < last; i++)
+    { rlen = reads[i].end - reads[i].beg;
+      if (i == first || reads[i].origin != reads[i-1].origin)
+        { if (gmax[0] >= 0)
+            hist[2][gmax[0]] += 1;
+          if (gmax[1] >= 0)
+            hist[3][gmax[1]] += 1;
+          gmax[0] = gmax[1] = -1;
+        }
+      hist[0][rlen] += 1;
+      if (rlen > gmax[0])
+        gmax[0] = rlen;
+      if ((reads[i].flags & DB_BEST) != 0)
+        { hist[1][rlen] += 1;
+          if (rlen > gmax[1])
+            gmax[1] = rlen;
+        }
+      totlen += rlen;
+      if (rlen > maxlen)
+        maxlen = rlen;
+    }
+  if (gmax[0] >= 0)
+    hist[2][gmax[0]] += 1;
+  if (gmax[1] >= 0)
+    hist[3][gmax[1]] += 1;
+
+  unit->first  = first;
+  unit->last   = last;
+  unit->nreads = last-first;
+  unit->maxlen = maxlen;
+  unit->totlen = totlen;
+
+  ptr = buf;
+  for (h = 0; h < 4; h++)
+    { beg = ptr;
+      p   = 0;
+      for (l = 0; l <= maxlen; l++)
+        if (hist[h][l] > 0)
+          { ptr = Put_Varint(ptr,l-p);
+            ptr = Put_Varint(ptr,hist[h][l]);
+            hist[h][l] = 0;
+            p = l;
+          }
+      unit->hlen[h] = ptr-beg;
+    }
+  return (ptr-buf);
+}
+
+int Write_DB_Summary(char *path, HITS_DB *db)
+{ STATS_HEADER head;
+  STATS_UNIT   unit;
+  int64       *hist[4], *uoff, fpos, blen;
+  uint8       *buf;
+  int         *flast, *bstart, *ufirst, *ulast;
+  char        *pwd, *root, *sname;
+  char         fname[MAX_NAME], prolog[MAX_NAME];
+  FILE        *dbvis, *stats;
+  int          nunits, u, f, b, status;
+
+  if (db->part > 0 || db->trimmed || db->loaded)
+    { fprintf(stderr,"%s: A summary is made from an entire, untrimmed DB\n",Prog_Name);
+      return (1);
+    }
+
+  status  = 1;
+  flast   = NULL;
+  bstart  = NULL;
+  ufirst  = NULL;
+  uoff    = NULL;
+  hist[0] = NULL;
+  buf     = NULL;
+  pwd     = PathTo(path);
+  root    = Root(path,".db");
+  if ((dbvis = Fopen(Catenate(pwd,"/",root,".db"),"r")) == NULL)
+    goto exit;
+
+  bzero(&head,sizeof(STATS_HEADER));
+  head.magic   = STATS_MAGIC;
+  head.version = STATS_VERSION;
+  if (Stamp_File(Catenate(pwd,PATHSEP,root,".idx"),head.istamp)
+        || Stamp_File(Catenate(pwd,"/",root,".db"),head.sstamp))
+    { fprintf(stderr,"%s: Cannot stat the files of %s/%s\n",Prog_Name,pwd,root);
+      goto exit1;
+    }
+
+  //  Get the last read + 1 of each file, flast[0..nfiles-1], and of each block, bstart[1..nblocks]
+
+  fscanf(dbvis,DB_NFILE,&head.nfiles);
+  flast = (int *) Malloc(sizeof(int)*head.nfiles,"Allocating summary units");
+  if (flast == NULL)
+    goto exit1;
+  for (f = 0; f < head.nfiles; f++)
+    if (fscanf(dbvis,DB_FDATA,flast+f,fname,prolog) != 3)
+      goto corrupt;
+
+  if (fscanf(dbvis,DB_NBLOCK,&head.nblocks) == 1)
+    { int64 size;
+      int   cutoff, all, bfirst;
+
+      fscanf(dbvis,DB_PARAMS,&size,&cutoff,&all);
+      bstart = (int *) Malloc(sizeof(int)*(head.nblocks+1),"Allocating summary units");
+      if (bstart == NULL)
+        goto exit1;
+      for (b = 0; b <= head.nblocks; b++)
+        if (fscanf(dbvis,DB_BDATA,bstart+b,&bfirst) != 2)
+          goto corrupt;
+    }
+  else
+    head.nblocks = 0;
+
+  //  Unit 0 is the entire DB, units 1..nblocks the blocks, and the remaining units the files
+
+  nunits = 1 + head.nblocks + head.nfiles;
+  ufirst = (int *) Malloc(sizeof(int)*2*nunits,"Allocating summary units");
+  if (ufirst == NULL)
+    goto exit1;
+  ulast = ufirst + nunits;
+
+  ufirst[0] = 0;
+  ulast[0]  = db->oreads;
+  for (b = 0; b < head.nblocks; b++)
+    { ufirst[1+b] = bstart[b];
+      ulast[1+b]  = bstart[b+1];
+    }
+  for (f = 0; f < head.nfiles; f++)
+    { ufirst[1+head.nblocks+f] = (f == 0 ? 0 : flast[f-1]);
+      ulast[1+head.nblocks+f]  = flast[f];
+    }
+  for (u = 1; u < nunits; u++)
+    if (ufirst[u] < 0 || ulast[u] < ufirst[u] || ulast[u] > db->oreads)
+      goto corrupt;
+
+  uoff    = (int64 *) Malloc(sizeof(int64)*(nunits+1),"Allocating summary units");
+  hist[0] = (int64 *) Malloc(sizeof(int64)*4*(db->maxlen+1),"Allocating summary histograms");
+  buf     = (uint8 *) Malloc(4*(db->maxlen+1)*(3+MAX_VARINT),"Allocating summary buffer");
+  if (uoff == NULL || hist[0] == NULL || buf == NULL)
+    goto exit1;
+  bzero(hist[0],sizeof(int64)*4*(db->maxlen+1));
+  for (u = 1; u < 4; u++)
+    hist[u] = hist[u-1] + (db->maxlen+1);
+
+  sname = Catenate(pwd,PATHSEP,root,".stats");
+  if ((stats = Fopen(sname,"w")) == NULL)
+    goto exit1;
+
+  fpos = sizeof(STATS_HEADER) + sizeof(int64)*(nunits+1);
+  fseeko(stats,fpos,SEEK_SET);
+  for (u = 0; u < nunits; u++)
+    { bzero(&unit,sizeof(STATS_UNIT));
+      blen = Summarize_Reads(db->reads,ufirst[u],ulast[u],hist,&unit,buf);
+      fwrite(&unit,sizeof(STATS_UNIT),1,stats);
+      fwrite(buf,1,blen,stats);
+      uoff[u] = fpos;
+      fpos   += sizeof(STATS_UNIT) + blen;
+    }
+  uoff[nunits] = fpos;
+
+  rewind(stats);
+  fwrite(&head,sizeof(STATS_HEADER),1,stats);
+  fwrite(uoff,sizeof(int64),nunits+1,stats);
+  if (fclose(stats) != 0)
+    { fprintf(stderr,"%s: Could not write %s\n",Prog_Name,sname);
+      unlink(sname);
+      goto exit1;
+    }
+  status = 0;
+  goto exit1;
+
+corrupt:
+  fprintf(stderr,"%s: Stub of %s/%s.db is corrupt\n",Prog_Name,pwd,root);
+exit1:
+  fclose(dbvis);
+exit:
+  free(buf);
+  free(hist[0]);
+  free(uoff);
+  free(ufirst);
+  free(bstart);
+  free(flast);
+  free(root);
+  free(pwd);
+  return (status);
+}
+
+HITS_SUMMARY *Read_DB_Summary(char *path, int unit)
+{ STATS_HEADER  head;
+  STATS_UNIT    rec;
+  HITS_SUMMARY *sum;
+  int64         istamp[3], sstamp[3], uoff[2], blen;
+  int64        *hist[4];
+  uint64        v;
+  uint8        *buf, *ptr, *end;
+  char         *pwd, *root, *bptr, *fptr;
+  FILE         *stats;
+  int           h, k, l;
+
+  sum   = NULL;
+  buf   = NULL;
+  stats = NULL;
+  pwd   = PathTo(path);
+  root  = Root(path,".db");
+  bptr  = rindex(root,'.');
+  if (bptr != NULL && bptr[1] != '\0' && bptr[1] != '-')
+    { strtol(bptr+1,&fptr,10);
+      if (*fptr == '\0')
+        *bptr = '\0';
+    }
+  if (Stamp_File(Catenate(pwd,PATHSEP,root,".idx"),istamp)
+        || Stamp_File(Catenate(pwd,"/",root,".db"),sstamp))
+    goto exit;
+  if ((stats = fopen(Catenate(pwd,PATHSEP,root,".stats"),"r")) == NULL)
+    goto exit;
+  if (fread(&head,sizeof(STATS_HEADER),1,stats) != 1 || head.magic != STATS_MAGIC
+        || head.version != STATS_VERSION || unit < 0 || unit > head.nblocks + head.nfiles)
+    goto exit;
+  for (k = 0; k < 3; k++)
+    if (head.istamp[k] != istamp[k] || head.sstamp[k] != sstamp[k])
+      goto exit;
+
+  fseeko(stats,sizeof(STATS_HEADER) + sizeof(int64)*unit,SEEK_SET);
+  if (fread(uoff,sizeof(int64),2,stats) != 2)
+    goto exit;
+  fseeko(stats,uoff[0],SEEK_SET);
+  blen = uoff[1] - (uoff[0] + sizeof(STATS_UNIT));
+  if (fread(&rec,sizeof(STATS_UNIT),1,stats) != 1 || blen < 0
+        || rec.hlen[0] + rec.hlen[1] + rec.hlen[2] + rec.hlen[3] != blen)
+    goto exit;
+  buf = (uint8 *) Malloc(blen+MAX_VARINT,"Allocating summary buffer");
+  sum = (HITS_SUMMARY *) Malloc(sizeof(HITS_SUMMARY),"Allocating summary");
+  if (buf == NULL || sum == NULL)
+    goto error;
+  hist[0] = (int64 *) Malloc(sizeof(int64)*4*(rec.maxlen+1),"Allocating summary histograms");
+  if (hist[0] == NULL)
+    goto error;
+  if (fread(buf,1,blen,stats) != (size_t) blen)
+    goto error1;
+  bzero(buf+blen,MAX_VARINT);
+
+  bzero(hist[0],sizeof(int64)*4*(rec.maxlen+1));
+  ptr = buf;
+  for (h = 0; h < 4; h++)
+    { if (h > 0)
+        hist[h] = hist[h-1] + (rec.maxlen+1);
+      end = ptr + rec.hlen[h];
+      l   = 0;
+      while (ptr < end)
+        { ptr = Get_Varint(ptr,&v);
+          l  += v;
+          ptr = Get_Varint(ptr,&v);
+          if (l > rec.maxlen)
+            goto error1;
+          hist[h][l] = v;
+        }
+    }
+
+  sum->first    = rec.first;
+  sum->last     = rec.last;
+  sum->nreads   = rec.nreads;
+  sum->maxlen   = rec.maxlen;
+  sum->totlen   = rec.totlen;
+  sum->count[0] = hist[0];
+  sum->count[1] = hist[1];
+  sum->wells[0] = hist[2];
+  sum->wells[1] = hist[3];
+  goto exit;
+
+error1:
+  free(hist[0]);
+error:
+  free(sum);
+  sum = NULL;
+exit:
+  if (stats != NULL)
+    fclose(stats);
+  free(buf);
+  free(root);
+  free(pwd);
+  return (sum);
+}
+
+void Free_DB_Summary(HITS_SUMMARY *sum)
+{ free(sum->count[0]);
+  free(sum);
+}
+
 // Open the given database "root" into the supplied HITS_DB record "db"
-//   The index array is allocated and read in, the 'bases' file is open for reading.
+//   The index array is allocated and read in (or mapped if "mapped" is set), the 'bases'
+//   file is opened for reading on demand (or mapped).  When read in, the records are
+//   decoded from the compact index if there is a current one.  A block is located from
+//   the block directory if there is a current one, and otherwise by scanning the stub.
 
-int Open_DB(char* path, HITS_DB *db)
+static int Open_DB_Mode(char* path, HITS_DB *db, int mapped)
 { char *root, *pwd, *bptr, *fptr;
   int   nreads;
   FILE *index, *dbvis;
   int   status;
   int   part, cutoff, all;
   int   ofirst, bfirst, olast;
+  int   indexed;
+  HITS_MAP  *map;
+  HITS_BDIR  bdir;
+  HITS_BLOCK block;
 
   status = 0;
 
@@ -352,40 +1278,56 @@ int Open_DB(char* path, HITS_DB *db)
   fread(db,sizeof(HITS_DB),1,index);
   nreads = db->oreads;
 
-  { int   p, nblocks, nfiles, blast;
-    int64 size;
-    char buffer[2*MAX_NAME+100];
-
-    nblocks = 0;
-    fscanf(dbvis,DB_NFILE,&nfiles);
-    for (p = 0; p < nfiles; p++)
-      fgets(buffer,2*MAX_NAME+100,dbvis);
-    if (fscanf(dbvis,DB_NBLOCK,&nblocks) != 1 || part > nblocks)
+  if (Read_Block_Directory(pwd,root,part,&bdir,&block) == 0)   //  Current block directory
+    { cutoff  = bdir.cutoff;
+      all     = bdir.all;
+      indexed = (part > 0);
       if (part > 0)
-        { status = 1;
-          if (nblocks == 0)
-            fprintf(stderr,"%s: DB has not been partitioned\n",Prog_Name);
-          else
-            fprintf(stderr,"%s: DB has only %d blocks\n",Prog_Name,nblocks);
-          goto exit2;
+        { ofirst = block.ofirst;
+          bfirst = block.bfirst;
+          olast  = block.olast;
         }
       else
-        { cutoff = 0;
-          all    = 1;
+        { ofirst = bfirst = 0;
+          olast  = nreads;
         }
-    else
-      fscanf(dbvis,DB_PARAMS,&size,&cutoff,&all);
+    }
+  else
+    { int   p, nblocks, nfiles, blast;
+      int64 size;
+      char  buffer[2*MAX_NAME+100];
+
+      nblocks = 0;
+      fscanf(dbvis,DB_NFILE,&nfiles);
+      for (p = 0; p < nfiles; p++)
+        fgets(buffer,2*MAX_NAME+100,dbvis);
+      if (fscanf(dbvis,DB_NBLOCK,&nblocks) != 1 || part > nblocks)
+        if (part > 0)
+          { status = 1;
+            if (nblocks == 0)
+              fprintf(stderr,"%s: DB has not been partitioned\n",Prog_Name);
+            else
+              fprintf(stderr,"%s: DB has only %d blocks\n",Prog_Name,nblocks);
+            goto exit2;
+          }
+        else
+          { cutoff = 0;
+            all    = 1;
+          }
+      else
+        fscanf(dbvis,DB_PARAMS,&size,&cutoff,&all);
 
-    if (part > 0)
-      { for (p = 1; p <= part; p++)
-          fscanf(dbvis,DB_BDATA,&ofirst,&bfirst);
-        fscanf(dbvis,DB_BDATA,&olast,&blast);
-      }
-    else
-      { ofirst = bfirst = 0;
-        olast  = nreads;
-      }
-  }
+      if (part > 0)
+        { for (p = 1; p <= part; p++)
+            fscanf(dbvis,DB_BDATA,&ofirst,&bfirst);
+          fscanf(dbvis,DB_BDATA,&olast,&blast);
+        }
+      else
+        { ofirst = bfirst = 0;
+          olast  = nreads;
+        }
+      indexed = 0;
+    }
 
   db->trimmed = 0;
   db->tracks  = NULL;
@@ -395,9 +1337,37 @@ int Open_DB(char* path, HITS_DB *db)
   db->ofirst  = ofirst;
   db->bfirst  = bfirst;
 
+  if (mapped)
+    { map = (HITS_MAP *) Malloc(sizeof(HITS_MAP),"Allocating Open_DB mapping");
+      if (map == NULL)
+        { status = 1;
+          goto exit2;
+        }
+      map->idx = Map_File(Catenate(pwd,PATHSEP,root,".idx"),&(map->ilen),1);
+      if (map->idx == NULL)
+        { free(map);
+          status = 1;
+          goto exit2;
+        }
+      map->bps = Map_File(Catenate(pwd,PATHSEP,root,".bps"),&(map->blen),0);
+      if (map->bps == NULL && map->blen > 0)
+        { munmap(map->idx,map->ilen);
+          free(map);
+          status = 1;
+          goto exit2;
+        }
+    }
+  else
+    map = NULL;
+
   if (part <= 0)
-    { db->reads = (HITS_READ *) Malloc(sizeof(HITS_READ)*(nreads+1),"Allocating Open_DB index");
-      fread(db->reads,sizeof(HITS_READ),nreads,index);
+    { if (mapped)
+        db->reads = (HITS_READ *) (((char *) map->idx) + sizeof(HITS_DB));
+      else
+        { db->reads = (HITS_READ *) Malloc(sizeof(HITS_READ)*(nreads+1),
+                                           "Allocating Open_DB index");
+          fread(db->reads,sizeof(HITS_READ),nreads,index);
+        }
     }
   else
     { HITS_READ *reads;
@@ -405,16 +1375,27 @@ int Open_DB(char* path, HITS_DB *db)
       int64      totlen;
 
       nreads = olast-ofirst;
-      reads  = (HITS_READ *) Malloc(sizeof(HITS_READ)*(nreads+1),"Allocating Open_DB index");
-
-      fseeko(index,sizeof(HITS_READ)*ofirst,SEEK_CUR);
-      fread(reads,sizeof(HITS_READ),nreads,index);
+      if (mapped)
+        reads = (HITS_READ *) (((char *) map->idx) + sizeof(HITS_DB) + sizeof(HITS_READ)*ofirst);
+      else
+        { reads = (HITS_READ *) Malloc(sizeof(HITS_READ)*(nreads+1),"Allocating Open_DB index");
+          fseeko(index,sizeof(HITS_READ)*ofirst,SEEK_CUR);
+          fread(reads,sizeof(HITS_READ),nreads,index);
+        }
 
-      for (i = 0; i < nreads; i++)
-        { r = reads[i].end - reads[i].beg;
-          totlen += r;
-          if (r > maxlen)
-            maxlen = r;
+      if (indexed)
+        { totlen = block.totlen;
+          maxlen = block.maxlen;
+        }
+      else
+        { totlen = 0;
+          maxlen = 0;
+          for (i = 0; i < nreads; i++)
+            { r = reads[i].end - reads[i].beg;
+              totlen += r;
+              if (r > maxlen)
+                maxlen = r;
+            }
         }
 
       db->maxlen = maxlen;
@@ -424,8 +1405,9 @@ int Open_DB(char* path, HITS_DB *db)
 
   db->nreads = nreads;
   db->path   = Strdup(Catenate(pwd,PATHSEP,root,""),"Allocating Open_DB path");
-  db->bases  = NULL;
+  db->bases  = (void *) map;
   db->loaded = 0;
+  db->mapped = mapped;
 
 exit2:
   fclose(index);
@@ -438,10 +1420,19 @@ exit:
   return (status);
 }
 
+int Open_DB(char* path, HITS_DB *db)
+{ return (Open_DB_Mode(path,db,0)); }
+
+int Open_DB_Mapped(char* path, HITS_DB *db)
+{ return (Open_DB_Mode(path,db,1)); }
+
+
+static void Unmap_Track(HITS_TRACK *record, int nreads);
+static void Free_Track(HITS_TRACK *record);
 
 // Trim the DB or part thereof and all loaded tracks according to the cuttof and all settings
 //   of the current DB partition.  Reallocate smaller memory blocks for the information kept
-//   for the retained reads.
+//   for the retained reads.  Mapped tracks are first copied into memory.
 
 void Trim_DB(HITS_DB *db)
 { int         i, j, r;
@@ -478,6 +1469,9 @@ void Trim_DB(HITS_DB *db)
         int64 *anno8;
         void  *anno, *data;
 
+        if (record->map != NULL)
+          Unmap_Track(record,db->nreads);
+
         size = record->size;
         data = record->data; 
         if (data == NULL)
@@ -537,8 +1531,8 @@ void Trim_DB(HITS_DB *db)
   db->nreads  = j;
   db->trimmed = 1;
 
-  if (j < nreads)
-    reads = Realloc(reads,sizeof(HITS_READ)*(j+1),NULL);
+  if (j < nreads && ! db->mapped)
+    db->reads = Realloc(reads,sizeof(HITS_READ)*(j+1),NULL);
 }
 
 // Shut down an open 'db' by freeing all associated space, including tracks and QV structures, 
@@ -548,20 +1542,21 @@ void Trim_DB(HITS_DB *db)
 void Close_DB(HITS_DB *db)
 { HITS_TRACK *t, *p;
 
+  if ( ! db->mapped)
+    free(db->reads);
   if (db->loaded)
     free(((char *) (db->bases)) - 1);
+  else if (db->mapped)
+    Unmap_DB(db);
   else if (db->bases != NULL)
     fclose((FILE *) db->bases);
-  free(db->reads);
   free(db->path);
 
   Close_QVs(db);
 
   for (t = db->tracks; t != NULL; t = p)
     { p = t->next;
-      free(t->anno);
-      free(t->data);
-      free(t);
+      Free_Track(t);
     }
 }
 
@@ -732,7 +1727,6 @@ void Load_QVs(HITS_DB *db)
   }
 
   fclose(istub);
-  fclose(indx);
 }
 
 // Close the QV stream, free the QV pseudo track and all associated memory
@@ -765,6 +1759,19 @@ void Close_QVs(HITS_DB *db)
  *
  ********************************************************************************************/
 
+//  Add a track record to the db's track list (after the QV pseudo-track if present)
+
+static void Link_Track(HITS_DB *db, HITS_TRACK *record)
+{ if (db->tracks != NULL && strcmp(db->tracks->name,".@qvs") == 0)
+    { record->next     = db->tracks->next;
+      db->tracks->next = record;
+    }
+  else
+    { record->next = db->tracks;
+      db->tracks   = record;
+    }
+}
+
 // If track is not already in the db's track list, then allocate all the storage for it,
 //   read it in from the appropriate file, add it to the track list, and return a pointer
 //   to the newly created HITS_TRACK record.  If the track does not exist or cannot be
@@ -842,32 +1849,216 @@ HITS_TRACK *Load_Track(HITS_DB *db, char *track)
               fseeko(dfile,off8,SEEK_SET);
             }
           dlen = anno8[nreads];
-          data = (void *) Malloc(dlen,"Allocating Track Data Vector");
+          data = (void *) Malloc(dlen,"Allocating Track Data Vector");
+        }
+      fread(data,dlen,1,dfile);
+      fclose(dfile);
+    }
+  else
+    data = NULL;
+
+  fclose(afile);
+
+  record = (HITS_TRACK *) Malloc(sizeof(HITS_TRACK),"Allocating Track Record");
+  record->name = Strdup(track,"Allocating Track Name");
+  record->data = data;
+  record->anno = anno;
+  record->size = size;
+  record->base = 0;
+  record->map  = NULL;
+
+  Link_Track(db,record);
+  return (record);
+}
+
+//  When a track is mapped, its map field points at a TRACK_MAP record giving the private
+//    mappings of the spans of its .anno and .data files that cover the db (or block).
+
+typedef struct
+  { void  *amap;   //  Mapping of the span of the .anno file
+    int64  alen;   //  Its length in bytes
+    void  *dmap;   //  Mapping of the span of the .data file (NULL if none)
+    int64  dlen;   //  Its length in bytes
+  } TRACK_MAP;
+
+//  Map bytes [beg,end) of the file open on fd (of length flen) into *map of length *mlen,
+//    and return a pointer to byte beg therein, or NULL if this cannot be done.
+
+static void *Map_Span(int fd, int64 flen, int64 beg, int64 end, void **map, int64 *mlen)
+{ int64 moff;
+
+  if (beg >= end || end > flen)
+    return (NULL);
+  moff  = beg - beg % sysconf(_SC_PAGESIZE);
+  *mlen = end - moff;
+  *map  = mmap(NULL,*mlen,PROT_READ|PROT_WRITE,MAP_PRIVATE,fd,moff);
+  if (*map == MAP_FAILED)
+    { *map = NULL;
+      return (NULL);
+    }
+  return (((char *) *map) + (beg-moff));
+}
+
+HITS_TRACK *Load_Track_Mapped(HITS_DB *db, char *track)
+{ int         afd, dfd;
+  struct stat info;
+  int         head[2], size;
+  int64       first, alen, base, dend;
+  void       *anno, *data;
+  TRACK_MAP  *map;
+  HITS_TRACK *record;
+
+  if (track[0] == '.')
+    { fprintf(stderr,"Track names cannot begin with a .\n");
+      exit (1);
+    }
+
+  for (record = db->tracks; record != NULL; record = record->next)
+    if (strcmp(record->name,track) == 0)
+      return (record);
+
+  afd = open(Catenate(db->path,".",track,".anno"),O_RDONLY);
+  if (afd < 0)
+    return (Load_Track(db,track));    //  Reports the missing file
+  dfd = open(Catenate(db->path,".",track,".data"),O_RDONLY);
+
+  if (pread(afd,head,sizeof(int)*2,0) != sizeof(int)*2 || fstat(afd,&info) < 0)
+    goto unmapped;
+  size = head[1];
+  if (db->trimmed)
+    { if (head[0] != db->breads)
+        { fprintf(stderr,"%s: Track %s not same size as database !\n",Prog_Name,track);
+          exit (1);
+        }
+      first = db->bfirst;
+    }
+  else
+    { if (head[0] != db->oreads)
+        { fprintf(stderr,"%s: Track %s not same size as database !\n",Prog_Name,track);
+          exit (1);
+        }
+      first = db->ofirst;
+    }
+  if (db->part == 0)
+    first = 0;
+
+  map = (TRACK_MAP *) Malloc(sizeof(TRACK_MAP),"Allocating Track Mapping");
+  if (map == NULL)
+    goto unmapped;
+  map->dmap = NULL;
+
+  alen = size * (db->nreads+1ll);
+  anno = Map_Span(afd,info.st_size,sizeof(int)*2+size*first,sizeof(int)*2+size*first+alen,
+                  &(map->amap),&(map->alen));
+  if (anno == NULL)
+    { free(map);
+      goto unmapped;
+    }
+
+  base = 0;
+  data = NULL;
+  if (dfd >= 0)
+    { if (size == 4)
+        { base = ((int *) anno)[0];
+          dend = ((int *) anno)[db->nreads];
+        }
+      else
+        { base = ((int64 *) anno)[0];
+          dend = ((int64 *) anno)[db->nreads];
+        }
+      if (fstat(dfd,&info) >= 0)
+        data = Map_Span(dfd,info.st_size,base,dend,&(map->dmap),&(map->dlen));
+      if (data == NULL)
+        { munmap(map->amap,map->alen);
+          free(map);
+          goto unmapped;
+        }
+      close(dfd);
+    }
+  close(afd);
+
+  record = (HITS_TRACK *) Malloc(sizeof(HITS_TRACK),"Allocating Track Record");
+  record->name = Strdup(track,"Allocating Track Name");
+  record->data = data;
+  record->anno = anno;
+  record->size = size;
+  record->base = base;
+  record->map  = map;
+
+  Link_Track(db,record);
+  return (record);
+
+  //  The track (e.g. one with no data for the block) cannot be mapped: load it into memory
+
+unmapped:
+  close(afd);
+  if (dfd >= 0)
+    close(dfd);
+  return (Load_Track(db,track));
+}
+
+//  Replace the mappings of a mapped track over nreads reads by an in-memory copy whose
+//    anno entries are relative to the start of its data (i.e. base = 0).
+
+static void Unmap_Track(HITS_TRACK *record, int nreads)
+{ TRACK_MAP *map = (TRACK_MAP *) record->map;
+  void      *anno, *data;
+  int64      dlen;
+  int        i;
+
+  anno = Malloc(record->size*(nreads+1ll),"Allocating Track Anno Vector");
+  if (anno == NULL)
+    exit (1);
+  memcpy(anno,record->anno,record->size*(nreads+1ll));
+
+  data = NULL;
+  if (record->data != NULL)
+    { if (record->size == 4)
+        { int *anno4 = (int *) anno;
+
+          for (i = 0; i <= nreads; i++)
+            anno4[i] -= record->base;
+          dlen = anno4[nreads];
+        }
+      else
+        { int64 *anno8 = (int64 *) anno;
+
+          for (i = 0; i <= nreads; i++)
+            anno8[i] -= record->base;
+          dlen = anno8[nreads];
         }
-      fread(data,dlen,1,dfile);
-      fclose(dfile);
+      data = Malloc(dlen,"Allocating Track Data Vector");
+      if (data == NULL)
+        exit (1);
+      memcpy(data,record->data,dlen);
+      munmap(map->dmap,map->dlen);
     }
-  else
-    data = NULL;
-
-  fclose(afile);
+  munmap(map->amap,map->alen);
+  free(map);
 
-  record = (HITS_TRACK *) Malloc(sizeof(HITS_TRACK),"Allocating Track Record");
-  record->name = Strdup(track,"Allocating Track Name");
-  record->data = data;
   record->anno = anno;
-  record->size = size;
+  record->data = data;
+  record->base = 0;
+  record->map  = NULL;
+}
 
-  if (db->tracks != NULL && strcmp(db->tracks->name,".@qvs") == 0)
-    { record->next     = db->tracks->next;
-      db->tracks->next = record;
+//  Free the storage of a track record (mapped or not) and the record itself
+
+static void Free_Track(HITS_TRACK *record)
+{ TRACK_MAP *map = (TRACK_MAP *) record->map;
+
+  if (map != NULL)
+    { if (map->dmap != NULL)
+        munmap(map->dmap,map->dlen);
+      munmap(map->amap,map->alen);
+      free(map);
     }
   else
-    { record->next = db->tracks;
-      db->tracks   = record;
+    { free(record->anno);
+      free(record->data);
     }
-
-  return (record);
+  free(record->name);
+  free(record);
 }
 
 void Close_Track(HITS_DB *db, char *track)
@@ -876,14 +2067,11 @@ void Close_Track(HITS_DB *db, char *track)
   prev = NULL;
   for (record = db->tracks; record != NULL; record = record->next)
     { if (strcmp(record->name,track) == 0)
-        { free(record->anno);
-          free(record->data);
-          free(record->name);
-          if (prev == NULL)
+        { if (prev == NULL)
             db->tracks = record->next;
           else
             prev->next = record->next;
-          free(record);
+          Free_Track(record);
           return;
         }
       prev = record;
@@ -892,6 +2080,220 @@ void Close_Track(HITS_DB *db, char *track)
 }
 
 
+//  A lazy track handle: the .anno records of the db's (block's) reads start at offset aoff
+//    of the .anno file, and pages of the .anno and .data files are cached in page[] where
+//    each page remembers the time of its last use so the least recently used can be replaced.
+
+#define TRACK_PAGE   0x10000   //  Size of a page of a lazy track's cache
+#define TRACK_NPAGE  16        //  # of pages in a lazy track's cache
+
+typedef struct
+  { int    fd;      //  File the page is from (-1 if the page is empty)
+    int64  pno;     //  Page number in the file
+    int64  len;     //  # of bytes of the page in the file (< TRACK_PAGE at its end)
+    int64  used;    //  Time of last use
+    char  *buf;
+  } Track_Page;
+
+struct _lazy_track
+  { int         size;     //  Size in bytes of anno records
+    int         afd;      //  .anno file
+    int         dfd;      //  .data file (-1 if none)
+    int64       aoff;     //  Offset in .anno of the record of the first read
+    int         nreads;   //  # of reads of the db (block)
+    int64       clock;    //  # of page requests so far
+    Track_Page  page[TRACK_NPAGE];
+    char       *buf;      //  Assembles slices that cross a page boundary
+    int64       bmax;
+  };
+
+HITS_LAZY_TRACK *Open_Lazy_Track(HITS_DB *db, char *track)
+{ HITS_LAZY_TRACK *lazy;
+  char            *name;
+  int              head[2], first, p;
+
+  if (track[0] == '.')
+    { fprintf(stderr,"Track names cannot begin with a .\n");
+      exit (1);
+    }
+
+  name = Catenate(db->path,".",track,".anno");
+  lazy = (HITS_LAZY_TRACK *) Malloc(sizeof(HITS_LAZY_TRACK),"Allocating Lazy Track");
+  if (lazy == NULL)
+    return (NULL);
+  lazy->afd = open(name,O_RDONLY);
+  if (lazy->afd < 0)
+    { fprintf(stderr,"%s: Cannot open %s for 'r'\n",Prog_Name,name);
+      free(lazy);
+      return (NULL);
+    }
+  if (pread(lazy->afd,head,sizeof(int)*2,0) != sizeof(int)*2)
+    { fprintf(stderr,"%s: Cannot read header of %s\n",Prog_Name,name);
+      close(lazy->afd);
+      free(lazy);
+      return (NULL);
+    }
+
+  if (db->trimmed)
+    { if (head[0] != db->breads)
+        { fprintf(stderr,"%s: Track %s not same size as database !\n",Prog_Name,track);
+          exit (1);
+        }
+      first = db->bfirst;
+    }
+  else
+    { if (head[0] != db->oreads)
+        { fprintf(stderr,"%s: Track %s not same size as database !\n",Prog_Name,track);
+          exit (1);
+        }
+      first = db->ofirst;
+    }
+  if (db->part == 0)
+    first = 0;
+
+  lazy->size   = head[1];
+  lazy->aoff   = sizeof(int)*2 + lazy->size*((int64) first);
+  lazy->nreads = db->nreads;
+  lazy->dfd    = open(Catenate(db->path,".",track,".data"),O_RDONLY);
+  lazy->clock  = 0;
+  lazy->buf    = NULL;
+  lazy->bmax   = 0;
+  for (p = 0; p < TRACK_NPAGE; p++)
+    { lazy->page[p].fd  = -1;
+      lazy->page[p].buf = NULL;
+    }
+  return (lazy);
+}
+
+void Close_Lazy_Track(HITS_LAZY_TRACK *lazy)
+{ int p;
+
+  for (p = 0; p < TRACK_NPAGE; p++)
+    free(lazy->page[p].buf);
+  free(lazy->buf);
+  if (lazy->dfd >= 0)
+    close(lazy->dfd);
+  close(lazy->afd);
+  free(lazy);
+}
+
+//  Return the cache page holding page pno of file fd, reading it into the least recently
+//    used page if it is not present, or NULL if it could not be read.
+
+static Track_Page *Get_Track_Page(HITS_LAZY_TRACK *lazy, int fd, int64 pno)
+{ Track_Page *pg, *lru;
+  int         p;
+
+  lazy->clock += 1;
+  lru = lazy->page;
+  for (p = 0; p < TRACK_NPAGE; p++)
+    { pg = lazy->page + p;
+      if (pg->fd == fd && pg->pno == pno)
+        { pg->used = lazy->clock;
+          return (pg);
+        }
+      if (pg->fd < 0 || (lru->fd >= 0 && pg->used < lru->used))
+        lru = pg;
+    }
+
+  pg = lru;
+  if (pg->buf == NULL)
+    { pg->buf = (char *) Malloc(TRACK_PAGE,"Allocating Lazy Track Page");
+      if (pg->buf == NULL)
+        return (NULL);
+    }
+  pg->len = pread(fd,pg->buf,TRACK_PAGE,pno*TRACK_PAGE);
+  if (pg->len < 0)
+    { fprintf(stderr,"%s: Cannot read track file (Track_Get)\n",Prog_Name);
+      pg->fd = -1;
+      return (NULL);
+    }
+  pg->fd   = fd;
+  pg->pno  = pno;
+  pg->used = lazy->clock;
+  return (pg);
+}
+
+//  Set *ptr to bytes [off,off+len) of file fd: within its cache page if it lies in one,
+//    otherwise assembled in lazy->buf.  Return nonzero if they could not be read.
+
+static int Get_Track_Slice(HITS_LAZY_TRACK *lazy, int fd, int64 off, int64 len, void **ptr)
+{ Track_Page *pg;
+  int64       pno, beg, n, o;
+
+  pno = off / TRACK_PAGE;
+  beg = off % TRACK_PAGE;
+  if (beg + len <= TRACK_PAGE)
+    { pg = Get_Track_Page(lazy,fd,pno);
+      if (pg == NULL)
+        return (1);
+      if (beg + len > pg->len)
+        goto short_file;
+      *ptr = pg->buf + beg;
+      return (0);
+    }
+
+  if (len > lazy->bmax)
+    { lazy->bmax = 1.2*len + TRACK_PAGE;
+      lazy->buf  = (char *) Realloc(lazy->buf,lazy->bmax,"Allocating Lazy Track Buffer");
+      if (lazy->buf == NULL)
+        { lazy->bmax = 0;
+          return (1);
+        }
+    }
+  for (o = 0; o < len; o += n)
+    { pg = Get_Track_Page(lazy,fd,pno++);
+      if (pg == NULL)
+        return (1);
+      n = TRACK_PAGE - beg;
+      if (n > len-o)
+        n = len-o;
+      if (beg + n > pg->len)
+        goto short_file;
+      memcpy(lazy->buf+o,pg->buf+beg,n);
+      beg = 0;
+    }
+  *ptr = lazy->buf;
+  return (0);
+
+short_file:
+  fprintf(stderr,"%s: Track file is truncated (Track_Get)\n",Prog_Name);
+  return (1);
+}
+
+int Track_Get(HITS_LAZY_TRACK *lazy, int i, void **ptr, int64 *len)
+{ void  *anno;
+  int64  beg, end;
+
+  if (i < 0 || i >= lazy->nreads)
+    { fprintf(stderr,"%s: Index out of bounds (Track_Get)\n",Prog_Name);
+      exit (1);
+    }
+
+  if (lazy->dfd < 0)
+    { *len = lazy->size;
+      return (Get_Track_Slice(lazy,lazy->afd,lazy->aoff+lazy->size*((int64) i),lazy->size,ptr));
+    }
+
+  if (Get_Track_Slice(lazy,lazy->afd,lazy->aoff+lazy->size*((int64) i),2*lazy->size,&anno))
+    return (1);
+  if (lazy->size == 4)
+    { beg = ((int *) anno)[0];
+      end = ((int *) anno)[1];
+    }
+  else
+    { beg = ((int64 *) anno)[0];
+      end = ((int64 *) anno)[1];
+    }
+
+  *len = end-beg;
+  if (end <= beg)
+    { *ptr = NULL;
+      return (0);
+    }
+  return (Get_Track_Slice(lazy,lazy->dfd,beg,end-beg,ptr));
+}
+
 /*******************************************************************************************
  *
  *  READ BUFFER ALLOCATION AND READ ACCESS
@@ -910,6 +2312,20 @@ char *New_Read_Buffer(HITS_DB *db)
   return (read+1);
 }
 
+// Uncompress the len bases just fetched into 'read' and convert them as per ascii (see
+//   Load_Read below), setting the delimiter bytes at either end.
+
+static void Finish_Read(int len, char *read, int ascii)
+{ if (ascii == 1 || ascii == 2)
+    { Uncompress_Read_Ascii(len,read,ascii);
+      read[-1] = '\0';
+    }
+  else
+    { Uncompress_Read(len,read);
+      read[-1] = 4;
+    }
+}
+
 // Load into 'read' the i'th read in 'db'.  As an upper case ASCII string if ascii is 2, as a
 //   lower-case ASCII string is ascii is 1, and as a numeric string over 0(A), 1(C), 2(G), and
 //   3(T) otherwise.
@@ -935,20 +2351,14 @@ void Load_Read(HITS_DB *db, int i, char *read, int ascii)
   off = r[i].boff;
   len = r[i].end - r[i].beg;
 
-  if (ftello(bases) != off)
-    fseeko(bases,off,SEEK_SET);
-  fread(read,1,COMPRESSED_LEN(len),bases);
-  Uncompress_Read(len,read);
-  if (ascii == 1)
-    { Lower_Read(read);
-      read[-1] = '\0';
-    }
-  else if (ascii == 2)
-    { Upper_Read(read);
-      read[-1] = '\0';
-    }
+  if (db->mapped)
+    memcpy(read,((HITS_MAP *) bases)->bps + off,COMPRESSED_LEN(len));
   else
-    read[-1] = 4;
+    { if (ftello(bases) != off)
+        fseeko(bases,off,SEEK_SET);
+      fread(read,1,COMPRESSED_LEN(len),bases);
+    }
+  Finish_Read(len,read,ascii);
 }
 
 
@@ -974,6 +2384,26 @@ char **New_QV_Buffer(HITS_DB *db)
   return (entry);
 }
 
+// Convert the lower case deletion tags in deltag[0..rlen-1] as per ascii (see Load_Read)
+
+static void Convert_Deltag(char *deltag, int rlen, int ascii)
+{ if (ascii != 1)
+    { if (ascii != 2)
+        { int x = deltag[rlen];
+          deltag[rlen] = '\0';
+          Number_Read(deltag);
+          deltag[rlen] = x;
+        }
+      else
+        { int i;
+          int u = 'A'-'a';
+
+          for (i = 0; i < rlen; i++)
+            deltag[i] += u;
+        }
+    }
+}
+
 // Load into entry the QV streams for the i'th read from db.  The parameter ascii applies to
 //  the DELTAG stream as described for Load_Read.
 
@@ -1001,24 +2431,272 @@ void Load_QVentry(HITS_DB *db, int i, char **entry, int ascii)
 
   fseeko(quiva,reads[i].coff,SEEK_SET);
   Uncompress_Next_QVentry(quiva,entry,Active_QV->coding+Active_QV->table[i],rlen);
+  Convert_Deltag(entry[1],rlen,ascii);
+}
 
-  if (ascii != 1)
-    { char *deltag = entry[1];
 
-      if (ascii != 2)
-        { int x = deltag[rlen];
-          deltag[rlen] = '\0';
-          Number_Read(deltag);
-          deltag[rlen] = x;
+/*******************************************************************************************
+ *
+ *  THREAD-SAFE READ AND QV ACCESS
+ *
+ ********************************************************************************************/
+
+// Open a reader on 'db' with its own file descriptor on the .bps file (unless the db is
+//   mapped in which case reads are decoded from the shared mapping), its own stream on the
+//   .qvs file (opened on the first QV request), and its own read and QV buffers.  Returns
+//   NULL if the .bps file cannot be opened.
+
+HITS_READER *Open_Reader(HITS_DB *db)
+{ HITS_READER *rdr;
+  char        *name;
+
+  if (db->loaded)
+    { fprintf(stderr,"%s: Reads are already loaded in memory (Open_Reader)\n",Prog_Name);
+      return (NULL);
+    }
+
+  rdr = (HITS_READER *) Malloc(sizeof(HITS_READER),"Allocating reader");
+  if (rdr == NULL)
+    return (NULL);
+  rdr->db    = db;
+  rdr->quiva = NULL;
+  rdr->entry = NULL;
+  rdr->qvctx = NULL;
+  rdr->read  = New_Read_Buffer(db);
+
+  if (db->mapped)
+    rdr->bases = -1;
+  else
+    { name = (char *) Malloc(strlen(db->path)+5,"Allocating reader");
+      if (name == NULL)
+        { free(rdr->read-1);
+          free(rdr);
+          return (NULL);
         }
-      else
-        { int i;
-          int u = 'A'-'a';
+      sprintf(name,"%s.bps",db->path);
+      rdr->bases = open(name,O_RDONLY);
+      if (rdr->bases < 0)
+        { fprintf(stderr,"%s: Cannot open %s for 'r'\n",Prog_Name,name);
+          free(name);
+          free(rdr->read-1);
+          free(rdr);
+          return (NULL);
+        }
+      free(name);
+    }
 
-          for (i = 0; i < rlen; i++)
-            deltag[i] += u;
+  return (rdr);
+}
+
+// Free all the buffers of reader 'rdr' and close its files
+
+void Close_Reader(HITS_READER *rdr)
+{ if (rdr->bases >= 0)
+    close(rdr->bases);
+  if (rdr->quiva != NULL)
+    fclose(rdr->quiva);
+  if (rdr->qvctx != NULL)
+    QV_Free(rdr->qvctx);
+  if (rdr->entry != NULL)
+    { free(rdr->entry[0]);
+      free(rdr->entry);
+    }
+  free(rdr->read-1);
+  free(rdr);
+}
+
+// As Load_Read, but into the reader's own buffer which is returned.  The fetch is a pread
+//   (or a copy from the mapping) so no file position is shared with any other reader.
+
+char *Reader_Load_Read(HITS_READER *rdr, int i, int ascii)
+{ HITS_DB   *db   = rdr->db;
+  char      *read = rdr->read;
+  HITS_READ *r;
+  int64      off;
+  int        len, clen;
+
+  if (i >= db->nreads)
+    { fprintf(stderr,"%s: Index out of bounds (Reader_Load_Read)\n",Prog_Name);
+      exit (1);
+    }
+
+  r    = db->reads + i;
+  off  = r->boff;
+  len  = r->end - r->beg;
+  clen = COMPRESSED_LEN(len);
+
+  if (db->mapped)
+    memcpy(read,((HITS_MAP *) db->bases)->bps + off,clen);
+  else if (pread(rdr->bases,read,clen,off) != clen)
+    { fprintf(stderr,"%s: Could not read sequence of read %d (Reader_Load_Read)\n",
+                     Prog_Name,i);
+      exit (1);
+    }
+  Finish_Read(len,read,ascii);
+  return (read);
+}
+
+// As Load_QVentry, but into the reader's own QV buffer which is returned.  The QV
+//   pseudo-track must have been loaded (Load_QVs) before any reader asks for QVs and
+//   must not be closed while readers are active.
+
+char **Reader_Load_QVentry(HITS_READER *rdr, int i, int ascii)
+{ HITS_DB   *db = rdr->db;
+  HITS_QV   *qvtrk;
+  HITS_READ *r;
+  int        rlen;
+
+  if (db->tracks == NULL || strcmp(db->tracks->name,".@qvs") != 0)
+    { fprintf(stderr,"%s: QV's are not loaded!\n",Prog_Name);
+      exit (1);
+    }
+  if (i >= db->nreads)
+    { fprintf(stderr,"%s: Index out of bounds (Reader_Load_QVentry)\n",Prog_Name);
+      exit (1);
+    }
+  qvtrk = (HITS_QV *) db->tracks;
+
+  if (rdr->quiva == NULL)
+    { char *name;
+
+      name = (char *) Malloc(strlen(db->path)+5,"Allocating reader");
+      if (name == NULL)
+        exit (1);
+      sprintf(name,"%s.qvs",db->path);
+      rdr->quiva = Fopen(name,"r");
+      if (rdr->quiva == NULL)
+        exit (1);
+      free(name);
+      rdr->entry = New_QV_Buffer(db);
+      rdr->qvctx = QV_New();
+    }
+
+  r    = db->reads + i;
+  rlen = r->end - r->beg;
+
+  fseeko(rdr->quiva,r->coff,SEEK_SET);
+  QV_Uncompress(rdr->qvctx,rdr->quiva,rdr->entry,qvtrk->coding+qvtrk->table[i],rlen);
+  Convert_Deltag(rdr->entry[1],rlen,ascii);
+  return (rdr->entry);
+}
+
+// Decode the QV entries of reads [first,last) into out with nthreads threads.  The .qvs file
+//   is mapped into memory and each thread decodes a contiguous range of reads (with about the
+//   same number of QVs as the others) directly from the mapping, placing each stream at its
+//   final position in out.
+
+typedef struct
+  { HITS_DB  *db;
+    char     *qvs;      //  The mapped .qvs file of length qlen
+    int64     qlen;
+    int       beg;      //  Decode reads [beg,end) ...
+    int       end;
+    int64     o;        //  ... into out[0..4] starting at offset o
+    char    **out;
+    int       ascii;
+  } QV_Arg;
+
+static void *qv_thread(void *arg)
+{ QV_Arg    *data  = (QV_Arg *) arg;
+  HITS_READ *reads = data->db->reads;
+  HITS_QV   *qvtrk = (HITS_QV *) data->db->tracks;
+  char     **out   = data->out;
+  char      *entry[5];
+  int64      o, coff;
+  int        i, k, rlen;
+
+  o = data->o;
+  for (i = data->beg; i < data->end; i++)
+    { rlen = reads[i].end - reads[i].beg;
+      coff = reads[i].coff;
+      for (k = 0; k < 5; k++)
+        entry[k] = out[k] + o;
+      if (coff > data->qlen)
+        coff = data->qlen;
+      Uncompress_QVentry(data->qvs+coff,data->qlen-coff,entry,
+                         qvtrk->coding+qvtrk->table[i],rlen);
+      Convert_Deltag(entry[1],rlen,data->ascii);
+      for (k = 0; k < 5; k++)
+        entry[k][rlen] = '\0';
+      o += rlen+1;
+    }
+
+  return (NULL);
+}
+
+void Load_QVentries(HITS_DB *db, int first, int last, char **out, int ascii, int nthreads)
+{ HITS_READ *reads = db->reads;
+  QV_Arg    *parm;
+  pthread_t *threads;
+  char      *qvs;
+  int64      qlen, o, avail;
+  int        i, t, u;
+
+  if (db->tracks == NULL || strcmp(db->tracks->name,".@qvs") != 0)
+    { fprintf(stderr,"%s: QV's are not loaded!\n",Prog_Name);
+      exit (1);
+    }
+  if (first < 0 || last > db->nreads || first > last)
+    { fprintf(stderr,"%s: Index out of bounds (Load_QVentries)\n",Prog_Name);
+      exit (1);
+    }
+  if (first == last)
+    return;
+
+  qvs = (char *) Map_File(Catenate(db->path,"","",".qvs"),&qlen,0);
+  if (qvs == NULL)
+    exit (1);
+
+  if (nthreads < 1)
+    nthreads = 1;
+  if (nthreads > last-first)
+    nthreads = last-first;
+
+  parm    = (QV_Arg *) Malloc(sizeof(QV_Arg)*nthreads,"Allocating QV threads");
+  threads = (pthread_t *) Malloc(sizeof(pthread_t)*nthreads,"Allocating QV threads");
+  if (parm == NULL || threads == NULL)
+    exit (1);
+
+  avail = 0;
+  for (i = first; i < last; i++)
+    avail += (reads[i].end - reads[i].beg) + 1;
+
+  o = 0;
+  t = 0;
+  parm[0].beg = first;
+  parm[0].o   = 0;
+  for (i = first; i < last; i++)
+    { o += (reads[i].end - reads[i].beg) + 1;
+      if (o >= ((t+1)*avail)/nthreads && t < nthreads-1)
+        { parm[t].end = i+1;
+          t += 1;
+          parm[t].beg = i+1;
+          parm[t].o   = o;
         }
     }
+  parm[t].end = last;
+  nthreads    = t+1;
+
+  for (t = 0; t < nthreads; t++)
+    { parm[t].db    = db;
+      parm[t].qvs   = qvs;
+      parm[t].qlen  = qlen;
+      parm[t].out   = out;
+      parm[t].ascii = ascii;
+    }
+
+  for (t = 1; t < nthreads; t++)
+    if (pthread_create(threads+t,NULL,qv_thread,parm+t) != 0)
+      break;
+  for (u = t; u < nthreads; u++)      //  Run here any range no thread could be created for
+    qv_thread(parm+u);
+  qv_thread(parm);
+  for (u = 1; u < t; u++)
+    pthread_join(threads[u],NULL);
+
+  munmap(qvs,qlen);
+  free(threads);
+  free(parm);
 }
 
 
@@ -1038,42 +2716,235 @@ void Read_All_Sequences(HITS_DB *db, int ascii)
 { FILE      *bases  = (FILE *) db->bases;
   int        nreads = db->nreads;
   HITS_READ *reads = db->reads;
-  void     (*translate)(char *s);
 
-  char  *seq;
+  char  *seq, *bps;
   int64  o, off;
   int    i, len;
 
-  if (bases == NULL)
-    db->bases = (void *) (bases = Fopen(Catenate(db->path,"","",".bps"),"r"));
+  if (db->mapped)
+    bps = ((HITS_MAP *) bases)->bps;
   else
-    rewind(bases);
+    { if (bases == NULL)
+        db->bases = (void *) (bases = Fopen(Catenate(db->path,"","",".bps"),"r"));
+      else
+        rewind(bases);
+      bps = NULL;
+    }
 
   seq = (char *) Malloc(db->totlen+nreads+4,"Allocating All Sequence Reads");
 
   *seq++ = 4;
 
-  if (ascii == 1)
-    translate = Lower_Read;
-  else
-    translate = Upper_Read;
-
   o = 0;
   for (i = 0; i < nreads; i++)
     { len = reads[i].end - reads[i].beg;
       off = reads[i].boff;
-      if (ftello(bases) != off)
-        fseeko(bases,off,SEEK_SET);
-      fread(seq+o,1,COMPRESSED_LEN(len),bases);
-      Uncompress_Read(len,seq+o);
-      if (ascii)
-        translate(seq+o);
+      if (bps != NULL)
+        memcpy(seq+o,bps+off,COMPRESSED_LEN(len));
+      else
+        { if (ftello(bases) != off)
+            fseeko(bases,off,SEEK_SET);
+          fread(seq+o,1,COMPRESSED_LEN(len),bases);
+        }
+      Uncompress_Read_Ascii(len,seq+o,ascii);
+      reads[i].boff = o;
+      o += (len+1);
+    }
+
+  //  A mapped db is no longer needed once all the reads are in memory: copy the read
+  //    records (plus the sentinel) out of the private .idx mapping and release it.
+
+  if (db->mapped)
+    { reads = (HITS_READ *) Malloc(sizeof(HITS_READ)*(nreads+1),"Allocating All Sequence Reads");
+      if (reads == NULL)
+        exit (1);
+      memcpy(reads,db->reads,sizeof(HITS_READ)*nreads);
+      Unmap_DB(db);
+      db->reads = reads;
+    }
+  else
+    fclose(bases);
+
+  reads[nreads].boff = o;
+
+  db->bases  = (void *) seq;
+  db->loaded = 1;
+}
+
+//  The parallel variant: the in-memory offset of each read is a prefix sum of the read
+//    lengths, so the reads are cut into nthreads ranges of roughly equal numbers of bases
+//    and each range is independently copied and uncompressed by its own thread from a
+//    single mapping (or failing that, a single sequential read) of the .bps span of the block.
+
+typedef struct
+  { HITS_READ *reads;    //  Reads [beg,end) are the responsibility of this thread
+    int        beg;
+    int        end;
+    char      *bps;      //  Compressed bases of the span, bps[0] is at file offset 'first'
+    int64      first;
+    char      *seq;      //  Uncompressed reads start at seq+o
+    int64      o;
+    int        ascii;
+  } Load_Arg;
+
+static void *load_thread(void *arg)
+{ Load_Arg  *data  = (Load_Arg *) arg;
+  HITS_READ *reads = data->reads;
+  char      *bps   = data->bps - data->first;
+  char      *seq   = data->seq;
+  int        ascii = data->ascii;
+  int64      o;
+  int        i, len;
+
+  o = data->o;
+  for (i = data->beg; i < data->end; i++)
+    { len = reads[i].end - reads[i].beg;
+      memcpy(seq+o,bps+reads[i].boff,COMPRESSED_LEN(len));
+      Uncompress_Read_Ascii(len,seq+o,ascii);
       reads[i].boff = o;
       o += (len+1);
     }
+  return (NULL);
+}
+
+void Read_All_Sequences_Parallel(HITS_DB *db, int ascii, int nthreads)
+{ int        nreads = db->nreads;
+  HITS_READ *reads  = db->reads;
+  FILE      *bases  = (FILE *) db->bases;
+
+  Load_Arg  *parm;
+  pthread_t *threads;
+
+  char  *seq, *bps, *span;
+  int64  o, first, last, moff, mlen, avail;
+  int    i, t, u, len;
+
+  if (nthreads <= 1 || nreads <= 1)
+    { Read_All_Sequences(db,ascii);
+      return;
+    }
+  if (nthreads > nreads)
+    nthreads = nreads;
+
+  //  Determine the extent of the block's bases in the .bps file and get at them
+
+  first = reads[0].boff;
+  last  = first;
+  o     = 0;
+  for (i = 0; i < nreads; i++)
+    { len = reads[i].end - reads[i].beg;
+      if (reads[i].boff < first)
+        first = reads[i].boff;
+      if (reads[i].boff + COMPRESSED_LEN(len) > last)
+        last = reads[i].boff + COMPRESSED_LEN(len);
+      o += (len+1);
+    }
+
+  span = NULL;
+  mlen = 0;
+  if (db->mapped)
+    { bps  = ((HITS_MAP *) bases)->bps + first;
+      moff = first;
+    }
+  else
+    { char *name = Catenate(db->path,"","",".bps");
+      int   fd;
+
+      if (bases != NULL)
+        { fclose(bases);
+          db->bases = NULL;
+        }
+      if ((fd = open(name,O_RDONLY)) < 0)
+        { fprintf(stderr,"%s: Cannot open %s for 'r'\n",Prog_Name,name);
+          exit (1);
+        }
+      moff = first - first % sysconf(_SC_PAGESIZE);
+      mlen = last - moff;
+      span = mmap(NULL,mlen,PROT_READ,MAP_PRIVATE,fd,moff);
+      if (span == MAP_FAILED)
+        { mlen = 0;
+          span = (char *) Malloc(last-first,"Allocating All Sequence Reads");
+          if (span == NULL)
+            exit (1);
+          if (pread(fd,span,last-first,first) != last-first)
+            { fprintf(stderr,"%s: Cannot read %s\n",Prog_Name,name);
+              exit (1);
+            }
+          bps = span;
+        }
+      else
+        { madvise(span,mlen,MADV_WILLNEED);
+          bps = span + (first-moff);
+        }
+      close(fd);
+    }
+
+  seq = (char *) Malloc(o+4,"Allocating All Sequence Reads");
+  parm    = (Load_Arg *) Malloc(sizeof(Load_Arg)*nthreads,"Allocating All Sequence Reads");
+  threads = (pthread_t *) Malloc(sizeof(pthread_t)*nthreads,"Allocating All Sequence Reads");
+  if (seq == NULL || parm == NULL || threads == NULL)
+    exit (1);
+
+  *seq++ = 4;
+
+  //  Cut the reads into nthreads ranges of about o/nthreads bytes each
+
+  avail = o;
+  o = 0;
+  t = 0;
+  parm[0].beg = 0;
+  parm[0].o   = 0;
+  for (i = 0; i < nreads; i++)
+    { o += (reads[i].end - reads[i].beg) + 1;
+      if (o >= ((t+1)*avail)/nthreads && t < nthreads-1)
+        { parm[t].end = i+1;
+          t += 1;
+          parm[t].beg = i+1;
+          parm[t].o   = o;
+        }
+    }
+  parm[t].end = nreads;
+  nthreads    = t+1;
+
+  for (t = 0; t < nthreads; t++)
+    { parm[t].reads = reads;
+      parm[t].bps   = bps;
+      parm[t].first = first;
+      parm[t].seq   = seq;
+      parm[t].ascii = ascii;
+    }
+
+  if (db->mapped)
+    { reads = (HITS_READ *) Malloc(sizeof(HITS_READ)*(nreads+1),"Allocating All Sequence Reads");
+      if (reads == NULL)
+        exit (1);
+      memcpy(reads,db->reads,sizeof(HITS_READ)*nreads);
+      for (t = 0; t < nthreads; t++)
+        parm[t].reads = reads;
+    }
+
+  for (t = 1; t < nthreads; t++)
+    if (pthread_create(threads+t,NULL,load_thread,parm+t) != 0)
+      break;
+  for (u = t; u < nthreads; u++)      //  Run here any range no thread could be created for
+    load_thread(parm+u);
+  load_thread(parm);
+  for (u = 1; u < t; u++)
+    pthread_join(threads[u],NULL);
+
+  if (db->mapped)
+    { Unmap_DB(db);
+      db->reads = reads;
+    }
+  else if (mlen > 0)
+    munmap(span,mlen);
+  else
+    free(span);
+
   reads[nreads].boff = o;
 
-  fclose(bases);
+  free(threads);
+  free(parm);
 
   db->bases  = (void *) seq;
   db->loaded = 1;
@@ -18,8 +18,6 @@
 
 #include <stdio.h>
 
-#include "QV.h"
-
 typedef unsigned char      uint8;
 typedef unsigned short     uint16;
 typedef unsigned int       uint32;
@@ -31,6 +29,8 @@ typedef signed long long   int64;
 typedef float              float32;
 typedef double             float64;
 
+#include "QV.h"
+
 #define HIDE_FILES          //  Auxiliary DB files start with a . so they are "hidden"
                             //    Undefine if you don't want this
 
@@ -124,10 +124,22 @@ void   Compress_Read(int len, char *s);   //  Compress read in-place into 2-bit
 void Uncompress_Read(int len, char *s);   //  Uncompress read in-place into numeric form
 void      Print_Read(char *s, int width);
 
+  //  Uncompress read in-place directly into numeric form (ascii = 0), lowercase letters
+  //    (ascii = 1), or uppercase letters (ascii = 2), terminating it with a 4 or '\0',
+  //    respectively.  Uses SSE2/AVX2 kernels where the machine has them.
+
+void Uncompress_Read_Ascii(int len, char *s, int ascii);
+
 void Lower_Read(char *s);     //  Convert read from numbers to lowercase letters (0-3 to acgt)
 void Upper_Read(char *s);     //  Convert read from numbers to uppercase letters (0-3 to ACGT)
 void Number_Read(char *s);    //  Convert read from letters to numbers
 
+  //  Convert s[0..len-1] from letters to numbers in-place (ending it with a 4), and if count is
+  //    not NULL add the number of a|A's, c|C's, g|G's, and t|T's to count[0..3] (any other
+  //    symbol is converted to, and counted as, an a).
+
+void Number_Read_Count(int len, char *s, int64 *count);
+
 
 /*******************************************************************************************
  *
@@ -151,17 +163,23 @@ typedef struct
 
 //  A track can be of 3 types:
 //    data == NULL: there are nreads+1 'anno' records of size 'size'.
-//    data != NULL && size == 4: anno is an array of nreads+1 int's and data[anno[i]..anno[i+1])
-//                                    contains the variable length data
-//    data != NULL && size == 8: anno is an array of nreads+1 int64's and data[anno[i]..anno[i+1])
-//                                    contains the variable length data
+//    data != NULL && size == 4: anno is an array of nreads+1 int's and
+//                                    data[anno[i]-base..anno[i+1]-base) contains the variable
+//                                    length data
+//    data != NULL && size == 8: anno is an array of nreads+1 int64's and
+//                                    data[anno[i]-base..anno[i+1]-base) contains the variable
+//                                    length data
+//  base is 0 unless the track was loaded with Load_Track_Mapped, in which case it is the
+//    offset in the .data file of the data of the first read of the block.
 
 typedef struct _track
   { struct _track *next;  //  Link to next track
     char          *name;  //  Symbolic name of track
     int            size;  //  Size in bytes of anno records
     void          *anno;  //  over [0,nreads]: read i annotation: int, int64, or 'size' records 
-    void          *data;  //     data[anno[i] .. anno[i+1]-1] is data if data != NULL
+    void          *data;  //     data[anno[i]-base .. anno[i+1]-1-base] is data if data != NULL
+    int64          base;  //  Offset subtracted from anno entries to index data
+    void          *map;   //  Record of the file mappings of anno & data (NULL if in memory)
   } HITS_TRACK;
 
 //  The information for accessing QV streams is in a HITS_QV record that is a "pseudo-track"
@@ -203,8 +221,10 @@ typedef struct
 
     char       *path;       //  Root name of DB for .bps and tracks
     int         loaded;     //  Are reads loaded in memory?
+    int         mapped;     //  Are .bps and .idx memory mapped (see Open_DB_Mapped)?
     void       *bases;      //  file pointer for bases file (to fetch reads from),
-                            //    or memory pointer to uncompressed block of all sequences.
+                            //    or memory pointer to uncompressed block of all sequences,
+                            //    or the record of the file mappings if mapped.
     HITS_READ  *reads;      //  Array [0..nreads] of HITS_READ
     HITS_TRACK *tracks;     //  Linked list of loaded tracks
   } HITS_DB; 
@@ -225,6 +245,39 @@ typedef struct
 #define DB_BDATA  " %9d %9d\n"      //  First read index (untrimmed), first read index (trimmed)
 
 
+/*******************************************************************************************
+ *
+ *  DB BLOCK DIRECTORY FORMAT = HITS_BDIR HITS_BLOCK^nblocks   (binary file .[root].bdir)
+ *
+ ********************************************************************************************/
+
+#define BDIR_MAGIC    0x72696462   //  "bdir"
+#define BDIR_VERSION  1
+
+typedef struct
+  { int    magic;       //  BDIR_MAGIC
+    int    version;     //  BDIR_VERSION
+    int64  stamp[3];    //  Size and modification time (sec,nsec) of the stub when written
+    int64  size;        //  Partition parameters as in DB_PARAMS
+    int    cutoff;
+    int    all;
+    int    nblocks;     //  Number of blocks
+    int    pad;
+  } HITS_BDIR;
+
+typedef struct
+  { int    ofirst;      //  Reads [ofirst,olast) of the .idx are in the block
+    int    olast;
+    int    bfirst;      //  Reads [bfirst,blast) of the trimmed DB are in the block
+    int    blast;
+    int64  bbeg;        //  The bases of the block are in [bbeg,bend) of the .bps file
+    int64  bend;
+    int64  totlen;      //  Total and maximum read length of the (untrimmed) block
+    int    maxlen;
+    int    pad;
+  } HITS_BLOCK;
+
+
 /*******************************************************************************************
  *
  *  DB ROUTINES
@@ -242,6 +295,54 @@ typedef struct
 
 int Open_DB(char *path, HITS_DB *db);
 
+  // Exactly like Open_DB, except that the .idx and .bps files are memory mapped read-only
+  //   instead of being read/fetched through stdio.  The read records of the db (or part)
+  //   are a private (copy-on-write) view of the mapped index, and Load_Read decodes
+  //   directly from the mapped base pairs without any seeks.  Concurrent processes on the
+  //   same DB thus share a single page-cache copy of these files.
+
+int Open_DB_Mapped(char *path, HITS_DB *db);
+
+  // Write the block directory .[root].bdir of the partition in the stub of the DB "path",
+  //   where db is the entire, untrimmed DB just opened from it.  It has a fixed-size record
+  //   of each block's read ranges, .bps span, and read length statistics, so that while it
+  //   is current (the stub has not been changed since), Open_DB finds a block with a single
+  //   seek in place of scanning the stub, and without a pass over its reads.  Return non-zero
+  //   if the file could not be written.
+
+int Write_Block_Directory(char *path, HITS_DB *db);
+
+  // The summary of a range of reads [first,last) of the untrimmed DB: the number of reads,
+  //   total and maximum read length, and for s = 0 (all reads) and s = 1 (the best read of
+  //   each well) the exact length histograms count[s][0..maxlen] and wells[s][0..maxlen],
+  //   where wells[s][l] is the number of wells (runs of reads with the same origin) whose
+  //   longest read (best read) has length l.  Any statistic of the reads of a length
+  //   cutoff or more, for either choice of reads, can thus be computed from a summary.
+
+typedef struct
+  { int     first, last;
+    int     nreads;
+    int     maxlen;
+    int64   totlen;
+    int64  *count[2];
+    int64  *wells[2];
+  } HITS_SUMMARY;
+
+  // Write the summary file .[root].stats of the DB "path", where db is the entire,
+  //   untrimmed DB just opened from it.  It holds the summary of unit 0, the entire DB, of
+  //   units 1..nblocks, the blocks of the current partition (if any), and of units
+  //   nblocks+1..nblocks+nfiles, the reads of each file added to the DB.  fasta2DB and
+  //   DBsplit keep it up to date.  Return non-zero if the file could not be written.
+
+int Write_DB_Summary(char *path, HITS_DB *db);
+
+  // Return the summary of the given unit of the DB "path" from its summary file, or NULL if
+  //   there is no such unit or no summary file that is current (neither the .idx nor the
+  //   stub has been changed since it was written).  Free_DB_Summary frees a summary.
+
+HITS_SUMMARY *Read_DB_Summary(char *path, int unit);
+void          Free_DB_Summary(HITS_SUMMARY *sum);
+
   // Trim the DB or part thereof and all loaded tracks according to the cuttof and all settings
   //   of the current DB partition.  Reallocate smaller memory blocks for the information kept
   //   for the retained reads.
@@ -270,11 +371,43 @@ void Close_QVs(HITS_DB *db);
 
 HITS_TRACK *Load_Track(HITS_DB *db, char *track);
 
+  // Exactly like Load_Track, except that the block's range of the track's .anno and .data
+  //   files are memory mapped (privately) instead of being allocated and read in, and the
+  //   anno entries are left as they are in the file with base set to the first of them.
+  //   Loading is then nearly instant and concurrent processes on the same track share a
+  //   single page-cache copy of it.  If the files cannot be mapped, the track is loaded as
+  //   by Load_Track.
+
+HITS_TRACK *Load_Track_Mapped(HITS_DB *db, char *track);
+
   // If track is on the db's track list, then it is removed and all storage associated with it
   //   is freed.
 
 void Close_Track(HITS_DB *db, char *track);
 
+  // A lazy track handle gives random access to the annotation of individual reads of the
+  //   db (or block) without loading the track: Track_Get reads just the slice of the .anno
+  //   and .data files for the requested read, through a small LRU cache of fixed-size pages
+  //   of the two files.  Opening a handle costs little more than opening the files, and the
+  //   track can be far larger than memory.  As for Load_Track, the track must cover exactly
+  //   the reads of the db (trimmed or not).  A handle is not on the db's track list, is not
+  //   affected by Trim_DB, and must not be shared by threads (give each its own).
+
+typedef struct _lazy_track HITS_LAZY_TRACK;
+
+  // Open a lazy handle on the track, returning NULL if it does not exist or cannot be opened.
+  //   Close_Lazy_Track closes the files of the handle and frees it.
+
+HITS_LAZY_TRACK *Open_Lazy_Track(HITS_DB *db, char *track);
+void             Close_Lazy_Track(HITS_LAZY_TRACK *track);
+
+  // Set *ptr and *len to the data of read i of the track and its length in bytes, or if the
+  //   track has no .data file, to the anno record of read i and the size of a record.  The
+  //   slice is only valid until the next call on the handle (*ptr is NULL if *len is 0).
+  //   Return nonzero if the files could not be read (which is reported).
+
+int              Track_Get(HITS_LAZY_TRACK *track, int i, void **ptr, int64 *len);
+
   // Allocate and return a buffer big enough for the largest read in 'db'.
   // **NB** free(x-1) if x is the value returned as *prefix* and suffix '\0'(4)-byte
   // are needed by the alignment algorithms.
@@ -304,6 +437,42 @@ char **New_QV_Buffer(HITS_DB *db);
 
 void   Load_QVentry(HITS_DB *db, int i, char **entry, int ascii);
 
+  // Load_Read and Load_QVentry share the file positions of db and so cannot be called
+  //   concurrently.  A HITS_READER is a per-thread handle on an open db with its own file
+  //   descriptors and buffers, so that any number of threads can fetch reads and QVs from
+  //   the same db at once, each through its own reader.  The db must not be trimmed,
+  //   have QVs loaded/closed, or be closed while readers are active on it.
+
+typedef struct
+  { HITS_DB   *db;      //  The db read from
+    int        bases;   //  File descriptor of .bps (-1 if db is mapped)
+    FILE      *quiva;   //  Private stream on .qvs (opened on the first QV request)
+    char      *read;    //  Read buffer (as per New_Read_Buffer)
+    char     **entry;   //  QV buffer (as per New_QV_Buffer, allocated on the first QV request)
+    QVcontext *qvctx;   //  QV decoding context (allocated on the first QV request)
+  } HITS_READER;
+
+  // Open a reader on db, returning NULL if this could not be done.  Close_Reader frees
+  //   a reader and all its resources.
+
+HITS_READER *Open_Reader(HITS_DB *db);
+void         Close_Reader(HITS_READER *rdr);
+
+  // Load the i'th read (QV entry) of the reader's db into the reader's own buffer and return
+  //   a pointer to it.  The contents and ascii parameter are exactly as for Load_Read
+  //   (Load_QVentry), and the buffer is overwritten by the next call on the same reader.
+
+char        *Reader_Load_Read(HITS_READER *rdr, int i, int ascii);
+char       **Reader_Load_QVentry(HITS_READER *rdr, int i, int ascii);
+
+  // Decode the QV entries of reads [first,last) of db (whose QVs must be loaded) in parallel
+  //   with nthreads threads.  Each of the 5 streams of read i is placed, '\0'-terminated, at
+  //   out[s] + o_i where o_i is the sum of rlen+1 over the reads in [first,i), so each of
+  //   out[0..4] must have room for the sum of rlen+1 over the range.  The ascii parameter
+  //   applies to the DELTAG stream as for Load_QVentry.
+
+void Load_QVentries(HITS_DB *db, int first, int last, char **out, int ascii, int nthreads);
+
   // Allocate a block big enough for all the uncompressed sequences, read them into it,
   //   reset the 'off' in each read record to be its in-memory offset, and set the
   //   bases pointer to point at the block after closing the bases file.  If ascii is
@@ -312,13 +481,19 @@ void   Load_QVentry(HITS_DB *db, int i, char **entry, int ascii);
 
 void Read_All_Sequences(HITS_DB *db, int ascii);
 
+  // As above, but the reads are uncompressed by nthreads threads each working on a disjoint
+  //   range of reads from a single memory mapping of the block's span of the .bps file.
+
+void Read_All_Sequences_Parallel(HITS_DB *db, int ascii, int nthreads);
+
   // For the DB "path" = "prefix/root[.db]", find all the files for that DB, i.e. all those
   //   of the form "prefix/[.]root.part" and call foreach with the complete path to each file
   //   pointed at by path, and the suffix of the path by extension.  The . proceeds the root
   //   name if the defined constant HIDE_FILES is set.  Always the first call is with the
   //   path "prefix/root.db" and extension "db".  There will always be calls for
-  //   "prefix/[.]root.idx" and "prefix/[.]root.bps".  All other calls are for *tracks* and
-  //   so this routine gives one a way to know all the tracks associated with a given DB.
+  //   "prefix/[.]root.idx" and "prefix/[.]root.bps".  Besides the .qvs, .bdir, and
+  //   .stats files if present, all other calls are for *tracks* and so this routine gives
+  //   one a way to know all the tracks associated with a given DB.
   //   Return non-zero iff path could not be opened for any reason.
 
 int List_DB_Files(char *path, void foreach(char *path, char *extension));
@@ -4,22 +4,151 @@
  *
  *  Author:  Gene Myers
  *  Date  :  May 2014
+ *  Modify:  Records formatted into a large buffer written in blocks, -T threads each
+ *             recreating different files
  *
  ********************************************************************************************/
 
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
 
 #include "DB.h"
 
-static char *Usage = "[-vU] [-w<int(80)>] <path:db>";
+static char *Usage = "[-vU] [-w<int(80)>] [-T<int(1)>] <path:db>";
+
+#define OUT_BLOCK  0x400000   //  Size of the output buffer of a thread
+
+static int VERBOSE, UPPER, WIDTH;
+static int NTHREADS;
+
+  //  A .fasta file to be recreated: reads [first,last) of the db with the given file name
+  //    and prolog
+
+typedef struct
+  { int   first, last;
+    char  fname[MAX_NAME];
+    char  prolog[MAX_NAME];
+  } Fasta_File;
+
+  //  A thread recreates files tid, tid+NTHREADS, ... each through its own reader on db.
+  //    Whole records (header and wrapped lines) are formatted into buffer[0..omax-1], that
+  //    is written out with a single write call whenever the next record may not fit.
+
+typedef struct
+  { HITS_DB    *db;
+    Fasta_File *files;
+    int         nfiles;
+    int         tid;
+    char       *buffer;
+    int64       omax;
+    int         error;
+  } Thread_Arg;
+
+static int Write_Block(int ofile, char *buf, int64 len, char *fname)
+{ int64 n;
+
+  while (len > 0)
+    { n = write(ofile,buf,len);
+      if (n < 0)
+        { fprintf(stderr,"%s: Could not write to %s.fasta\n",Prog_Name,fname);
+          return (1);
+        }
+      buf += n;
+      len -= n;
+    }
+  return (0);
+}
+
+static void *fasta_thread(void *arg)
+{ Thread_Arg  *parm  = (Thread_Arg *) arg;
+  HITS_DB     *db    = parm->db;
+  HITS_READ   *reads = db->reads;
+  char        *buf   = parm->buffer;
+  HITS_READER *rdr;
+  int          f;
+
+  parm->error = 1;
+  rdr = Open_Reader(db);
+  if (rdr == NULL)
+    return (NULL);
+
+  for (f = parm->tid; f < parm->nfiles; f += NTHREADS)
+    { Fasta_File *ff = parm->files + f;
+      char        name[MAX_NAME+10];
+      int64       o;
+      int         i, ofile;
+
+      //  Create .fasta file for writing (Catenate's buffer is not private to the thread)
+
+      sprintf(name,"./%s.fasta",ff->fname);
+      ofile = open(name,O_WRONLY|O_CREAT|O_TRUNC,0666);
+      if (ofile < 0)
+        { fprintf(stderr,"%s: Cannot open %s for 'w'\n",Prog_Name,name);
+          goto error;
+        }
+
+      if (VERBOSE)
+        { fprintf(stderr,"Creating %s.fasta ...\n",ff->fname);
+          fflush(stderr);
+        }
+
+      //   For the relevant range of reads, format each into the buffer recreating the
+      //     original headers with the index meta-data about each read
+
+      o = 0;
+      for (i = ff->first; i < ff->last; i++)
+        { int        j, len, qv;
+          HITS_READ *r;
+          char      *read;
+
+          r   = reads + i;
+          len = r->end - r->beg;
+          qv  = (r->flags & DB_QV);
+
+          if (o + (len + len/WIDTH + MAX_NAME + 64) > parm->omax)
+            { if (Write_Block(ofile,buf,o,ff->fname))
+                goto error;
+              o = 0;
+            }
+
+          if (qv > 0)
+            o += sprintf(buf+o,">%s/%d/%d_%d RQ=0.%3d\n",ff->prolog,r->origin,r->beg,r->end,qv);
+          else
+            o += sprintf(buf+o,">%s/%d/%d_%d\n",ff->prolog,r->origin,r->beg,r->end);
+
+          read = Reader_Load_Read(rdr,i,UPPER);
+
+          for (j = 0; j+WIDTH < len; j += WIDTH)
+            { memcpy(buf+o,read+j,WIDTH);
+              o += WIDTH;
+              buf[o++] = '\n';
+            }
+          if (j < len)
+            { memcpy(buf+o,read+j,len-j);
+              o += len-j;
+              buf[o++] = '\n';
+            }
+        }
+
+      if (Write_Block(ofile,buf,o,ff->fname))
+        goto error;
+      close(ofile);
+    }
+
+  parm->error = 0;
+error:
+  Close_Reader(rdr);
+  return (NULL);
+}
 
 int main(int argc, char *argv[])
 { HITS_DB    _db, *db = &_db;
   FILE       *dbfile;
   int         nfiles;
-  int         VERBOSE, UPPER, WIDTH;
 
   //  Process arguments
 
@@ -29,7 +158,8 @@ int main(int argc, char *argv[])
 
     ARG_INIT("DB2fasta")
 
-    WIDTH = 80;
+    WIDTH    = 80;
+    NTHREADS = 1;
 
     j = 1;
     for (i = 1; i < argc; i++)
@@ -39,7 +169,10 @@ int main(int argc, char *argv[])
             ARG_FLAGS("vU")
             break;
           case 'w':
-            ARG_NON_NEGATIVE(WIDTH,"Line width")
+            ARG_POSITIVE(WIDTH,"Line width")
+            break;
+          case 'T':
+            ARG_POSITIVE(NTHREADS,"Number of threads")
             break;
         }
       else
@@ -55,9 +188,9 @@ int main(int argc, char *argv[])
       }
   }
 
-  //  Open db and also db image file (dbfile)
+  //  Open db (with its .idx and .bps memory mapped) and also db image file (dbfile)
 
-  if (Open_DB(argv[1],db))
+  if (Open_DB_Mapped(argv[1],db))
     { fprintf(stderr,"%s: Database %s.db could not be opened\n",Prog_Name,argv[1]);
       exit (1);
     }
@@ -81,59 +214,54 @@ int main(int argc, char *argv[])
 
   fscanf(dbfile,DB_NFILE,&nfiles);
 
-  //  For each file do:
+  //  Scan the db image file lines, and then recreate the files with NTHREADS threads
 
-  { HITS_READ  *reads;
-    char       *read;
-    int         f, first;
+  { Fasta_File *files;
+    Thread_Arg *parm;
+    pthread_t  *threads;
+    int         f, t, u, first;
+
+    files   = (Fasta_File *) Malloc(sizeof(Fasta_File)*(nfiles+1),"Allocating file list");
+    parm    = (Thread_Arg *) Malloc(sizeof(Thread_Arg)*NTHREADS,"Allocating thread records");
+    threads = (pthread_t *) Malloc(sizeof(pthread_t)*NTHREADS,"Allocating threads");
+    if (files == NULL || parm == NULL || threads == NULL)
+      exit (1);
 
-    reads = db->reads;
-    read  = New_Read_Buffer(db);
     first = 0;
     for (f = 0; f < nfiles; f++)
-      { int   i, last;
-        FILE *ofile;
-        char  prolog[MAX_NAME], fname[MAX_NAME];
-
-        //  Scan db image file line, create .fasta file for writing
-
-        fscanf(dbfile,DB_FDATA,&last,fname,prolog);
+      { fscanf(dbfile,DB_FDATA,&(files[f].last),files[f].fname,files[f].prolog);
+        files[f].first = first;
+        first = files[f].last;
+      }
 
-        if ((ofile = Fopen(Catenate(".","/",fname,".fasta"),"w")) == NULL)
+    for (t = 0; t < NTHREADS; t++)
+      { parm[t].db     = db;
+        parm[t].files  = files;
+        parm[t].nfiles = nfiles;
+        parm[t].tid    = t;
+        parm[t].omax   = OUT_BLOCK + db->maxlen + db->maxlen/WIDTH + MAX_NAME + 64;
+        parm[t].buffer = (char *) Malloc(parm[t].omax,"Allocating output buffer");
+        if (parm[t].buffer == NULL)
           exit (1);
+      }
 
-        if (VERBOSE)
-          { fprintf(stderr,"Creating %s.fasta ...\n",fname);
-            fflush(stdout);
-          }
-
-        //   For the relevant range of reads, write each to the file
-        //     recreating the original headers with the index meta-data about each read
-
-        for (i = first; i < last; i++)
-          { int        j, len;
-            int        flags, qv;
-            HITS_READ *r;
-
-            r     = reads + i;
-            len   = r->end - r->beg;
-            flags = r->flags;
-            qv    = (flags & DB_QV);
-            fprintf(ofile,">%s/%d/%d_%d",prolog,r->origin,r->beg,r->end);
-            if (qv > 0)
-              fprintf(ofile," RQ=0.%3d",qv);
-            fprintf(ofile,"\n");
-
-            Load_Read(db,i,read,UPPER);
-
-            for (j = 0; j+WIDTH < len; j += WIDTH)
-              fprintf(ofile,"%.*s\n",WIDTH,read+j);
-            if (j < len)
-              fprintf(ofile,"%s\n",read+j);
-          }
-
-        first = last;
+    for (t = 1; t < NTHREADS; t++)
+      if (pthread_create(threads+t,NULL,fasta_thread,parm+t) != 0)
+        break;
+    for (u = t; u < NTHREADS; u++)      //  Run here any range no thread could be created for
+      fasta_thread(parm+u);
+    fasta_thread(parm);
+    for (u = 1; u < t; u++)
+      pthread_join(threads[u],NULL);
+
+    for (t = 0; t < NTHREADS; t++)
+      { if (parm[t].error)
+          exit (1);
+        free(parm[t].buffer);
       }
+    free(threads);
+    free(parm);
+    free(files);
   }
 
   fclose(dbfile);
@@ -20,24 +20,37 @@
 #define PATHSEP "/"
 #endif
 
-static char *Usage = "[-vU] <path:db>";
+static char *Usage = "[-vU] [-T<int(1)>] <path:db>";
+
+#define QV_BATCH  0x1000000   //  Decode about this many QVs of a file at a time when threaded
 
 int main(int argc, char *argv[])
 { HITS_DB    _db, *db = &_db;
   FILE       *dbfile, *quiva;
   int         VERBOSE, UPPER;
+  int         NTHREADS;
 
   //  Process arguments
 
   { int   i, j, k;
     int   flags[128];
+    char *eptr;
 
     ARG_INIT("DB2quiva")
 
+    NTHREADS = 1;
+
     j = 1;
     for (i = 1; i < argc; i++)
       if (argv[i][0] == '-')
-        { ARG_FLAGS("vU") }
+        switch (argv[i][1])
+        { default:
+            ARG_FLAGS("vU")
+            break;
+          case 'T':
+            ARG_POSITIVE(NTHREADS,"Number of threads")
+            break;
+        }
       else
         argv[j++] = argv[i];
     argc = j;
@@ -80,9 +93,26 @@ int main(int argc, char *argv[])
     int         f, first, nfiles;
     QVcoding   *coding;
     char      **entry;
+    char       *batch[5];
+    int64       bmax;
 
     fscanf(dbfile,DB_NFILE,&nfiles);
 
+    //  If threaded, all the QVs are loaded and decoded in batches with Load_QVentries,
+    //    otherwise the .qvs file is decoded sequentially
+
+    if (NTHREADS > 1)
+      { int e;
+
+        Load_QVs(db);
+        bmax = QV_BATCH + db->maxlen + 1;
+        for (e = 0; e < 5; e++)
+          { batch[e] = (char *) Malloc(bmax,"Allocating QV batch buffers");
+            if (batch[e] == NULL)
+              exit (1);
+          }
+      }
+
     entry = New_QV_Buffer(db);
     reads = db->reads;
     first = 0;
@@ -91,9 +121,10 @@ int main(int argc, char *argv[])
         FILE *ofile;
         char  prolog[MAX_NAME], fname[MAX_NAME];
 
-        //  Scan db image file line, create .quiva file for writing
+        //  Scan db image file line, create .quiva file for writing (the QVs of the first file
+        //    begin at offset 0, for later files a 0 offset means no QVs were added)
 
-        if (reads[first].coff == 0) break;
+        if (first >= db->nreads || (f > 0 && reads[first].coff == 0)) break;
 
         fscanf(dbfile,DB_FDATA,&last,fname,prolog);
 
@@ -105,6 +136,51 @@ int main(int argc, char *argv[])
             fflush(stderr);
           }
 
+        if (NTHREADS > 1)
+          { int   beg, end;
+            int64 o;
+
+            //   Decode a batch of reads [beg,end) of the file in parallel and then write the
+            //     header and quiva entry for each
+
+            for (beg = first; beg < last; beg = end)
+              { o = 0;
+                for (end = beg; end < last; end++)
+                  { o += (reads[end].end - reads[end].beg) + 1;
+                    if (o > bmax)
+                      break;
+                  }
+                Load_QVentries(db,beg,end,batch,(UPPER ? 2 : 1),NTHREADS);
+
+                o = 0;
+                for (i = beg; i < end; i++)
+                  { int        e, flags, qv, rlen;
+                    HITS_READ *r;
+
+                    r     = reads + i;
+                    flags = r->flags;
+                    rlen  = r->end - r->beg;
+                    qv    = (flags & DB_QV);
+                    fprintf(ofile,"@%s/%d/%d_%d",prolog,r->origin,r->beg,r->end);
+                    if (qv > 0)
+                      fprintf(ofile," RQ=0.%3d",qv);
+                    fprintf(ofile,"\n");
+
+                    for (e = 0; e < 5; e++)
+                      fprintf(ofile,"%.*s\n",rlen,batch[e]+o);
+                    o += rlen+1;
+                  }
+              }
+
+            fclose(ofile);
+            first = last;
+            continue;
+          }
+
+        //   The entries are normally in .qvs order, but need not be (see DBrepack)
+
+        if (ftello(quiva) != reads[first].coff)
+          fseeko(quiva,reads[first].coff,SEEK_SET);
         coding = Read_QVcoding(quiva);
 
         //   For the relevant range of reads, write the header for each to the file
@@ -123,6 +199,8 @@ int main(int argc, char *argv[])
               fprintf(ofile," RQ=0.%3d",qv);
             fprintf(ofile,"\n");
 
+            if (i > first && ftello(quiva) != r->coff)
+              fseeko(quiva,r->coff,SEEK_SET);
             Uncompress_Next_QVentry(quiva,entry,coding,rlen);
 
             if (UPPER)
@@ -137,6 +215,7 @@ int main(int argc, char *argv[])
               fprintf(ofile,"%.*s\n",rlen,entry[e]);
           }
 
+        fclose(ofile);
         first = last;
       }
   }
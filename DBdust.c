@@ -14,6 +14,7 @@
 #include <string.h>
 #include <strings.h>
 #include <math.h>
+#include <pthread.h>
 
 #include "DB.h"
 
@@ -32,7 +33,7 @@ static int Lowr[4] = { 'a', 'c', 'g', 't' };
 
 #endif
 
-static char *Usage = "[-b] [-w<int(64)>] [-t<double(2.)>] [-m<int(10)>] <path:db>";
+static char *Usage = "[-bf] [-w<int(64)>] [-t<double(2.)>] [-m<int(10)>] [-T<int(1)>] <path:db>";
 
 typedef struct _cand
   { struct _cand *next;
@@ -42,17 +43,610 @@ typedef struct _cand
     double        score;
   } Candidate;
 
+#define ROUND  10000   //  # of reads dusted by each thread before their results are output
+
+  //  Dust parameters, set once from the command line and the DB
+
+static int    WINDOW;
+static double THRESH;
+static int    MINLEN;
+static int    BIASED;
+static int    FAST;
+
+static double skew[64], thresh2r;
+static int    thresh2i;
+
+  //  Each thread dusts reads with its own mask vector and pool of candidates
+
+typedef struct
+  { int       *mask;   //  mask[0] = -2 is a sentinel, intervals are placed in mask[1..]
+    Candidate *cptr;   //  cptr[0] heads the list of current candidates, the rest are
+    Candidate *aptr;   //    on the free list starting at aptr
+    int       *cend;   //  Candidate arrays of the fast engine (if FAST), see Dust_Read_Fast
+    double    *cscore;
+    uint64    *cbit;
+  } Duster;
+
+static void Init_Duster(Duster *dust, int maxlen)
+{ Candidate *cptr;
+  int        i;
+
+  dust->mask = (int *) Malloc((maxlen+1)*sizeof(int),"Allocating mask vector");
+  dust->cptr = (Candidate *) Malloc((WINDOW+1)*sizeof(Candidate),"Allocating candidate vector");
+  if (dust->mask == NULL || dust->cptr == NULL)
+    exit (1);
+
+  *dust->mask = -2;
+
+  cptr       = dust->cptr;
+  dust->aptr = cptr+1;
+  for (i = 1; i < WINDOW; i++)
+    cptr[i].next = cptr+(i+1);
+  cptr[WINDOW].next = NULL;
+
+  cptr->next = cptr->prev = cptr;
+  cptr->beg  = -2;
+
+  if (FAST)
+    { dust->cend   = (int *) Malloc((maxlen+1)*sizeof(int),"Allocating candidate arrays");
+      dust->cscore = (double *) Malloc((maxlen+1)*sizeof(double),"Allocating candidate arrays");
+      dust->cbit   = (uint64 *) Malloc(((maxlen >> 6)+1)*sizeof(uint64),
+                                       "Allocating candidate arrays");
+      if (dust->cend == NULL || dust->cscore == NULL || dust->cbit == NULL)
+        exit (1);
+      for (i = 0; i <= (maxlen >> 6); i++)
+        dust->cbit[i] = 0;
+    }
+  else
+    dust->cend = NULL;
+}
+
+static void Free_Duster(Duster *dust)
+{ if (dust->cend != NULL)
+    { free(dust->cbit);
+      free(dust->cscore);
+      free(dust->cend);
+    }
+  free(dust->cptr);
+  free(dust->mask);
+}
+
+  //  Compact the intervals in mask[1..mtop] to those longer than MINLEN and return the
+  //    number of ints left in mask[1..]
+
+static int Long_Intervals(int *mask, int *mtop)
+{ int *jtop, ntop;
+
+  ntop = 0;
+  for (jtop = mask+1; jtop < mtop; jtop += 2)
+    if (jtop[1] - jtop[0] >= MINLEN)
+      { mask[++ntop] = jtop[0];
+        mask[++ntop] = jtop[1];
+      }
+  return (ntop);
+}
+
+  //  Find the low complexity intervals of read[0..len-1] (in numeric form, it is overwritten),
+  //    place the ntop/2 intervals longer than MINLEN in dust->mask[1..ntop], and return ntop
+
+static int Dust_Read(Duster *dust, char *read, int len)
+{ Candidate *cptr = dust->cptr;
+  Candidate *aptr = dust->aptr;
+  int       *mask = dust->mask;
+  char      *lag2 = read-2;
+  int        wcount[64], lcount[64];
+  Candidate *lptr, *jptr;
+  int       *mtop;
+  double     mscore;
+  int        wb, lb;
+  int        j, c, d;
+
+  c = (read[0] << 2) | read[1];     //   Convert to triple codes
+  for (j = 2; j < len; j++)
+    { c = ((c << 2) & 0x3f) | read[j];
+      lag2[j] = c;
+    }
+  len -= 2;
+
+  for (j = 0; j < 64; j++)		//   Setup counter arrays
+    wcount[j] = lcount[j] = 0;
+
+  mtop = mask;                      //   The dust algorithm
+  lb   = wb   = -1;
+
+  if (BIASED)
+
+    { double lsqr, wsqr, trun;      //   Modification for high-compositional bias
+
+      wsqr = lsqr = 0.;
+      for (j = 0; j < len; j++)
+        { c = read[j];
+
+#define ADDR(e,cnt,sqr)	 sqr += (cnt[e]++) * skew[e];
+
+#define DELR(e,cnt,sqr)	 sqr -= (--cnt[e]) * skew[e];
+
+#define WADDR(e) ADDR(e,wcount,wsqr)
+#define WDELR(e) DELR(e,wcount,wsqr)
+#define LADDR(e) ADDR(e,lcount,lsqr)
+#define LDELR(e) DELR(e,lcount,lsqr)
+
+          if (j > WINDOW-3)
+            { d = read[++wb];
+              WDELR(d)
+            }
+          WADDR(c)
+
+          if (lb < wb)
+            { d = read[++lb];
+              LDELR(d)
+            }
+          trun  = (lcount[c]++) * skew[c];
+          lsqr += trun;
+          if (trun >= thresh2r)
+            { while (lb < j)
+                { d = read[++lb];
+                  LDELR(d)
+                  if (d == c) break;
+                }
+            }
+
+          jptr = cptr->prev;
+          if (jptr != cptr && jptr->beg <= wb)
+            { c = jptr->end + 2;
+              if (*mtop+1 >= jptr->beg)
+                { if (*mtop < c)
+                    *mtop = c;
+                }
+              else
+                { *++mtop = jptr->beg;
+                  *++mtop = c;
+                }
+              lptr = jptr->prev;
+              cptr->prev = lptr;
+              lptr->next = cptr;
+              jptr->next = aptr;
+              aptr = jptr;
+            }
+
+          if (wsqr <= lsqr*THRESH) continue;
+
+          jptr   = cptr->next;
+          lptr   = cptr;
+          mscore = 0.;
+          for (c = lb; c > wb; c--)
+            { d = read[c];
+              LADDR(d)
+              if (lsqr >= THRESH * (j-c))
+                { for ( ; jptr->beg >= c; jptr = (lptr = jptr)->next)
+                    if (jptr->score > mscore)
+                      mscore = jptr->score;
+                  if (lsqr >= mscore * (j-c))
+                    { mscore = lsqr / (j-c);
+                      if (lptr->beg == c)
+                        { lptr->end   = j;
+                          lptr->score = mscore;
+                        }
+                      else
+                        { aptr->beg   = c;
+                          aptr->end   = j;
+                          aptr->score = mscore;
+                          aptr->prev  = lptr;
+                          lptr = lptr->next = aptr;
+                          aptr = aptr->next;
+                          jptr->prev = lptr;
+                          lptr->next = jptr;
+                        }
+                    }
+                }
+            }
+
+          for (c++; c <= lb; c++)
+            { d = read[c];
+              LDELR(d)
+            }
+        }
+    }
+
+  else
+
+    { int lsqr, wsqr, trun;                 //  Algorithm for GC-balanced sequences
+
+      wsqr = lsqr = 0;
+      for (j = 0; j < len; j++)
+        { c = read[j];
+
+#define ADDI(e,cnt,sqr)	 sqr += (cnt[e]++);
+
+#define DELI(e,cnt,sqr)	 sqr -= (--cnt[e]);
+
+#define WADDI(e) ADDI(e,wcount,wsqr)
+#define WDELI(e) DELI(e,wcount,wsqr)
+#define LADDI(e) ADDI(e,lcount,lsqr)
+#define LDELI(e) DELI(e,lcount,lsqr)
+
+          if (j > WINDOW-3)
+            { d = read[++wb];
+              WDELI(d)
+            }
+          WADDI(c)
+
+          if (lb < wb)
+            { d = read[++lb];
+              LDELI(d)
+            }
+          trun  = lcount[c]++;
+          lsqr += trun;
+          if (trun >= thresh2i)
+            { while (lb < j)
+                { d = read[++lb];
+                  LDELI(d)
+                  if (d == c) break;
+                }
+            }
+
+          jptr = cptr->prev;
+          if (jptr != cptr && jptr->beg <= wb)
+            { c = jptr->end + 2;
+              if (*mtop+1 >= jptr->beg)
+                { if (*mtop < c)
+                    *mtop = c;
+                }
+              else
+                { *++mtop = jptr->beg;
+                  *++mtop = c;
+                }
+              lptr = jptr->prev;
+              cptr->prev = lptr;
+              lptr->next = cptr;
+              jptr->next = aptr;
+              aptr = jptr;
+            }
+
+          if (wsqr <= lsqr*THRESH) continue;
+
+          jptr   = cptr->next;
+          lptr   = cptr;
+          mscore = 0.;
+          for (c = lb; c > wb; c--)
+            { d = read[c];
+              LADDI(d)
+              if (lsqr >= THRESH * (j-c))
+                { for ( ; jptr->beg >= c; jptr = (lptr = jptr)->next)
+                    if (jptr->score > mscore)
+                      mscore = jptr->score;
+                  if (lsqr >= mscore * (j-c))
+                    { mscore = (1. * lsqr) / (j-c);
+                      if (lptr->beg == c)
+                        { lptr->end   = j;
+                          lptr->score = mscore;
+                        }
+                      else
+                        { aptr->beg   = c;
+                          aptr->end   = j;
+                          aptr->score = mscore;
+                          aptr->prev  = lptr;
+                          lptr = lptr->next = aptr;
+                          aptr = aptr->next;
+                          jptr->prev = lptr;
+                          lptr->next = jptr;
+                        }
+                    }
+                }
+            }
+
+          for (c++; c <= lb; c++)
+            { d = read[c];
+              LDELI(d)
+            }
+        }
+    }
+
+  while ((jptr = cptr->prev) != cptr)
+    { c = jptr->end + 2;
+      if (*mtop+1 >= jptr->beg)
+        { if (*mtop < c)
+            *mtop = c;
+        }
+      else
+        { *++mtop = jptr->beg;
+          *++mtop = c;
+        }
+      cptr->prev = jptr->prev;
+      jptr->prev->next = cptr;
+      jptr->next = aptr;
+      aptr = jptr;
+    }
+
+  dust->aptr = aptr;
+
+  return (Long_Intervals(mask,mtop));
+}
+
+  //  The fast engine finds exactly the same intervals as Dust_Read.  The triple codes of the
+  //    whole read are computed in one batched (SSE2 on x86_64) pass.  Instead of a linked
+  //    list, the current candidates are kept in arrays indexed by their start position, with
+  //    a bit vector cbit marking the starts of the current candidates so that the best score
+  //    of those starting at or after a given position is found by skipping over whole words.
+  //    Moreover, as the candidate with the smallest start is always the one that leaves the
+  //    window, no list need be maintained.  Lastly, in the unbiased case the counts of the
+  //    long window are restored after each leftward scan with a (vectorized) block copy
+  //    rather than by undoing the scan one triple at a time.
+
+#if defined(__GNUC__) && defined(__x86_64__)
+
+#include <emmintrin.h>
+
+static void Triple_Codes(char *read, int len)
+{ __m128i x0, x1, x2;
+  int     j;
+
+  for (j = 0; j+18 <= len; j += 16)
+    { x0 = _mm_loadu_si128((__m128i *) (read+j));
+      x1 = _mm_loadu_si128((__m128i *) (read+(j+1)));
+      x2 = _mm_loadu_si128((__m128i *) (read+(j+2)));
+      x0 = _mm_or_si128(_mm_or_si128(_mm_slli_epi16(x0,4),_mm_slli_epi16(x1,2)),x2);
+      _mm_storeu_si128((__m128i *) (read+j),x0);
+    }
+  for ( ; j+2 < len; j++)
+    read[j] = (read[j] << 4) | (read[j+1] << 2) | read[j+2];
+}
+
+#else
+
+static void Triple_Codes(char *read, int len)
+{ int j;
+
+  for (j = 0; j+2 < len; j++)
+    read[j] = (read[j] << 4) | (read[j+1] << 2) | read[j+2];
+}
+
+#endif
+
+  //  Add the interval [b,e] to the mask intervals, merging it with the last if they overlap
+
+#define FLUSH(b,e)			\
+  { c = (e) + 2;			\
+    if (*mtop+1 >= (b))			\
+      { if (*mtop < c)			\
+          *mtop = c;			\
+      }					\
+    else				\
+      { *++mtop = (b);			\
+        *++mtop = c;			\
+      }					\
+  }
+
+  //  Fold the scores of all candidates starting in [c,e] into mscore, and set e = c-1
+
+#define BEST(c,e)							\
+  while (e >= c)							\
+    { uint64 w = cbit[e >> 6] & (0xffffffffffffffffull >> (63 - (e & 0x3f)));	\
+      if (w == 0)							\
+        e = (e | 0x3f) - 64;						\
+      else								\
+        { int p = (e | 0x3f) - __builtin_clzll(w);			\
+          if (p < c)							\
+            e = c-1;							\
+          else								\
+            { if (cscore[p] > mscore)					\
+                mscore = cscore[p];					\
+              e = p-1;							\
+            }							\
+        }								\
+    }
+
+#define SETC(c)  cbit[(c) >> 6] |= (1ull << ((c) & 0x3f));
+#define CLRC(c)  cbit[(c) >> 6] &= ~(1ull << ((c) & 0x3f));
+#define ISC(c)   ((cbit[(c) >> 6] >> ((c) & 0x3f)) & 0x1)
+
+static int Dust_Read_Fast(Duster *dust, char *read, int len)
+{ int    *mask   = dust->mask;
+  int    *cend   = dust->cend;
+  double *cscore = dust->cscore;
+  uint64 *cbit   = dust->cbit;
+  int     wcount[64], lcount[64];
+  int    *mtop;
+  double  mscore;
+  int     wb, lb;
+  int     j, c, d, e;
+
+  Triple_Codes(read,len);
+  len -= 2;
+
+  for (j = 0; j < 64; j++)
+    wcount[j] = lcount[j] = 0;
+
+  mtop = mask;
+  lb   = wb   = -1;
+
+  if (BIASED)
+
+    { double lsqr, wsqr, trun;
+
+      wsqr = lsqr = 0.;
+      for (j = 0; j < len; j++)
+        { c = read[j];
+
+          if (j > WINDOW-3)
+            { d = read[++wb];
+              WDELR(d)
+              if (ISC(wb))
+                { FLUSH(wb,cend[wb])
+                  CLRC(wb)
+                  c = read[j];
+                }
+            }
+          WADDR(c)
+
+          if (lb < wb)
+            { d = read[++lb];
+              LDELR(d)
+            }
+          trun  = (lcount[c]++) * skew[c];
+          lsqr += trun;
+          if (trun >= thresh2r)
+            { while (lb < j)
+                { d = read[++lb];
+                  LDELR(d)
+                  if (d == c) break;
+                }
+            }
+
+          if (wsqr <= lsqr*THRESH) continue;
+
+          mscore = 0.;
+          e      = j-1;
+          for (c = lb; c > wb; c--)
+            { d = read[c];
+              LADDR(d)
+              if (lsqr >= THRESH * (j-c))
+                { BEST(c,e)
+                  if (lsqr >= mscore * (j-c))
+                    { mscore    = lsqr / (j-c);
+                      cend[c]   = j;
+                      cscore[c] = mscore;
+                      SETC(c)
+                    }
+                }
+            }
+
+          for (c++; c <= lb; c++)
+            { d = read[c];
+              LDELR(d)
+            }
+        }
+    }
+
+  else
+
+    { int lsqr, wsqr, trun;
+      int lsave[64], ssave;
+
+      wsqr = lsqr = 0;
+      for (j = 0; j < len; j++)
+        { c = read[j];
+
+          if (j > WINDOW-3)
+            { d = read[++wb];
+              WDELI(d)
+              if (ISC(wb))
+                { FLUSH(wb,cend[wb])
+                  CLRC(wb)
+                  c = read[j];
+                }
+            }
+          WADDI(c)
+
+          if (lb < wb)
+            { d = read[++lb];
+              LDELI(d)
+            }
+          trun  = lcount[c]++;
+          lsqr += trun;
+          if (trun >= thresh2i)
+            { while (lb < j)
+                { d = read[++lb];
+                  LDELI(d)
+                  if (d == c) break;
+                }
+            }
+
+          if (wsqr <= lsqr*THRESH) continue;
+
+          memcpy(lsave,lcount,sizeof(lsave));
+          ssave = lsqr;
+
+          mscore = 0.;
+          e      = j-1;
+          for (c = lb; c > wb; c--)
+            { d = read[c];
+              LADDI(d)
+              if (lsqr >= THRESH * (j-c))
+                { BEST(c,e)
+                  if (lsqr >= mscore * (j-c))
+                    { mscore    = (1. * lsqr) / (j-c);
+                      cend[c]   = j;
+                      cscore[c] = mscore;
+                      SETC(c)
+                    }
+                }
+            }
+
+          memcpy(lcount,lsave,sizeof(lsave));
+          lsqr = ssave;
+        }
+    }
+
+  for (e = wb+1; e < len; e++)
+    if (ISC(e))
+      { FLUSH(e,cend[e])
+        CLRC(e)
+      }
+
+  return (Long_Intervals(mask,mtop));
+}
+
+  //  A thread dusts reads [beg,end) with its own reader, leaving the number of mask ints
+  //    for read i in ntop[i-beg], and all the masks concatenated in ints[0..nint-1].  If
+  //    the reads of the db are in memory then rdr is NULL and each read is copied into the
+  //    thread's buffer read, as dusting overwrites the read with its triple codes.  With a
+  //    single thread rdr is also NULL and the reads are fetched with the buffered Load_Read.
+
+typedef struct
+  { HITS_DB     *db;
+    HITS_READER *rdr;
+    char        *read;
+    Duster       dust;
+    int          beg;
+    int          end;
+    int         *ntop;
+    int         *ints;
+    int64        nint;
+    int64        imax;
+  } Dust_Arg;
+
+static void *dust_thread(void *arg)
+{ Dust_Arg  *data  = (Dust_Arg *) arg;
+  HITS_READ *reads = data->db->reads;
+  char      *bases = (char *) data->db->bases;
+  char      *read;
+  int        i, n, len;
+
+  data->nint = 0;
+  for (i = data->beg; i < data->end; i++)
+    { len  = reads[i].end - reads[i].beg;
+      if (data->rdr != NULL)
+        read = Reader_Load_Read(data->rdr,i,0);
+      else if (data->db->loaded)
+        read = memcpy(data->read,bases+reads[i].boff,len+1);
+      else
+        { read = data->read;
+          Load_Read(data->db,i,read,0);
+        }
+      if (FAST)
+        n = Dust_Read_Fast(&(data->dust),read,len);
+      else
+        n = Dust_Read(&(data->dust),read,len);
+      if (data->nint + n > data->imax)
+        { data->imax = 1.2*(data->nint+n) + 1000;
+          data->ints = (int *) Realloc(data->ints,data->imax*sizeof(int),"Allocating mask buffer");
+          if (data->ints == NULL)
+            exit (1);
+        }
+      memcpy(data->ints+data->nint,data->dust.mask+1,n*sizeof(int));
+      data->nint += n;
+      data->ntop[i-data->beg] = n;
+    }
+  return (NULL);
+}
+
+
 int main(int argc, char *argv[])
 { HITS_DB   _db, *db = &_db;
   FILE      *afile, *dfile;
   int        indx, nreads;
-  int       *mask;
-  Candidate *cptr;
-
-  int        WINDOW;
-  double     THRESH;
-  int        MINLEN;
-  int        BIASED;
+  int        NTHREADS;
 
   { int   i, j, k;
     int   flags[128];
@@ -60,16 +654,17 @@ int main(int argc, char *argv[])
 
     ARG_INIT("DBdust")
 
-    WINDOW = 64;
-    THRESH = 2.;
-    MINLEN = 9;
+    WINDOW   = 64;
+    THRESH   = 2.;
+    MINLEN   = 9;
+    NTHREADS = 1;
 
     j = 1;
     for (i = 1; i < argc; i++)
       if (argv[i][0] == '-')
         switch (argv[i][1])
         { default:
-            ARG_FLAGS("b")
+            ARG_FLAGS("bf")
             break;
           case 'w':
             ARG_POSITIVE(WINDOW,"Window size")
@@ -85,12 +680,16 @@ int main(int argc, char *argv[])
             ARG_NON_NEGATIVE(MINLEN,"Minimum hit")
             MINLEN -= 1;
             break;
+          case 'T':
+            ARG_POSITIVE(NTHREADS,"Number of threads")
+            break;
         }
       else
         argv[j++] = argv[i];
     argc = j;
 
     BIASED = flags['b'];
+    FAST   = flags['f'];
 
     if (argc != 2)
       { fprintf(stderr,"Usage: %s %s\n",Prog_Name,Usage);
@@ -101,10 +700,10 @@ int main(int argc, char *argv[])
   if (Open_DB(argv[1],db))
     exit (1);
 
-  mask = (int *) Malloc((db->maxlen+1)*sizeof(int),"Allocating mask vector");
-  cptr = (Candidate *) Malloc((WINDOW+1)*sizeof(Candidate),"Allocating candidate vector");
-  if (mask == NULL || cptr == NULL)
-    exit (1);
+  //  A block is small enough to hold in memory, so with threads to hand load it all at once
+
+  if (db->part > 0 && NTHREADS > 1)
+    Read_All_Sequences_Parallel(db,0,NTHREADS);
 
   { char *pwd, *root, *fname;
     int   size;
@@ -148,309 +747,134 @@ int main(int argc, char *argv[])
     free(root);
   }
 
-  { int       *mask1;
-    char      *read, *lag2;
-    int        wcount[64], lcount[64];
-    Candidate *aptr;
-    double     skew[64], thresh2r;
-    int        thresh2i;
-    int        i;
+  thresh2r = 2.*THRESH;
+  thresh2i = (int) ceil(thresh2r);
 
-    read = New_Read_Buffer(db);
-    lag2 = read-2;
+  if (BIASED)
+    { int a, b, c, p;
 
-    mask1 = mask+1;
-    *mask = -2;
+      p = 0;
+      for (a = 0; a < 4; a++)
+       for (b = 0; b < 4; b++)
+        for (c = 0; c < 4; c++)
+          skew[p++] = .015625 / (db->freq[a]*db->freq[b]*db->freq[c]);
+    }
 
-    aptr  = cptr+1;
-    for (i = 1; i < WINDOW; i++)
-      cptr[i].next = aptr+i;
-    cptr[WINDOW].next = NULL;
+  //  Dust the reads in rounds of NTHREADS*ROUND reads, each thread taking a contiguous
+  //    range, and then output the masks of each range in order
 
-    cptr->next = cptr->prev = cptr;
-    cptr->beg  = -2;
+  { Dust_Arg  *parm;
+    pthread_t *threads;
+    int        lo, hi, span;
+    int        i, t, u, n;
+    int       *ints;
 
-    thresh2r = 2.*THRESH;
-    thresh2i = (int) ceil(thresh2r);
-
-    if (BIASED)
-      { int a, b, c, p;
+#ifdef DEBUG
+    char      *read = New_Read_Buffer(db);
+    int       *jtop;
+    int        c, len;
+#endif
 
-        p = 0;
-        for (a = 0; a < 4; a++)
-         for (b = 0; b < 4; b++)
-          for (c = 0; c < 4; c++)
-            skew[p++] = .015625 / (db->freq[a]*db->freq[b]*db->freq[c]);
+    parm    = (Dust_Arg *) Malloc(sizeof(Dust_Arg)*NTHREADS,"Allocating thread records");
+    threads = (pthread_t *) Malloc(sizeof(pthread_t)*NTHREADS,"Allocating thread records");
+    if (parm == NULL || threads == NULL)
+      exit (1);
+
+    for (t = 0; t < NTHREADS; t++)
+      { parm[t].db = db;
+        if (db->loaded || NTHREADS == 1)
+          { parm[t].rdr  = NULL;
+            parm[t].read = New_Read_Buffer(db);
+            if (parm[t].read == NULL)
+              exit (1);
+          }
+        else
+          { parm[t].rdr = Open_Reader(db);
+            if (parm[t].rdr == NULL)
+              exit (1);
+          }
+        Init_Duster(&(parm[t].dust),db->maxlen);
+        parm[t].ntop = (int *) Malloc(ROUND*sizeof(int),"Allocating mask counts");
+        if (parm[t].ntop == NULL)
+          exit (1);
+        parm[t].ints = NULL;
+        parm[t].imax = 0;
       }
 
-    for (i = nreads; i < db->nreads; i++)
-      { Candidate *lptr, *jptr;
-        int       *mtop;
-        double     mscore;
-        int        len;
-        int        wb, lb;
-        int        j, c, d;
-
-        len = db->reads[i].end - db->reads[i].beg;	//  Fetch read
-        Load_Read(db,i,read,0);
-
-        c = (read[0] << 2) | read[1];     //   Convert to triple codes
-        for (j = 2; j < len; j++)
-          { c = ((c << 2) & 0x3f) | read[j];
-            lag2[j] = c;
+    for (lo = nreads; lo < db->nreads; lo = hi)
+      { hi = lo + NTHREADS*ROUND;
+        if (hi > db->nreads)
+          hi = db->nreads;
+        span = ((hi-lo) + (NTHREADS-1)) / NTHREADS;
+        for (t = 0; t < NTHREADS; t++)
+          { parm[t].beg = lo + t*span;
+            if (parm[t].beg > hi)
+              parm[t].beg = hi;
+            parm[t].end = parm[t].beg + span;
+            if (parm[t].end > hi)
+              parm[t].end = hi;
           }
-        len -= 2;
-
-        for (j = 0; j < 64; j++)		//   Setup counter arrays
-          wcount[j] = lcount[j] = 0;
-
-        mtop = mask;                      //   The dust algorithm
-        lb   = wb   = -1;
-
-        if (BIASED)
-
-          { double lsqr, wsqr, trun;      //   Modification for high-compositional bias
 
-            wsqr = lsqr = 0.;
-            for (j = 0; j < len; j++)
-              { c = read[j];
-
-#define ADDR(e,cnt,sqr)	 sqr += (cnt[e]++) * skew[e];
-
-#define DELR(e,cnt,sqr)	 sqr -= (--cnt[e]) * skew[e];
-
-#define WADDR(e) ADDR(e,wcount,wsqr)
-#define WDELR(e) DELR(e,wcount,wsqr)
-#define LADDR(e) ADDR(e,lcount,lsqr)
-#define LDELR(e) DELR(e,lcount,lsqr)
-
-                if (j > WINDOW-3)
-                  { d = read[++wb];
-                    WDELR(d)
-                  }
-                WADDR(c)
+        for (t = 1; t < NTHREADS; t++)
+          if (pthread_create(threads+t,NULL,dust_thread,parm+t) != 0)
+            break;
+        for (u = t; u < NTHREADS; u++)      //  Run here any range no thread could be created for
+          dust_thread(parm+u);
+        dust_thread(parm);
+        for (u = 1; u < t; u++)
+          pthread_join(threads[u],NULL);
+
+        for (t = 0; t < NTHREADS; t++)
+          { ints = parm[t].ints;
+            for (i = parm[t].beg; i < parm[t].end; i++)
+              { n     = parm[t].ntop[i-parm[t].beg];
+                indx += n*sizeof(int);
+                fwrite(&indx,sizeof(int),1,afile);
+                fwrite(ints,sizeof(int),n,dfile);
 
-                if (lb < wb)
-                  { d = read[++lb];
-                    LDELR(d)
-                  }
-                trun  = (lcount[c]++) * skew[c];
-                lsqr += trun;
-                if (trun >= thresh2r)
-                  { while (lb < j)
-                      { d = read[++lb];
-                        LDELR(d)
-                        if (d == c) break;
-                      }
-                  }
+#ifdef DEBUG
 
-                jptr = cptr->prev;
-                if (jptr != cptr && jptr->beg <= wb)
-                  { c = jptr->end + 2;
-                    if (*mtop+1 >= jptr->beg)
-                      { if (*mtop < c)
-                          *mtop = c;
-                      }
+                printf("\nREAD %d\n",i);
+                for (jtop = ints; jtop < ints+n; jtop += 2)
+                  printf(" [%5d,%5d]\n",jtop[0],jtop[1]);
+
+                len = db->reads[i].end - db->reads[i].beg;
+                if (db->loaded)
+                  memcpy(read,((char *) db->bases)+db->reads[i].boff,len+1);
+                else
+                  Load_Read(db,i,read,0);
+
+                jtop = ints;
+                for (c = 0; c < len; c++)
+                  { while (jtop < ints+n && c > jtop[1])
+                      jtop += 2;
+                    if (jtop < ints+n && c >= *jtop)
+                      printf("%c",Caps[(int) read[c]]);
                     else
-                      { *++mtop = jptr->beg;
-                        *++mtop = c;
-                      }
-                    lptr = jptr->prev;
-                    cptr->prev = lptr;
-                    lptr->next = cptr;
-                    jptr->next = aptr;
-                    aptr = jptr;
+                      printf("%c",Lowr[(int) read[c]]);
+                    if ((c%80) == 79)
+                      printf("\n");
                   }
+                printf("\n");
 
-                if (wsqr <= lsqr*THRESH) continue;
-
-                jptr   = cptr->next;
-                lptr   = cptr;
-                mscore = 0.;
-                for (c = lb; c > wb; c--)
-                  { d = read[c];
-                    LADDR(d)
-                    if (lsqr >= THRESH * (j-c))
-                      { for ( ; jptr->beg >= c; jptr = (lptr = jptr)->next)
-                          if (jptr->score > mscore)
-                            mscore = jptr->score;
-                        if (lsqr >= mscore * (j-c))
-                          { mscore = lsqr / (j-c);
-                            if (lptr->beg == c)
-                              { lptr->end   = j;
-                                lptr->score = mscore;
-                              }
-                            else
-                              { aptr->beg   = c;
-                                aptr->end   = j;
-                                aptr->score = mscore;
-                                aptr->prev  = lptr;
-                                lptr = lptr->next = aptr;
-                                aptr = aptr->next;
-                                jptr->prev = lptr;
-                                lptr->next = jptr;
-                              }
-                          }
-                      }
-                  }
+#endif
 
-                for (c++; c <= lb; c++)
-                  { d = read[c];
-                    LDELR(d)
-                  }
+                ints += n;
               }
           }
+      }
 
+    for (t = 0; t < NTHREADS; t++)
+      { if (parm[t].rdr == NULL)
+          free(parm[t].read-1);
         else
-
-          { int lsqr, wsqr, trun;                 //  Algorithm for GC-balanced sequences
-
-            wsqr = lsqr = 0;
-            for (j = 0; j < len; j++)
-              { c = read[j];
-
-#define ADDI(e,cnt,sqr)	 sqr += (cnt[e]++);
-
-#define DELI(e,cnt,sqr)	 sqr -= (--cnt[e]);
-
-#define WADDI(e) ADDI(e,wcount,wsqr)
-#define WDELI(e) DELI(e,wcount,wsqr)
-#define LADDI(e) ADDI(e,lcount,lsqr)
-#define LDELI(e) DELI(e,lcount,lsqr)
-
-                if (j > WINDOW-3)
-                  { d = read[++wb];
-                    WDELI(d)
-                  }
-                WADDI(c)
-
-                if (lb < wb)
-                  { d = read[++lb];
-                    LDELI(d)
-                  }
-                trun  = lcount[c]++;
-                lsqr += trun;
-                if (trun >= thresh2i)
-                  { while (lb < j)
-                      { d = read[++lb];
-                        LDELI(d)
-                        if (d == c) break;
-                      }
-                  }
-
-                jptr = cptr->prev;
-                if (jptr != cptr && jptr->beg <= wb)
-                  { c = jptr->end + 2;
-                    if (*mtop+1 >= jptr->beg)
-                      { if (*mtop < c)
-                          *mtop = c;
-                      }
-                    else
-                      { *++mtop = jptr->beg;
-                        *++mtop = c;
-                      }
-                    lptr = jptr->prev;
-                    cptr->prev = lptr;
-                    lptr->next = cptr;
-                    jptr->next = aptr;
-                    aptr = jptr;
-                  }
-
-                if (wsqr <= lsqr*THRESH) continue;
-
-                jptr   = cptr->next;
-                lptr   = cptr;
-                mscore = 0.;
-                for (c = lb; c > wb; c--)
-                  { d = read[c];
-                    LADDI(d)
-                    if (lsqr >= THRESH * (j-c))
-                      { for ( ; jptr->beg >= c; jptr = (lptr = jptr)->next)
-                          if (jptr->score > mscore)
-                            mscore = jptr->score;
-                        if (lsqr >= mscore * (j-c))
-                          { mscore = (1. * lsqr) / (j-c);
-                            if (lptr->beg == c)
-                              { lptr->end   = j;
-                                lptr->score = mscore;
-                              }
-                            else
-                              { aptr->beg   = c;
-                                aptr->end   = j;
-                                aptr->score = mscore;
-                                aptr->prev  = lptr;
-                                lptr = lptr->next = aptr;
-                                aptr = aptr->next;
-                                jptr->prev = lptr;
-                                lptr->next = jptr;
-                              }
-                          }
-                      }
-                  }
-
-                for (c++; c <= lb; c++)
-                  { d = read[c];
-                    LDELI(d)
-                  }
-              }
-          }
-
-        while ((jptr = cptr->prev) != cptr)
-          { c = jptr->end + 2;
-            if (*mtop+1 >= jptr->beg)
-              { if (*mtop < c)
-                  *mtop = c;
-              }
-            else
-              { *++mtop = jptr->beg;
-                *++mtop = c;
-              }
-            cptr->prev = jptr->prev;
-            jptr->prev->next = cptr;
-            jptr->next = aptr;
-            aptr = jptr;
-          }
-
-        { int *jtop, ntop;
-
-          ntop = 0;
-          for (jtop = mask1; jtop < mtop; jtop += 2)
-            if (jtop[1] - jtop[0] >= MINLEN)
-              { mask[++ntop] = jtop[0];
-                mask[++ntop] = jtop[1];
-              }
-          mtop  = mask + ntop;
-          indx += ntop*sizeof(int);
-          fwrite(&indx,sizeof(int),1,afile);
-          fwrite(mask1,sizeof(int),ntop,dfile);
-        }
-
-#ifdef DEBUG
-
-        { int *jtop;
-
-          printf("\nREAD %d\n",i);
-          for (jtop = mask1; jtop < mtop; jtop += 2)
-            printf(" [%5d,%5d]\n",jtop[0],jtop[1]);
-
-          Load_Read(db,i,read,0);
-
-          jtop = mask1;
-          for (c = 0; c < len; c++)
-            { while (jtop < mtop && c > jtop[1])
-                jtop += 2;
-              if (jtop < mtop && c >= *jtop)
-                printf("%c",Caps[(int) read[c]]);
-              else
-                printf("%c",Lowr[(int) read[c]]);
-              if ((c%80) == 79)
-                printf("\n");
-            }
-          printf("\n");
-        }
-
-#endif
+          Close_Reader(parm[t].rdr);
+        Free_Duster(&(parm[t].dust));
+        free(parm[t].ntop);
+        free(parm[t].ints);
       }
+    free(threads);
+    free(parm);
   }
 
   fclose(afile);
@@ -0,0 +1,427 @@
+/********************************************************************************************
+ *
+ *  Repack the base pairs and quality values of a .db in block order:
+ *     Rewrite the .bps and .qvs files of <path>.db so that the reads each block of the
+ *     current partition retains (those that are not shorter than the cutoff and, unless all
+ *     reads of a well are kept, the best of their well) are laid out contiguously and in
+ *     block order, followed by a tail region holding every read trimmed out of the blocks.
+ *     The .boff and .coff fields of the .idx are updated accordingly.  The reads keep their
+ *     indices, so the tracks and overlaps of the DB remain valid, and a trimmed block is
+ *     then loaded with a single sequential read.  The block directory and summary
+ *     of the DB are rewritten to reflect the new .idx.  The old files are
+ *     kept as backups until all the new ones are in place, so that an interrupted repack is
+ *     undone by the next one.
+ *
+ *  Date  :  October 2026
+ *
+ ********************************************************************************************/
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include "DB.h"
+
+#ifdef HIDE_FILES
+#define PATHSEP "/."
+#else
+#define PATHSEP "/"
+#endif
+
+static char *Usage = "[-v] <path:db>";
+
+static HITS_READ *Reads;   //  For the qsort of reads by .qvs offset
+
+static int COFF_ORDER(const void *l, const void *r)
+{ int64 x = Reads[*((int *) l)].coff;
+  int64 y = Reads[*((int *) r)].coff;
+
+  if (x < y)
+    return (-1);
+  else if (x > y)
+    return (1);
+  return (0);
+}
+
+  //  Copy the len bytes at offset off of in to the end of out (positioned at its end),
+  //    seeking in only when it is not already there.  Return non-zero on an I/O error.
+
+static int Copy_Span(FILE *in, int64 off, int64 len, FILE *out, char *buf)
+{ if (ftello(in) != off)
+    fseeko(in,off,SEEK_SET);
+  if (fread(buf,1,len,in) != (size_t) len)
+    return (1);
+  if (fwrite(buf,1,len,out) != (size_t) len)
+    return (1);
+  return (0);
+}
+
+  //  The files a repack replaces, their new versions, and the backups of the old versions
+  //    that are kept until all the new ones are in place.  The backup of the .idx is made
+  //    first and removed first, so the repack is complete exactly when it does not exist.
+
+static char *Cur_Suffix[3] = { ".bps", ".qvs", ".idx" };
+static char *New_Suffix[3] = { ".bpx", ".qvx", ".ixx" };
+static char *Old_Suffix[3] = { ".bpo", ".qvo", ".ixo" };
+
+  //  Rename file path+from to path+to (Catenate's result must be copied as it is overwritten
+  //    by the next call).  Return non-zero if this fails.
+
+static int Rename_File(char *path, char *from, char *to)
+{ char *name;
+  int   status;
+
+  name = Strdup(Catenate(path,from,"",""),"Allocating file name");
+  if (name == NULL)
+    return (1);
+  status = rename(name,Catenate(path,to,"",""));
+  if (status != 0)
+    fprintf(stderr,"%s: Could not rename %s%s to %s%s\n",Prog_Name,path,from,path,to);
+  free(name);
+  return (status != 0);
+}
+
+  //  Put back the backups for which made[k] is set, the .idx last, returning non-zero if this
+  //    was not possible
+
+static int Restore_Files(char *path, int *made)
+{ int k, status;
+
+  status = 0;
+  for (k = 0; k < 3; k++)
+    if (made[k])
+      status |= Rename_File(path,Old_Suffix[k],Cur_Suffix[k]);
+  return (status);
+}
+
+  //  Replace the current files (with the .qvs only if qvs is set) by the new ones: move each
+  //    current file to its backup, the .idx first, then each new file into place, the .idx
+  //    last, and only then remove the backups.  On failure the backups are put back, leaving
+  //    the DB as it was.
+
+static int Swap_Files(char *path, int qvs)
+{ int made[3];
+  int k;
+
+  made[0] = made[1] = made[2] = 0;
+  for (k = 2; k >= 0; k--)
+    if (k != 1 || qvs)
+      { if (Rename_File(path,Cur_Suffix[k],Old_Suffix[k]))
+          goto restore;
+        made[k] = 1;
+      }
+  for (k = 0; k < 3; k++)
+    if ((k != 1 || qvs) && Rename_File(path,New_Suffix[k],Cur_Suffix[k]))
+      goto restore;
+  for (k = 2; k >= 0; k--)
+    unlink(Catenate(path,Old_Suffix[k],"",""));
+  return (0);
+
+restore:
+  if (Restore_Files(path,made))
+    fprintf(stderr,"%s: Could not restore the backups %s.{bpo,qvo,ixo}\n",Prog_Name,path);
+  return (1);
+}
+
+int main(int argc, char *argv[])
+{ HITS_DB    db;
+  HITS_READ *reads;
+  int        nreads;
+  int        nblocks;
+  int       *order;
+  int64     *qlen;
+  int        nqvs;
+  char      *pwd, *root, *path;
+
+  int        VERBOSE;
+
+  { int   i, j, k;
+    int   flags[128];
+
+    ARG_INIT("DBrepack")
+
+    j = 1;
+    for (i = 1; i < argc; i++)
+      if (argv[i][0] == '-')
+        { ARG_FLAGS("v") }
+      else
+        argv[j++] = argv[i];
+    argc = j;
+
+    VERBOSE = flags['v'];
+
+    if (argc != 2)
+      { fprintf(stderr,"Usage: %s %s\n",Prog_Name,Usage);
+        exit (1);
+      }
+  }
+
+  //  If a previous repack was interrupted while replacing the files (the backup of the .idx
+  //    exists), undo it first, otherwise remove any backups left after its completion
+
+  pwd  = PathTo(argv[1]);
+  root = Root(argv[1],".db");
+  path = Strdup(Catenate(pwd,PATHSEP,root,""),"Allocating DB path");
+  if (path == NULL)
+    exit (1);
+  { int made[3];
+    int k;
+
+    if (access(Catenate(path,Old_Suffix[2],"",""),F_OK) == 0)
+      { for (k = 0; k < 3; k++)
+          made[k] = (access(Catenate(path,Old_Suffix[k],"",""),F_OK) == 0);
+        if (Restore_Files(path,made))
+          exit (1);
+        for (k = 0; k < 3; k++)
+          unlink(Catenate(path,New_Suffix[k],"",""));
+        fprintf(stderr,"%s: Restored %s/%s.db from an interrupted repack\n",Prog_Name,pwd,root);
+      }
+    else
+      for (k = 0; k < 2; k++)
+        unlink(Catenate(path,Old_Suffix[k],"",""));
+  }
+
+  if (Open_DB(argv[1],&db))
+    exit (1);
+  if (db.part > 0)
+    { fprintf(stderr,"%s: Command only applies to the entire DB\n",Prog_Name);
+      exit (1);
+    }
+
+  reads  = db.reads;
+  nreads = db.oreads;
+
+  //  Determine the new layout order of the reads: the reads retained by each block of the
+  //    partition in block order, and then all the reads trimmed out of the blocks.  Read 0
+  //    is always placed first so that it, and only it, has offset 0 in the .qvs (an offset
+  //    of 0 otherwise signals a read without QVs).
+
+  { FILE *dbvis;
+    char  buffer[2*MAX_NAME+100];
+    int   nfiles, cutoff, all, best;
+    int64 size;
+    int   b, i, o, t, x, ofirst, olast, bfirst, rlen;
+
+    order = (int *) Malloc(sizeof(int)*(nreads+1),"Allocating read order");
+    if (order == NULL)
+      exit (1);
+
+    dbvis = Fopen(Catenate(pwd,"/",root,".db"),"r");
+    if (dbvis == NULL)
+      exit (1);
+    fscanf(dbvis,DB_NFILE,&nfiles);
+    for (i = 0; i < nfiles; i++)
+      fgets(buffer,2*MAX_NAME+100,dbvis);
+    if (fscanf(dbvis,DB_NBLOCK,&nblocks) != 1)
+      { nblocks = 0;
+        cutoff  = 0;
+        all     = 1;
+      }
+    else
+      fscanf(dbvis,DB_PARAMS,&size,&cutoff,&all);
+    best = (all ? 0 : DB_BEST);
+
+    o = 0;
+    t = nreads;
+    order[o++] = 0;
+    if (nblocks == 0)
+      for (i = 1; i < nreads; i++)
+        order[o++] = i;
+    else
+      { fscanf(dbvis,DB_BDATA,&ofirst,&bfirst);
+        for (b = 0; b < nblocks; b++)
+          { if (fscanf(dbvis,DB_BDATA,&olast,&bfirst) != 2 || olast < ofirst || olast > nreads)
+              { fprintf(stderr,"%s: Partition of %s/%s.db is corrupt\n",Prog_Name,pwd,root);
+                exit (1);
+              }
+            for (i = ofirst; i < olast; i++)
+              if (i > 0)
+                { rlen = reads[i].end - reads[i].beg;
+                  if (rlen >= cutoff && (reads[i].flags & best) == best)
+                    order[o++] = i;
+                  else
+                    order[--t] = i;
+                }
+            ofirst = olast;
+          }
+
+        //  The trimmed reads were entered from the top down, reverse them so that the tail
+        //    is in index order.
+
+        for (i = t, b = nreads-1; i < b; i++, b--)
+          { x        = order[i];
+            order[i] = order[b];
+            order[b] = x;
+          }
+      }
+    fclose(dbvis);
+
+    if (o != t)
+      { fprintf(stderr,"%s: Partition of %s/%s.db does not cover the DB\n",Prog_Name,pwd,root);
+        exit (1);
+      }
+
+    if (VERBOSE)
+      { fprintf(stderr,"Repacking ");
+        Print_Number(nreads,0,stderr);
+        fprintf(stderr," reads, ");
+        Print_Number(t,0,stderr);
+        fprintf(stderr," retained in ");
+        Print_Number(nblocks,0,stderr);
+        fprintf(stderr," blocks\n");
+        fflush(stderr);
+      }
+  }
+
+  //  Determine which reads have QVs (those of the files QVs have been added for, a prefix of
+  //    the reads) and the length of the .qvs span of each, i.e. the distance to the next
+  //    offset in the .qvs.  The span of the first read of a file includes the compression
+  //    scheme preceding its entry, so the pair moves together.
+
+  { struct stat info;
+    int        *sort;
+    int         i;
+
+    nqvs = 0;
+    qlen = NULL;
+    if (stat(Catenate(pwd,PATHSEP,root,".qvs"),&info) == 0 && info.st_size > 0)
+      { for (i = nreads-1; i > 0; i--)
+          if (reads[i].coff != 0)
+            break;
+        nqvs = i+1;
+
+        qlen = (int64 *) Malloc(sizeof(int64)*nqvs,"Allocating QV spans");
+        sort = (int *) Malloc(sizeof(int)*nqvs,"Allocating QV spans");
+        if (qlen == NULL || sort == NULL)
+          exit (1);
+        for (i = 0; i < nqvs; i++)
+          sort[i] = i;
+        Reads = reads;
+        qsort(sort,nqvs,sizeof(int),COFF_ORDER);
+        for (i = 0; i < nqvs-1; i++)
+          qlen[sort[i]] = reads[sort[i+1]].coff - reads[sort[i]].coff;
+        qlen[sort[nqvs-1]] = info.st_size - reads[sort[nqvs-1]].coff;
+        free(sort);
+      }
+  }
+
+  //  Copy the bases, and the QVs if any, of the reads in the new order into new .bps and
+  //    .qvs files, recording the new offsets in the read records, then write the new .idx,
+  //    and finally replace the old files with the new ones.
+
+  { FILE  *ibps, *obps, *iqvs, *oqvs, *oidx;
+    char  *buf;
+    int64  bmax, boff, coff;
+    int    i, k, len;
+
+    bmax = COMPRESSED_LEN(db.maxlen);
+    for (i = 0; i < nqvs; i++)
+      if (qlen[i] > bmax)
+        bmax = qlen[i];
+    buf = (char *) Malloc(bmax+1,"Allocating copy buffer");
+    if (buf == NULL)
+      exit (1);
+
+    ibps = Fopen(Catenate(pwd,PATHSEP,root,".bps"),"r");
+    obps = Fopen(Catenate(pwd,PATHSEP,root,".bpx"),"w");
+    if (ibps == NULL || obps == NULL)
+      exit (1);
+    iqvs = oqvs = NULL;
+    if (nqvs > 0)
+      { iqvs = Fopen(Catenate(pwd,PATHSEP,root,".qvs"),"r");
+        oqvs = Fopen(Catenate(pwd,PATHSEP,root,".qvx"),"w");
+        if (iqvs == NULL || oqvs == NULL)
+          exit (1);
+      }
+
+    boff = 0;
+    coff = 0;
+    for (k = 0; k < nreads; k++)
+      { i   = order[k];
+        len = COMPRESSED_LEN(reads[i].end - reads[i].beg);
+        if (Copy_Span(ibps,reads[i].boff,len,obps,buf))
+          { fprintf(stderr,"%s: Could not copy the bases of read %d\n",Prog_Name,i+1);
+            goto error;
+          }
+        reads[i].boff = boff;
+        boff += len;
+        if (i < nqvs)
+          { if (Copy_Span(iqvs,reads[i].coff,qlen[i],oqvs,buf))
+              { fprintf(stderr,"%s: Could not copy the QVs of read %d\n",Prog_Name,i+1);
+                goto error;
+              }
+            reads[i].coff = coff;
+            coff += qlen[i];
+          }
+      }
+
+    fclose(ibps);
+    if (fclose(obps) != 0)
+      { fprintf(stderr,"%s: Could not write %s/%s.bpx\n",Prog_Name,pwd,root);
+        goto error;
+      }
+    if (nqvs > 0)
+      { fclose(iqvs);
+        if (fclose(oqvs) != 0)
+          { fprintf(stderr,"%s: Could not write %s/%s.qvx\n",Prog_Name,pwd,root);
+            goto error;
+          }
+      }
+
+    { HITS_DB dbs;
+      FILE   *iidx;
+
+      iidx = Fopen(Catenate(pwd,PATHSEP,root,".idx"),"r");
+      oidx = Fopen(Catenate(pwd,PATHSEP,root,".ixx"),"w");
+      if (iidx == NULL || oidx == NULL)
+        goto error;
+      if (fread(&dbs,sizeof(HITS_DB),1,iidx) != 1)
+        { fprintf(stderr,"%s: Could not read %s/%s.idx\n",Prog_Name,pwd,root);
+          goto error;
+        }
+      fclose(iidx);
+      fwrite(&dbs,sizeof(HITS_DB),1,oidx);
+      fwrite(reads,sizeof(HITS_READ),nreads,oidx);
+      if (fclose(oidx) != 0)
+        { fprintf(stderr,"%s: Could not write %s/%s.ixx\n",Prog_Name,pwd,root);
+          goto error;
+        }
+    }
+
+    if (Swap_Files(path,nqvs > 0))
+      goto error;
+
+    free(buf);
+    goto done;
+
+  error:
+    for (k = 0; k < 3; k++)
+      unlink(Catenate(path,New_Suffix[k],"",""));
+    exit (1);
+
+  done:
+    ;
+  }
+
+  //  The derived files of the .idx are now stale: rewrite them from the updated read records
+
+  { int status;
+
+    status = Write_DB_Summary(argv[1],&db);
+    if (nblocks > 0)
+      status |= Write_Block_Directory(argv[1],&db);
+    if (status)
+      exit (1);
+  }
+
+  free(qlen);
+  free(order);
+  free(path);
+  free(root);
+  free(pwd);
+  Close_DB(&db);
+
+  exit (0);
+}
@@ -67,22 +67,23 @@ int main(int argc, char *argv[])
       }
   }
 
-  //  Open DB, QVs if requested, Dust track if requested, and then trim unless -u set
+  //  Open DB (mapped as reads are fetched in an arbitrary order), QVs if requested, Dust
+  //    track if requested, and then trim unless -u set
 
-  if (Open_DB(argv[1],db))
+  if (Open_DB_Mapped(argv[1],db))
     exit (1);
 
   if (QVTOO || QVNUR)
     Load_QVs(db);
 
   if (DUST)
-    { dust = Load_Track(db,"dust");
+    { dust = Load_Track_Mapped(db,"dust");
       if (dust == NULL && db->part > 0)
         { int oreads = db->oreads;
           int ofirst = db->ofirst;
           db->oreads = db->nreads;
           db->ofirst = 0;
-          dust = Load_Track(db,Numbered_Suffix("",db->part,".dust"));
+          dust = Load_Track_Mapped(db,Numbered_Suffix("",db->part,".dust"));
           db->oreads = oreads;
           db->ofirst = ofirst;
         }
@@ -153,6 +154,7 @@ int main(int argc, char *argv[])
 
   { HITS_READ  *reads;
     int        *anno, *data;
+    int64       base;
     char       *read, **entry;
     int         c, b, e, i;
     int         hilight;
@@ -164,6 +166,7 @@ int main(int argc, char *argv[])
     if (dust != NULL)
       { anno = (int *) dust->anno;
         data = (int *) dust->data;
+        base = dust->base;
       }
 
     hilight = 'a'-'A';
@@ -203,8 +206,8 @@ int main(int argc, char *argv[])
             if (dust != NULL)
               { int  s, f, b, e, m;
 
-                s = (anno[i] >> 2);
-                f = (anno[i+1] >> 2);
+                s = ((anno[i]-base) >> 2);
+                f = ((anno[i+1]-base) >> 2);
                 if (s < f)
                   { for (j = s; j < f; j += 2)
                       { b = data[j];
@@ -7,15 +7,25 @@
  *     reads from a given well are also ignored.  The remaining reads are split amongst the
  *     blocks so that each block is of size -s * 1Mbp except for the last which necessarily
  *     contains a smaller residual.  The default value for -s is 400Mbp because blocks of this
- *     size can be compared by our "overlapper" dalign in roughly 16Gb of memory.  The blocks
+ *     size can be compared by our "overlapper" dalign in roughly 16Gb of memory.  With -n
+ *     the trimmed DB is instead split into the given number of equal sized blocks, and with
+ *     -w the blocks are balanced by the sum of the squares of their read lengths, an estimate
+ *     of the work of comparing them, rather than by their number of bases.  The blocks
  *     are very space efficient in that their sub-index of the master .idx is computed on the
  *     fly when loaded, and the .bps file of base pairs is shared with the master DB.  Any
  *     tracks associated with the DB are also computed on the fly when loading a database block.
+ *     A block directory (.bdir) recording the extent of each block is written so that a
+ *     block can be opened without scanning the stub, and the summary (.stats) of the DB is
+ *     rewritten with that of each block.
  *
  *  Author:  Gene Myers
  *  Date  :  September 2013
  *  Mod   :  New splitting definition to support incrementality, and new stub file format
  *  Date  :  April 2014
+ *  Mod   :  Write the block directory and the summary
+ *  Date  :  October 2026
+ *  Mod   :  -n and -w options to split into a given number of blocks balanced by bases or work
+ *  Date  :  October 2026
  *
  ********************************************************************************************/
 
@@ -32,7 +42,7 @@
 #define PATHSEP "/"
 #endif
 
-static char *Usage = "[-a] [-x<int>] [-s<int(400)>] <path:db>";
+static char *Usage = "[-aw] [-x<int>] [-s<int(400)>] [-n<int>] <path:db>";
 
 int main(int argc, char *argv[])
 { HITS_DB    db, dbs;
@@ -40,8 +50,10 @@ int main(int argc, char *argv[])
   FILE      *dbfile, *ixfile;
 
   int        ALL;
+  int        BALANCE;
   int        CUTOFF;
   int        SIZE;
+  int        NBLOCK;
 
   { int   i, j, k;
     int   flags[128];
@@ -51,13 +63,14 @@ int main(int argc, char *argv[])
 
     CUTOFF = 0;
     SIZE   = 400;
+    NBLOCK = 0;
 
     j = 1;
     for (i = 1; i < argc; i++)
       if (argv[i][0] == '-')
         switch (argv[i][1])
         { default:
-            ARG_FLAGS("a")
+            ARG_FLAGS("aw")
             break;
           case 'x':
             ARG_NON_NEGATIVE(CUTOFF,"Min read length cutoff")
@@ -65,12 +78,16 @@ int main(int argc, char *argv[])
           case 's':
             ARG_POSITIVE(SIZE,"Block size")
             break;
+          case 'n':
+            ARG_POSITIVE(NBLOCK,"Number of blocks")
+            break;
         }
       else
         argv[j++] = argv[i];
     argc = j;
 
-    ALL = flags['a'];
+    ALL     = flags['a'];
+    BALANCE = flags['w'];
 
     if (argc != 2)
       { fprintf(stderr,"Usage: %s %s\n",Prog_Name,Usage);
@@ -122,52 +139,107 @@ int main(int argc, char *argv[])
     dbpos = ftello(dbfile);
     fseeko(dbfile,dbpos,SEEK_SET);
     fprintf(dbfile,DB_NBLOCK,0);
-    fprintf(dbfile,DB_PARAMS,(int64) SIZE,CUTOFF,ALL);
   }
 
   { HITS_READ *reads  = db.reads;
     int        nreads = db.oreads;
     int64      size, totlen;
-    int        nblock, ireads, breads, rlen;
+    int        nblock, ireads, breads, rlen, best;
     int        i;
 
     size = SIZE*1000000ll;
+    best = (ALL ? 0 : DB_BEST);
+
+    if (BALANCE || NBLOCK > 0)
+
+      //  Cut the trimmed DB into target blocks of equal work, where the work of a read is
+      //    its length, or with -w the square of its length (the cost of comparing it is
+      //    roughly proportional to this).  A cut is made after the first read at which the
+      //    accumulated work reaches that of the block's share, the work remaining then
+      //    being shared equally amongst the remaining blocks, so that the overshoot of one
+      //    block is not carried into the next.  The number of blocks is -n if given, and
+      //    otherwise the number of -s sized blocks the trimmed DB would be divided into.
+      //    The size recorded for the extension of the partition by fasta2DB is the
+      //    average number of bases per block, rounded to the nearest Mbp (at least 1).
+
+      { double total, work, next;
+        int64  tbases;
+        int    target;
+
+        tbases = 0;
+        total  = 0.;
+        for (i = 0; i < nreads; i++)
+          { rlen = reads[i].end - reads[i].beg;
+            if (rlen >= CUTOFF && (reads[i].flags & best) == best)
+              { tbases += rlen;
+                if (BALANCE)
+                  total += ((double) rlen) * rlen;
+                else
+                  total += rlen;
+              }
+          }
+
+        if (NBLOCK > 0)
+          target = NBLOCK;
+        else
+          target = (tbases + (size-1)) / size;
+        if (target < 1)
+          target = 1;
+        SIZE   = (tbases / target + 500000) / 1000000;
+        if (SIZE < 1)
+          SIZE = 1;
+
+        fprintf(dbfile,DB_PARAMS,(int64) SIZE,CUTOFF,ALL);
+
+        nblock = 0;
+        ireads = 0;
+        breads = 0;
+        work   = 0.;
+        next   = total / target;
+        fprintf(dbfile,DB_BDATA,0,0);
+        for (i = 0; i < nreads; i++)
+          { rlen = reads[i].end - reads[i].beg;
+            if (rlen >= CUTOFF && (reads[i].flags & best) == best)
+              { ireads += 1;
+                breads += 1;
+                if (BALANCE)
+                  work += ((double) rlen) * rlen;
+                else
+                  work += rlen;
+                if ((work >= next && nblock < target-1) || ireads >= READMAX)
+                  { fprintf(dbfile,DB_BDATA,i+1,breads);
+                    ireads = 0;
+                    nblock += 1;
+                    if (nblock < target)
+                      next = work + (total - work) / (target - nblock);
+                  }
+              }
+          }
+      }
 
-    nblock = 0;
-    totlen = 0;
-    ireads = 0;
-    breads = 0;
-    fprintf(dbfile,DB_BDATA,0,0);
-    if (ALL)
-      for (i = 0; i < nreads; i++)
-        { rlen = reads[i].end - reads[i].beg;
-          if (rlen >= CUTOFF)
-            { ireads += 1;
-              breads += 1;
-              totlen += rlen;
-              if (totlen >= size || ireads >= READMAX)
-                { fprintf(dbfile,DB_BDATA,i+1,breads);
-                  totlen = 0;
-                  ireads = 0;
-                  nblock += 1;
-                }
-            }
-        }
     else
-      for (i = 0; i < nreads; i++)
-        { rlen = reads[i].end - reads[i].beg;
-          if (rlen >= CUTOFF && (reads[i].flags & DB_BEST) != 0)
-            { ireads += 1;
-              breads += 1;
-              totlen += rlen;
-              if (totlen >= size || ireads >= READMAX)
-                { fprintf(dbfile,DB_BDATA,i+1,breads);
-                  totlen = 0;
-                  ireads = 0;
-                  nblock += 1;
-                }
-            }
-        }
+      { fprintf(dbfile,DB_PARAMS,(int64) SIZE,CUTOFF,ALL);
+
+        nblock = 0;
+        totlen = 0;
+        ireads = 0;
+        breads = 0;
+        fprintf(dbfile,DB_BDATA,0,0);
+        for (i = 0; i < nreads; i++)
+          { rlen = reads[i].end - reads[i].beg;
+            if (rlen >= CUTOFF && (reads[i].flags & best) == best)
+              { ireads += 1;
+                breads += 1;
+                totlen += rlen;
+                if (totlen >= size || ireads >= READMAX)
+                  { fprintf(dbfile,DB_BDATA,i+1,breads);
+                    totlen = 0;
+                    ireads = 0;
+                    nblock += 1;
+                  }
+              }
+          }
+      }
 
     if (ireads > 0)
       { fprintf(dbfile,DB_BDATA,nreads,breads);
@@ -187,6 +259,12 @@ int main(int argc, char *argv[])
 
   fclose(ixfile);
   fclose(dbfile);
+
+  if (Write_Block_Directory(argv[1],&db) || Write_DB_Summary(argv[1],&db))
+    { Close_DB(&db);
+      exit (1);
+    }
+
   Close_DB(&db);
 
   exit (0);
@@ -5,6 +5,10 @@
  *  Author:  Gene Myers
  *  Date  :  July 2013
  *  Mod   :  April 2014
+ *  Mod   :  Single pass over the mapped index by -T threads that each histogram the exact
+ *             lengths of a range of reads, N50/N90 and well counts (-n), base composition
+ *             of the selected reads (-c), and TSV or JSON output (-f)
+ *  Mod   :  Statistics from the DB summary file when it is current
  *
  ********************************************************************************************/
 
@@ -12,18 +16,105 @@
 #include <stdio.h>
 #include <string.h>
 #include <math.h>
+#include <pthread.h>
 
 #include "DB.h"
 
-static char *Usage = " [-a] [-x<int>] [-b<int(1000)>] <name:db>";
+static char *Usage = "[-acn] [-x<int>] [-b<int(1000)>] [-f<tsv|json>] [-T<int(1)>] <name:db>";
+
+#define FORMAT_TEXT  0
+#define FORMAT_TSV   1
+#define FORMAT_JSON  2
+
+static int ALL, CUTOFF;
+static int NTHREADS;
+
+  //  A thread gathers the statistics of the selected reads in [beg,end): count[l] is the
+  //    number of reads of length l, wells the number of wells (runs of reads with the same
+  //    origin) with a selected read,
+  //    bases[0..3] the number of each base (if a reader is given), and numint & dustlen the
+  //    number and total length of the intervals of the dust track (if given).
+
+typedef struct
+  { HITS_DB     *db;
+    HITS_TRACK  *dust;
+    HITS_READER *reader;
+    int          beg, end;
+    int64       *count;
+    int64        wells;
+    int64        bases[4];
+    int64        numint, dustlen;
+  } Stats_Arg;
+
+static void *stats_thread(void *arg)
+{ Stats_Arg  *parm  = (Stats_Arg *) arg;
+  HITS_READ  *reads = parm->db->reads;
+  int64      *count = parm->count;
+  int         best  = (ALL ? 0 : DB_BEST);
+  int64       wells, numint, dustlen;
+  int         i, k, rlen, counted;
+  char       *seq;
+
+  wells   = 0;
+  numint  = 0;
+  dustlen = 0;
+  counted = 0;
+  for (i = parm->beg; i < parm->end; i++)
+    { if (i == parm->beg || reads[i].origin != reads[i-1].origin)
+        counted = 0;
+      rlen = reads[i].end - reads[i].beg;
+      if (rlen < CUTOFF || (reads[i].flags & best) != best)
+        continue;
+
+      count[rlen] += 1;
+      if ( ! counted)
+        { wells  += 1;
+          counted = 1;
+        }
+
+      if (parm->reader != NULL)
+        { seq = Reader_Load_Read(parm->reader,i,0);
+          for (k = 0; k < rlen; k++)
+            parm->bases[(int) seq[k]] += 1;
+        }
+
+      if (parm->dust != NULL)
+        { void *data = parm->dust->data;
+          int  *anno = (int *) parm->dust->anno;
+          int64 base = parm->dust->base;
+          int  *idata, *edata;
+
+          edata = (int *) (data + (anno[i+1]-base));
+          for (idata = (int *) (data + (anno[i]-base)); idata < edata; idata += 2)
+            { numint  += 1;
+              dustlen += (idata[1] - *idata) + 1;
+            }
+        }
+    }
+
+  parm->wells   = wells;
+  parm->numint  = numint;
+  parm->dustlen = dustlen;
+  return (NULL);
+}
+
+static void Print_JSON_String(char *s)
+{ printf("\"");
+  for ( ; *s != '\0'; s++)
+    if (*s == '"' || *s == '\\')
+      printf("\\%c",*s);
+    else
+      printf("%c",*s);
+  printf("\"");
+}
 
 int main(int argc, char *argv[])
 { HITS_DB     db;
-  HITS_READ  *reads;
+  HITS_TRACK *dust;
 
-  int        ALL;
-  int        CUTOFF;
   int        BIN;
+  int        FORMAT;
+  int        NXX, COMP;
 
   { int   i, j, k;
     int   flags[128];
@@ -31,15 +122,17 @@ int main(int argc, char *argv[])
 
     ARG_INIT("DBstats")
 
-    CUTOFF = 0;
-    BIN    = 1000;
+    CUTOFF   = 0;
+    BIN      = 1000;
+    FORMAT   = FORMAT_TEXT;
+    NTHREADS = 1;
 
     j = 1;
     for (i = 1; i < argc; i++)
       if (argv[i][0] == '-')
         switch (argv[i][1])
         { default:
-            ARG_FLAGS("a")
+            ARG_FLAGS("acn")
             break;
           case 'x':
             ARG_NON_NEGATIVE(CUTOFF,"Min read length cutoff")
@@ -47,12 +140,27 @@ int main(int argc, char *argv[])
           case 'b':
             ARG_POSITIVE(BIN,"Bin size")
             break;
+          case 'f':
+            if (strcmp(argv[i]+2,"tsv") == 0)
+              FORMAT = FORMAT_TSV;
+            else if (strcmp(argv[i]+2,"json") == 0)
+              FORMAT = FORMAT_JSON;
+            else
+              { fprintf(stderr,"%s: -f argument '%s' is not tsv or json\n",Prog_Name,argv[i]+2);
+                exit (1);
+              }
+            break;
+          case 'T':
+            ARG_POSITIVE(NTHREADS,"Number of threads")
+            break;
         }
       else
         argv[j++] = argv[i];
     argc = j;
 
-    ALL = flags['a'];
+    ALL  = flags['a'];
+    COMP = flags['c'];
+    NXX  = flags['n'];
 
     if (argc != 2)
       { fprintf(stderr,"Usage: %s %s\n",Prog_Name,Usage);
@@ -60,149 +168,327 @@ int main(int argc, char *argv[])
       }
   }
 
-  if (Open_DB(argv[1],&db))
+  if (Open_DB_Mapped(argv[1],&db))
     exit (1);
-  reads = db.reads;
 
-  { int         nbin, *hist;
-    int64       totlen, *bsum;
-    int         nreads;
-    int         i;
+  dust = Load_Track_Mapped(&db,"dust");
+  if (dust == NULL && db.part > 0)
+    { db.oreads = db.nreads;
+      db.ofirst = 0;
+      dust = Load_Track_Mapped(&db,Numbered_Suffix("",db.part,".dust"));
+    }
+
+  //  If there is no dust track to count and no composition to determine, then the
+  //    statistics come from the summary of the DB or block if it is current.  Otherwise
+  //    gather the statistics of the selected reads with NTHREADS threads each taking a
+  //    contiguous range of reads that starts a well, and sum the results into
+  //    count[0..maxlen], wells, bases[0..3], numint, and dustlen.
+
+  { HITS_SUMMARY *sum;
+    int64        *count;
+    int64         wells, numint, dustlen;
+    int64         bases[4];
+    int           nbin, maxlen, nreads;
+    int64         totlen;
+    int           i, c;
 
-    nbin = (db.maxlen-1)/BIN + 1;
-    hist = (int *) Malloc(sizeof(int)*nbin,"Allocating histograms");
-    bsum = (int64 *) Malloc(sizeof(int64)*nbin,"Allocating histograms");
-    if (hist == NULL || bsum == NULL)
+    maxlen = db.maxlen;
+    count  = (int64 *) Malloc(sizeof(int64)*(maxlen+1)*NTHREADS,"Allocating histograms");
+    if (count == NULL)
       exit (1);
+    bzero(count,sizeof(int64)*(maxlen+1)*NTHREADS);
 
-    for (i = 0; i < nbin; i++)
-      { hist[i] = 0;
-        bsum[i] = 0;
+    if (dust == NULL && ! COMP)
+      { sum = Read_DB_Summary(argv[1],db.part);
+        if (sum != NULL && (sum->nreads != db.nreads || sum->maxlen != maxlen))
+          { Free_DB_Summary(sum);
+            sum = NULL;
+          }
+      }
+    else
+      sum = NULL;
+
+    numint  = 0;
+    dustlen = 0;
+    for (c = 0; c < 4; c++)
+      bases[c] = 0;
+
+    if (sum != NULL)
+      { wells = 0;
+        for (i = CUTOFF; i <= maxlen; i++)
+          { count[i] = sum->count[ALL ? 0 : 1][i];
+            wells   += sum->wells[ALL ? 0 : 1][i];
+          }
+        Free_DB_Summary(sum);
       }
 
-    { int64 ave, dev;
- 
-      if ( ! ALL)
-        { for (i = 0; i < db.nreads;  i++)
-            if ((reads[i].flags & DB_BEST) == 0)
-              { reads[i].beg = 1;
-                reads[i].end = 0;
+    else
+      { Stats_Arg  *parm;
+        pthread_t  *threads;
+        int         t, u;
+
+        parm    = (Stats_Arg *) Malloc(sizeof(Stats_Arg)*NTHREADS,"Allocating thread records");
+        threads = (pthread_t *) Malloc(sizeof(pthread_t)*NTHREADS,"Allocating threads");
+        if (parm == NULL || threads == NULL)
+          exit (1);
+
+        for (t = 0; t < NTHREADS; t++)
+          { parm[t].db    = &db;
+            parm[t].dust  = dust;
+            parm[t].count = count + t*(maxlen+1);
+            for (c = 0; c < 4; c++)
+              parm[t].bases[c] = 0;
+            parm[t].beg = (((int64) db.nreads)*t)/NTHREADS;
+            if (t > 0)
+              { if (parm[t].beg < parm[t-1].beg)
+                  parm[t].beg = parm[t-1].beg;
+                while (parm[t].beg > 0 && parm[t].beg < db.nreads
+                           && db.reads[parm[t].beg].origin == db.reads[parm[t].beg-1].origin)
+                  parm[t].beg += 1;
+                parm[t-1].end = parm[t].beg;
+              }
+            if (COMP)
+              { parm[t].reader = Open_Reader(&db);
+                if (parm[t].reader == NULL)
+                  exit (1);
               }
+            else
+              parm[t].reader = NULL;
+          }
+        parm[NTHREADS-1].end = db.nreads;
+
+        for (t = 1; t < NTHREADS; t++)
+          if (pthread_create(threads+t,NULL,stats_thread,parm+t) != 0)
+            break;
+        for (u = t; u < NTHREADS; u++)      //  Run here any range no thread could be created for
+          stats_thread(parm+u);
+        stats_thread(parm);
+        for (u = 1; u < t; u++)
+          pthread_join(threads[u],NULL);
+
+        wells = 0;
+        for (t = 0; t < NTHREADS; t++)
+          { if (t > 0)
+              for (i = 0; i <= maxlen; i++)
+                count[i] += parm[t].count[i];
+            wells   += parm[t].wells;
+            numint  += parm[t].numint;
+            dustlen += parm[t].dustlen;
+            for (c = 0; c < 4; c++)
+              bases[c] += parm[t].bases[c];
+            if (parm[t].reader != NULL)
+              Close_Reader(parm[t].reader);
+          }
+        free(threads);
+        free(parm);
+      }
+
+    { int64      *hist, *bsum;
+      int64       ave, dev;
+      int         n50, n90;
+      double      freq[4];
+
+      //  Totals, mean, and deviation, and the histogram bins from the exact length counts
+
+      nbin = (maxlen-1)/BIN + 1;
+      hist = (int64 *) Malloc(sizeof(int64)*nbin,"Allocating histograms");
+      bsum = (int64 *) Malloc(sizeof(int64)*nbin,"Allocating histograms");
+      if (hist == NULL || bsum == NULL)
+        exit (1);
+
+      for (i = 0; i < nbin; i++)
+        { hist[i] = 0;
+          bsum[i] = 0;
         }
 
       totlen = 0;
       nreads = 0;
-      for (i = 0; i < db.nreads; i++)
-        { int rlen = ((int) reads[i].end) - reads[i].beg;
-          if (rlen >= CUTOFF)
-            { totlen += rlen;
-              nreads += 1;
-              hist[rlen/BIN] += 1;
-              bsum[rlen/BIN] += rlen;
-            }
+      for (i = 0; i <= maxlen; i++)
+        if (count[i] > 0)
+          { totlen += count[i]*i;
+            nreads += count[i];
+            hist[i/BIN] += count[i];
+            bsum[i/BIN] += count[i]*i;
+          }
+
+      if (nreads > 0)
+        { ave = totlen/nreads;
+          dev = 0;
+          for (i = 0; i <= maxlen; i++)
+            dev += count[i]*(i-ave)*(i-ave);
+          dev = sqrt(dev/nreads);
         }
+      else
+        ave = dev = 0;
+
+      //  N50 & N90: the length of the shortest read among the longest reads that together
+      //    have at least 50% (90%) of the bases
 
-      ave = totlen/nreads;
-      dev = 0;
-      for (i = 0; i < db.nreads; i++)
-        { int rlen = ((int) reads[i].end) - reads[i].beg;
-          if (rlen >= CUTOFF)
-            dev += (rlen-ave)*(rlen-ave);
+      { int64 cum;
+
+        n50 = n90 = 0;
+        cum = 0;
+        for (i = maxlen; i > 0 && totlen > 0; i--)
+          { cum += count[i]*i;
+            if (n50 == 0 && 2*cum >= totlen)
+              n50 = i;
+            if (10*cum >= 9*totlen)
+              { n90 = i;
+                break;
+              }
+          }
+      }
+
+      if (COMP)
+        { int64 nbase = bases[0] + bases[1] + bases[2] + bases[3];
+
+          for (c = 0; c < 4; c++)
+            freq[c] = (nbase > 0 ? (1.*bases[c])/nbase : 0.);
         }
-      dev = sqrt(dev/nreads);
-
-      if (CUTOFF == 0 && ALL)
-        { printf("\nStatistics over all reads in the data set\n\n");
-          Print_Number((int64) nreads,15,stdout);
-          printf(" reads\n");
-          Print_Number(totlen,15,stdout);
-          printf(" base pairs\n");
+      else
+        for (c = 0; c < 4; c++)
+          freq[c] = db.freq[c];
+
+      if (FORMAT == FORMAT_TSV)
+        { printf("db\t%s\n",argv[1]);
+          printf("all\t%d\n",ALL);
+          printf("cutoff\t%d\n",CUTOFF);
+          printf("reads\t%d\n",nreads);
+          printf("total_reads\t%d\n",db.nreads);
+          printf("bases\t%lld\n",totlen);
+          printf("total_bases\t%lld\n",db.totlen);
+          printf("wells\t%lld\n",wells);
+          printf("mean\t%lld\n",ave);
+          printf("stddev\t%lld\n",dev);
+          printf("n50\t%d\n",n50);
+          printf("n90\t%d\n",n90);
+          printf("composition\t%s\t%.4f\t%.4f\t%.4f\t%.4f\n",COMP ? "scanned" : "db",
+                 freq[0],freq[1],freq[2],freq[3]);
+          if (dust != NULL)
+            printf("dust\t%lld\t%lld\n",numint,dustlen);
+          printf("bin_size\t%d\n",BIN);
+          for (i = 0; i < nbin; i++)
+            if (hist[i] > 0)
+              printf("bin\t%d\t%lld\t%lld\n",i*BIN,hist[i],bsum[i]);
         }
+
+      else if (FORMAT == FORMAT_JSON)
+        { int first;
+
+          printf("{ \"db\": ");
+          Print_JSON_String(argv[1]);
+          printf(",\n  \"all\": %s,\n",ALL ? "true" : "false");
+          printf("  \"cutoff\": %d,\n",CUTOFF);
+          printf("  \"reads\": %d,\n",nreads);
+          printf("  \"total_reads\": %d,\n",db.nreads);
+          printf("  \"bases\": %lld,\n",totlen);
+          printf("  \"total_bases\": %lld,\n",db.totlen);
+          printf("  \"wells\": %lld,\n",wells);
+          printf("  \"mean\": %lld,\n",ave);
+          printf("  \"stddev\": %lld,\n",dev);
+          printf("  \"n50\": %d,\n",n50);
+          printf("  \"n90\": %d,\n",n90);
+          printf("  \"composition\": { \"source\": \"%s\", \"A\": %.4f, \"C\": %.4f,",
+                 COMP ? "scanned" : "db",freq[0],freq[1]);
+          printf(" \"G\": %.4f, \"T\": %.4f },\n",freq[2],freq[3]);
+          if (dust != NULL)
+            printf("  \"dust\": { \"intervals\": %lld, \"bases\": %lld },\n",numint,dustlen);
+          printf("  \"bin_size\": %d,\n",BIN);
+          printf("  \"histogram\": [");
+          first = 1;
+          for (i = 0; i < nbin; i++)
+            if (hist[i] > 0)
+              { printf("%s\n    { \"bin\": %d, \"count\": %lld, \"bases\": %lld }",
+                       first ? "" : ",",i*BIN,hist[i],bsum[i]);
+                first = 0;
+              }
+          printf("\n  ]\n}\n");
+        }
+
       else
-        { if (ALL)
-            printf("\nStatistics for all reads");
-          else
-            printf("\nStatistics for all wells");
-          if (CUTOFF > 0)
-            { printf(" of length ");
-              Print_Number(CUTOFF,0,stdout);
-              printf(" bases or more\n\n");
+        { if (CUTOFF == 0 && ALL)
+            { printf("\nStatistics over all reads in the data set\n\n");
+              Print_Number((int64) nreads,15,stdout);
+              printf(" reads\n");
+              Print_Number(totlen,15,stdout);
+              printf(" base pairs\n");
             }
           else
-            printf(" in the data set\n\n");
-          Print_Number((int64) nreads,15,stdout);
-          printf(" reads       out of ");
-          Print_Number((int64 ) db.nreads,15,stdout);
-          printf("   %5.1f%% loss\n",100.-(100.*nreads)/db.nreads);
-          Print_Number(totlen,15,stdout);
-          printf(" base pairs  out of ");
-          Print_Number(db.totlen,15,stdout);
-          printf("   %5.1f%% loss\n",100.-(100.*totlen)/db.totlen);
-        }
-      printf("\nBase composition: %.3f(A) %.3f(C) %.3f(G) %.3f(T)\n\n",
-             db.freq[0],db.freq[1],db.freq[2],db.freq[3]);
-      Print_Number(ave,15,stdout);
-      printf(" average read length\n");
-      Print_Number(dev,15,stdout);
-      printf(" standard deviation\n");
-    }
+            { if (ALL)
+                printf("\nStatistics for all reads");
+              else
+                printf("\nStatistics for all wells");
+              if (CUTOFF > 0)
+                { printf(" of length ");
+                  Print_Number(CUTOFF,0,stdout);
+                  printf(" bases or more\n\n");
+                }
+              else
+                printf(" in the data set\n\n");
+              Print_Number((int64) nreads,15,stdout);
+              printf(" reads       out of ");
+              Print_Number((int64 ) db.nreads,15,stdout);
+              printf("   %5.1f%% loss\n",100.-(100.*nreads)/db.nreads);
+              Print_Number(totlen,15,stdout);
+              printf(" base pairs  out of ");
+              Print_Number(db.totlen,15,stdout);
+              printf("   %5.1f%% loss\n",100.-(100.*totlen)/db.totlen);
+            }
+          printf("\nBase composition: %.3f(A) %.3f(C) %.3f(G) %.3f(T)\n\n",
+                 freq[0],freq[1],freq[2],freq[3]);
+          Print_Number(ave,15,stdout);
+          printf(" average read length\n");
+          Print_Number(dev,15,stdout);
+          printf(" standard deviation\n");
+          if (NXX)
+            { Print_Number((int64) n50,15,stdout);
+              printf(" N50 read length\n");
+              Print_Number((int64) n90,15,stdout);
+              printf(" N90 read length\n");
+              Print_Number(wells,15,stdout);
+              if (wells > 0)
+                printf(" wells, %.2f reads per well\n",(1.*nreads)/wells);
+              else
+                printf(" wells\n");
+            }
 
-    { int64 btot;
-      int   cum;
-
-      printf("\nDistribution of Read Lengths (Bin size = ");
-      Print_Number((int64) BIN,0,stdout);
-      printf(")\n\n    Bin:      Count  %% Reads  %% Bases   Average\n");
-      cum  = 0;
-      btot = 0;
-      for (i = nbin-1; i >= 0; i--)
-        { cum  += hist[i];
-          btot += bsum[i];
-          Print_Number((int64) (i*BIN),7,stdout);
-          printf(":");
-          Print_Number((int64) hist[i],11,stdout);
-          printf("    %5.1f    %5.1f    %5lld\n",(100.*cum)/nreads,(100.*btot)/totlen,btot/cum);
-          if (cum == nreads) break;
+          if (nreads > 0)
+            { int64 btot, cum;
+
+              printf("\nDistribution of Read Lengths (Bin size = ");
+              Print_Number((int64) BIN,0,stdout);
+              printf(")\n\n    Bin:      Count  %% Reads  %% Bases   Average\n");
+              cum  = 0;
+              btot = 0;
+              for (i = nbin-1; i >= 0; i--)
+                { cum  += hist[i];
+                  btot += bsum[i];
+                  Print_Number((int64) (i*BIN),7,stdout);
+                  printf(":");
+                  Print_Number(hist[i],11,stdout);
+                  printf("    %5.1f    %5.1f    %5lld\n",
+                         (100.*cum)/nreads,(100.*btot)/totlen,btot/cum);
+                  if (cum == nreads) break;
+                }
+            }
+          printf("\n");
+
+          if (dust != NULL)
+            { Print_Number(numint,0,stdout);
+              printf(" low-complexity intervals totaling ");
+              Print_Number(dustlen,0,stdout);
+              printf(" bases\n\n");
+            }
         }
-      printf("\n");
-    }
-  }
 
-  { HITS_TRACK *dust;
+      free(bsum);
+      free(hist);
+    }
 
-    dust = Load_Track(&db,"dust");
-    if (dust == NULL && db.part > 0)
-      { db.oreads = db.nreads;
-        db.ofirst = 0;
-        dust = Load_Track(&db,Numbered_Suffix("",db.part,".dust")); 
-      }
-    if (dust != NULL)
-      { void *data = dust->data;
-        int  *anno = (int *) dust->anno;
-        int   i, rlen;
-        int  *idata, *edata;
-        int64 numint, totlen;
-
-        totlen = 0;
-        numint = 0;
-        for (i = 0; i < db.nreads; i++)
-          { rlen = reads[i].end - reads[i].beg;
-            if (rlen >= CUTOFF)
-              { edata = (int *) (data + anno[i+1]);
-                for (idata = (int *) (data + anno[i]); idata < edata; idata += 2)
-                  { numint += 1;
-                    totlen += (idata[1] - *idata) + 1;
-                  }
-              }
-          }
-        Print_Number(numint,0,stdout);
-        printf(" low-complexity intervals totaling ");
-        Print_Number(totlen,0,stdout);
-        printf(" bases\n\n");
-      }
-    Close_Track(&db,"dust");
+    free(count);
   }
 
+  Close_Track(&db,"dust");
   Close_DB(&db);
 
   exit (0);
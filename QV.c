@@ -32,19 +32,6 @@
  *
  ********************************************************************************************/
 
-static int LittleEndian;  //  Little-endian machine ?
-                          //     Referred by: Decode & Decode_Run
-static int Flip;          //  Flip endian of all coded shorts and ints
-                          //     Referred by: Decode & Decode_Run & Read_Scheme
-
-static void Set_Endian(int flip)
-{ uint32 x = 3;
-  uint8 *b = (uint8 *) (&x);
-
-  Flip         = flip;
-  LittleEndian = (b[0] == 3);
-}
-
 static void Flip_Long(void *w)
 { uint8 *v = (uint8 *) w;
   uint8  x;
@@ -73,11 +60,21 @@ static void Flip_Short(void *w)
  *
  ********************************************************************************************/
 
+#define MULTI_BITS  12   //  Multi-symbol decode table is indexed by the next 12 bits
+
+typedef struct
+  { uint8  sym[4];   //  The symbols of the up to 4 complete codes in the next MULTI_BITS bits
+    uint8  nsym;     //  # of such symbols (0 => first code is longer or is an exception)
+    uint8  bits;     //  total # of bits in the nsym codes
+    uint8  last;     //  # of bits in the last of the codes
+  } HMulti;
+
 typedef struct
   { int    type;             //  0 => normal, 1 => normal but has long codes, 2 => truncated
     uint32 codebits[256];    //  If type = 2, then code 255 is the special code for
     int    codelens[256];    //    non-Huffman exceptions
     int    lookup[0x10000];  //  Lookup table (just for decoding)
+    HMulti multi[1 << MULTI_BITS];  //  Multi-symbol lookup table (just for decoding)
   } HScheme;
 
 typedef struct _HTree
@@ -317,7 +314,9 @@ static void Write_Scheme(HScheme *scheme, FILE *out)
 
   //  Allocate and read a code table from in, and return a pointer to it.
 
-static HScheme *Read_Scheme(FILE *in)
+  //  Read a scheme from in, flipping its code words if flip is set
+
+static HScheme *Read_Scheme(FILE *in, int flip)
 { HScheme *scheme;
   int     *look, *lens;
   uint32  *bits, base;
@@ -343,7 +342,7 @@ static HScheme *Read_Scheme(FILE *in)
         bits[i] = 0;
     }
 
-  if (Flip)
+  if (flip)
     { for (i = 0; i < 256; i++)
         Flip_Long(bits+i);
     }
@@ -357,6 +356,34 @@ static HScheme *Read_Scheme(FILE *in)
         }
     }
 
+  //  For each MULTI_BITS bit prefix, record the codes that lie wholly within it, stopping at
+  //    the first that does not or that is the exception code of a truncated scheme.
+
+  { HMulti *m;
+    int     signal, pos, c, n;
+
+    if (scheme->type == 2)
+      signal = 255;
+    else
+      signal = 256;
+
+    for (i = 0; i < (1 << MULTI_BITS); i++)
+      { m = scheme->multi + i;
+        m->nsym = m->bits = m->last = 0;
+        pos = 0;
+        while (m->nsym < 4)
+          { c = look[((i << pos) & ((1 << MULTI_BITS)-1)) << (16-MULTI_BITS)];
+            n = lens[c];
+            if (c == signal || pos + n > MULTI_BITS)
+              break;
+            m->sym[m->nsym++] = c;
+            m->last = n;
+            pos    += n;
+          }
+        m->bits = pos;
+      }
+  }
+
   return (scheme);
 }
 
@@ -367,25 +394,16 @@ static HScheme *Read_Scheme(FILE *in)
  *
  ********************************************************************************************/
 
-  //  Encode read[0..rlen-1] according to scheme and write to out
-
-static void Encode(HScheme *scheme, FILE *out, uint8 *read, int rlen)
-{ uint32  x, c, ocode;
-  int     n, k, olen, llen;
-  int    *nlens;
-  uint32 *nbits;
-  uint32  nspec;
-  int     nslen;
+  //  The encoders write their bit streams as 32-bit words, most significant bit first, into
+  //    the memory block out and return the number of bytes written.  At most 56 bits are
+  //    written per position of read, plus 2 words of padding, so 7*rlen+8 bytes suffice.
 
-  nlens = scheme->codelens;
-  nbits = scheme->codebits;
-
-  if (scheme->type == 2)
-    { nspec = nbits[255];
-      nslen = nlens[255];
-    }
-  else
-    nspec = nslen = 0x7fffffff;
+#define PUTWORD(W)				\
+{ uint32 word = (W);				\
+						\
+  memcpy(out+o,&word,sizeof(uint32));		\
+  o += sizeof(uint32);				\
+}
 
 #define OCODE(L,C)				\
 { int    len  = olen + (L);			\
@@ -395,7 +413,7 @@ static void Encode(HScheme *scheme, FILE *out, uint8 *read, int rlen)
   if (len >= 32)				\
     { olen   = len-32;				\
       ocode |= (code >> olen);			\
-      fwrite(&ocode,sizeof(uint32),1,out);	\
+      PUTWORD(ocode)				\
       if (olen > 0)				\
         ocode = (code << (32-olen));		\
       else					\
@@ -407,6 +425,40 @@ static void Encode(HScheme *scheme, FILE *out, uint8 *read, int rlen)
     }						\
 }
 
+  //  Tricky: must pad so decoder does not read past last integer int the coded output.
+
+#define OPAD					\
+{ if (olen > 0)					\
+    { PUTWORD(ocode)				\
+      if (llen > 16 && olen > llen)		\
+        PUTWORD(ocode)				\
+    }						\
+  else if (llen > 16)				\
+    PUTWORD(ocode)				\
+}
+
+  //  Encode read[0..rlen-1] according to scheme into out
+
+static int64 Encode(HScheme *scheme, uint8 *out, uint8 *read, int rlen)
+{ uint32  x, c, ocode;
+  int     n, k, olen, llen;
+  int    *nlens;
+  uint32 *nbits;
+  uint32  nspec;
+  int     nslen;
+  int64   o;
+
+  nlens = scheme->codelens;
+  nbits = scheme->codebits;
+
+  if (scheme->type == 2)
+    { nspec = nbits[255];
+      nslen = nlens[255];
+    }
+  else
+    nspec = nslen = 0x7fffffff;
+
+  o     = 0;
   llen  = 0;
   olen  = 0;
   ocode = 0;
@@ -419,25 +471,21 @@ static void Encode(HScheme *scheme, FILE *out, uint8 *read, int rlen)
         OCODE(8,x);
     }
 
-  if (olen > 0)                              //  Tricky: must pad so decoder does not read past
-    { fwrite(&ocode,sizeof(uint32),1,out);   //    last integer int the coded output.
-      if (llen > 16 && olen > llen)
-        fwrite(&ocode,sizeof(uint32),1,out);
-    }
-  else if (llen > 16)
-    fwrite(&ocode,sizeof(uint32),1,out);
+  OPAD
+  return (o);
 }
 
   //  Encode read[0..rlen-1] according to non-rchar table neme, and run-length table reme for
-  //    runs of rchar characters.  Write to out.
+  //    runs of rchar characters into out.
 
-static void Encode_Run(HScheme *neme, HScheme *reme, FILE *out, uint8 *read, int rlen, int rchar)
+static int64 Encode_Run(HScheme *neme, HScheme *reme, uint8 *out, uint8 *read, int rlen, int rchar)
 { uint32  x, c, ocode;
   int     n, h, k, olen, llen;
   int    *nlens, *rlens;
   uint32 *nbits, *rbits;
   uint32  nspec, rspec;
   int     nslen, rslen;
+  int64   o;
 
   nlens = neme->codelens;
   nbits = neme->codebits;
@@ -454,6 +502,7 @@ static void Encode_Run(HScheme *neme, HScheme *reme, FILE *out, uint8 *read, int
   rspec = rbits[255];
   rslen = rlens[255];
 
+  o     = 0;
   llen  = 0;
   olen  = 0;
   ocode = 0;
@@ -482,36 +531,63 @@ static void Encode_Run(HScheme *neme, HScheme *reme, FILE *out, uint8 *read, int
         }
     }
 
-  if (olen > 0)
-    { fwrite(&ocode,sizeof(uint32),1,out);
-      if (llen > 16 && olen > llen)
-        fwrite(&ocode,sizeof(uint32),1,out);
+  OPAD
+  return (o);
+}
+
+  //  The decoders work on an in-memory buffer buf[0..blen-1] whose 32-bit words are decoded
+  //    most significant bit first.  The next bits to be decoded are kept left justified in a
+  //    64-bit register that is refilled a word at a time whenever 32 or fewer bits remain,
+  //    so a code and its exception bits are always present.  The words are brought to the
+  //    native order (if flip is set) as they are fetched, and bytes beyond blen read as 0.
+  //
+  //    The encoder pads each stream so that the original word-at-a-time decoder, which always
+  //    looked 16 bits ahead of the last field it decoded, never read beyond the stream.  So
+  //    given the total # of bits, used, consumed by all the fields of a stream and the size,
+  //    last, of its final field, the stream occupies ceil((16+used-last)/32) words, which is
+  //    what each decoder returns (as a byte count).
+
+static inline uint32 Get_Word(uint8 *buf, int64 blen, int64 o, int flip)
+{ uint32 w;
+
+  if (o+4 <= blen)
+    memcpy(&w,buf+o,sizeof(uint32));
+  else
+    { w = 0;
+      if (o < blen)
+        memcpy(&w,buf+o,blen-o);
     }
-  else if (llen > 16)
-    fwrite(&ocode,sizeof(uint32),1,out);
+  if (flip)
+    w = (w >> 24) | ((w >> 8) & 0xff00) | ((w << 8) & 0xff0000) | (w << 24);
+  return (w);
 }
 
-  //  Read and decode from in, the next rlen symbols into read according to scheme
+#define REFILL							\
+  while (avail <= 32)						\
+    { bits  |= ((uint64) Get_Word(buf,blen,o,flip)) << (32-avail);	\
+      o     += 4;						\
+      avail += 32;						\
+    }
+
+#define TAKE(n)		\
+  { bits  <<= (n);	\
+    avail  -= (n);	\
+    used   += (n);	\
+    last    = (n);	\
+  }
 
-static void Decode(HScheme *scheme, FILE *in, char *read, int rlen)
+#define STREAM_BYTES  (rlen > 0 ? 4*((16+used-last+31) >> 5) : 0)
+
+  //  Decode the next rlen symbols into read according to scheme, for the most part several
+  //    symbols at a time with the multi-symbol table.
+
+static int64 Decode(HScheme *scheme, uint8 *buf, int64 blen, int flip, char *read, int rlen)
 { int    *look, *lens;
-  int     signal, ilen;
-  uint64  icode;
-  uint32 *ipart;
-  uint16 *xpart;
-  uint8  *cpart;
-  int     j, n, c;
-
-  if (LittleEndian)
-    { ipart = ((uint32 *) (&icode));
-      xpart = ((uint16 *) (&icode)) + 2;
-      cpart = ((uint8  *) (&icode)) + 5;
-    }
-  else
-    { ipart = ((uint32 *) (&icode)) + 1;
-      xpart = ((uint16 *) (&icode)) + 1;
-      cpart = ((uint8  *) (&icode)) + 2;
-    }
+  HMulti *m;
+  int     signal, avail, last;
+  uint64  bits;
+  int64   o, used;
+  int     j, n, c, k;
 
   if (scheme->type == 2)
     signal  = 255;
@@ -520,87 +596,50 @@ static void Decode(HScheme *scheme, FILE *in, char *read, int rlen)
   lens = scheme->codelens;
   look = scheme->lookup;
 
-#define GET					\
-  if (n > ilen)					\
-    { icode <<= ilen;				\
-      fread(ipart,sizeof(uint32),1,in);		\
-      ilen    = n-ilen;				\
-      icode <<= ilen;				\
-      ilen    = 32-ilen;			\
-    }						\
-  else						\
-    { icode <<= n;				\
-      ilen   -= n;				\
-    }
-
-#define GETFLIP					\
-  if (n > ilen)					\
-    { icode <<= ilen;				\
-      fread(ipart,sizeof(uint32),1,in);		\
-      Flip_Long(ipart);				\
-      ilen    = n-ilen;				\
-      icode <<= ilen;				\
-      ilen    = 32-ilen;			\
-    }						\
-  else						\
-    { icode <<= n;				\
-      ilen   -= n;				\
+  o     = 0;
+  bits  = 0;
+  avail = 0;
+  used  = 0;
+  last  = 0;
+  j     = 0;
+  while (j < rlen)
+    { REFILL
+      m = scheme->multi + (bits >> (64-MULTI_BITS));
+      if (m->nsym > 0 && m->nsym <= rlen-j)
+        { for (k = 0; k < m->nsym; k++)
+            read[j++] = m->sym[k];
+          bits  <<= m->bits;
+          avail  -= m->bits;
+          used   += m->bits;
+          last    = m->last;
+        }
+      else
+        { c = look[bits >> 48];
+          n = lens[c];
+          TAKE(n)
+          if (c == signal)
+            { c = (bits >> 56);
+              TAKE(8)
+            }
+          read[j++] = c;
+        }
     }
 
-  n     = 16;
-  ilen  = 0;
-  icode = 0;
-  if (Flip)
-    for (j = 0; j < rlen; j++)
-      { GETFLIP
-        c = look[*xpart];
-        n = lens[c];
-        if (c == signal)
-          { GETFLIP
-            c = *cpart;
-            n = 8;
-          }
-        read[j] = c;
-      }
-  else
-    for (j = 0; j < rlen; j++)
-      { GET
-        c = look[*xpart];
-        n = lens[c];
-        if (c == signal)
-          { GET
-            c = *cpart;
-            n = 8;
-          }
-        read[j] = c;
-      }
+  return (STREAM_BYTES);
 }
 
-  //  Read and decode from in, the next rlen symbols into read according to non-rchar scheme
-  //    neme, and the rchar runlength shceme reme
+  //  Decode the next rlen symbols into read according to non-rchar scheme neme, and the rchar
+  //    runlength scheme reme
 
-static void Decode_Run(HScheme *neme, HScheme *reme, FILE *in, char *read,
-                       int rlen, int rchar)
+static int64 Decode_Run(HScheme *neme, HScheme *reme, uint8 *buf, int64 blen, int flip,
+                        char *read, int rlen, int rchar)
 { int    *nlook, *nlens;
   int    *rlook, *rlens;
-  int     nsignal, ilen;
-  uint64  icode;
-  uint32 *ipart;
-  uint16 *xpart;
-  uint8  *cpart;
+  int     nsignal, avail, last;
+  uint64  bits;
+  int64   o, used;
   int     j, n, c, k;
 
-  if (LittleEndian)
-    { ipart = ((uint32 *) (&icode));
-      xpart = ((uint16 *) (&icode)) + 2;
-      cpart = ((uint8  *) (&icode)) + 5;
-    }
-  else
-    { ipart = ((uint32 *) (&icode)) + 1;
-      xpart = ((uint16 *) (&icode)) + 1;
-      cpart = ((uint8  *) (&icode)) + 2;
-    }
-
   if (neme->type == 2)
     nsignal = 255;
   else
@@ -611,59 +650,39 @@ static void Decode_Run(HScheme *neme, HScheme *reme, FILE *in, char *read,
   rlens = reme->codelens;
   rlook = reme->lookup;
 
-  n     = 16;
-  ilen  = 0;
-  icode = 0;
-  if (Flip)
-    for (j = 0; j < rlen; j++)
-      { GETFLIP
-        c = rlook[*xpart];
-        n = rlens[c];
-        if (c == 255)
-          { GETFLIP
-            c = *xpart;
-            n = 16;
-          }
-        for (k = 0; k < c; k++)
-          read[j++] = rchar;
-
-        if (j < rlen)
-          { GETFLIP
-            c = nlook[*xpart];
-            n = nlens[c];
-            if (c == nsignal)
-              { GETFLIP
-                c = *cpart;
-                n = 8;
-              }
-            read[j] = c;
-          }
-      }
-  else
-    for (j = 0; j < rlen; j++)
-      { GET
-        c = rlook[*xpart];
-        n = rlens[c];
-        if (c == 255)
-          { GET
-            c = *xpart;
-            n = 16;
-          }
-        for (k = 0; k < c; k++)
-          read[j++] = rchar;
-
-        if (j < rlen)
-          { GET
-            c = nlook[*xpart];
-            n = nlens[c];
-            if (c == nsignal)
-              { GET
-                c = *cpart;
-                n = 8;
-              }
-            read[j] = c;
-          }
-      }
+  o     = 0;
+  bits  = 0;
+  avail = 0;
+  used  = 0;
+  last  = 0;
+  for (j = 0; j < rlen; j++)
+    { REFILL
+      c = rlook[bits >> 48];
+      n = rlens[c];
+      TAKE(n)
+      if (c == 255)
+        { c = (bits >> 48);
+          TAKE(16)
+        }
+      if (c > rlen-j)           //  Only possible if the input is corrupt
+        c = rlen-j;
+      for (k = 0; k < c; k++)
+        read[j++] = rchar;
+
+      if (j < rlen)
+        { REFILL
+          c = nlook[bits >> 48];
+          n = nlens[c];
+          TAKE(n)
+          if (c == nsignal)
+            { c = (bits >> 56);
+              TAKE(8)
+            }
+          read[j] = c;
+        }
+    }
+
+  return (STREAM_BYTES);
 }
 
 
@@ -756,61 +775,93 @@ static void Unpack_Tag(char *tags, int clen, char *qvs, int rlen, int rchar)
  *
  ********************************************************************************************/
 
-static char  *Read = NULL;   //  Referred by:  QVentry, Read_Lines, QVcoding_Scan,
-static int    Rmax = -1;     //                Compress_Next_QVentry, Uncompress_Next_QVentry
+struct _QVcontext
+  { char     *read;    //  Line j of the current entry is at read + j*rmax
+    int       rmax;
+    int       nline;   //  # of lines read from the current input
+    QVstats   stats;   //  Statistics of the last scan
+    QVcoding  coding;  //  Scheme last created or read
+    uint8    *obuf;    //  Buffer of size omax for a compressed entry being written
+    int64     omax;
+    uint8    *ibuf;    //  Buffer of size imax for a compressed entry being read
+    int64     imax;
+  };
+
+static QVcontext Context;   //  The context of the routines that do not take one
+
+QVcontext *QV_New()
+{ QVcontext *ctx;
+
+  ctx = (QVcontext *) Malloc(sizeof(QVcontext),"Allocating QV context");
+  if (ctx == NULL)
+    exit (1);
+  bzero(ctx,sizeof(QVcontext));
+  return (ctx);
+}
+
+void QV_Free(QVcontext *ctx)
+{ free(ctx->read);
+  free(ctx->obuf);
+  free(ctx->ibuf);
+  free(ctx);
+}
 
-static int    Nline;         //  Referred by:  QVcoding_Scan
+char *QV_Entry(QVcontext *ctx)
+{ return (ctx->read); }
 
 char *QVentry()
-{ return (Read); }
+{ return (QV_Entry(&Context)); }
 
 //  If nlines == 1 trying to read a single header, nlines = 5 trying to read 5 QV/fasta lines
-//    for a sequence.  Place line j at Read+j*Rmax and the length of every line is returned
+//    for a sequence.  Place line j at read+j*rmax and the length of every line is returned
 //    unless eof occurs in which case return -1.
 
-int Read_Lines(FILE *input, int nlines)
+int QV_Read_Lines(QVcontext *ctx, FILE *input, int nlines)
 { int   i, rlen;
   char *other;
 
-  if (Read == NULL)
-    { Rmax = MIN_BUFFER;
-      Read = (char *) Malloc(5*Rmax,"Allocating QV entry read buffer");
-      if (Read == NULL)
+  if (ctx->read == NULL)
+    { ctx->rmax = MIN_BUFFER;
+      ctx->read = (char *) Malloc(5*ctx->rmax,"Allocating QV entry read buffer");
+      if (ctx->read == NULL)
        exit (1);
     }
 
-  Nline += 1;
-  if (fgets(Read,Rmax,input) == NULL)
+  ctx->nline += 1;
+  if (fgets(ctx->read,ctx->rmax,input) == NULL)
     return (-1);
 
-  rlen = strlen(Read);
-  while (Read[rlen-1] != '\n')
-    { Rmax = 1.4*Rmax + MIN_BUFFER;
-      Read = (char *) Realloc(Read,5*Rmax,"Reallocating QV entry read buffer");
-      if (Read == NULL)
+  rlen = strlen(ctx->read);
+  while (ctx->read[rlen-1] != '\n')
+    { ctx->rmax = 1.4*ctx->rmax + MIN_BUFFER;
+      ctx->read = (char *) Realloc(ctx->read,5*ctx->rmax,"Reallocating QV entry read buffer");
+      if (ctx->read == NULL)
         exit (1);
-      if (fgets(Read+rlen,Rmax-rlen,input) == NULL)
-        { fprintf(stderr,"Line %d: Last line does not end with a newline !\n",Nline);
+      if (fgets(ctx->read+rlen,ctx->rmax-rlen,input) == NULL)
+        { fprintf(stderr,"Line %d: Last line does not end with a newline !\n",ctx->nline);
           exit (1);
         }
-      rlen += strlen(Read+rlen);
+      rlen += strlen(ctx->read+rlen);
     }
-  other = Read;
+  other = ctx->read;
   for (i = 1; i < nlines; i++)
-    { other += Rmax;
-      Nline += 1;
-      if (fgets(other,Rmax,input) == NULL)
-        { fprintf(stderr,"Line %d: incomplete last entry of .quiv file\n",Nline);
+    { other += ctx->rmax;
+      ctx->nline += 1;
+      if (fgets(other,ctx->rmax,input) == NULL)
+        { fprintf(stderr,"Line %d: incomplete last entry of .quiv file\n",ctx->nline);
           exit (1);
         }
       if (rlen != (int) strlen(other))
-        { fprintf(stderr,"Line %d: Lines for an entry are not the same length\n",Nline);
+        { fprintf(stderr,"Line %d: Lines for an entry are not the same length\n",ctx->nline);
           exit (1);
         }
     }
   return (rlen-1);
 }
 
+int Read_Lines(FILE *input, int nlines)
+{ return (QV_Read_Lines(&Context,input,nlines)); }
+
 
 /*******************************************************************************************
  *
@@ -818,111 +869,157 @@ int Read_Lines(FILE *input, int nlines)
  *
  ********************************************************************************************/
 
-  // Read .quiva file from input, recording stats in the histograms.  If zero is set then
-  //   start the stats anew with this file.
+  //  Start the statistics in stats anew.
 
-static uint64   delHist[256], insHist[256], mrgHist[256], subHist[256], delRun[256], subRun[256];
-static uint64   totChar;
-static int      delChar, subChar;
+void QVstats_Init(QVstats *stats)
+{ bzero(stats->delHist,sizeof(uint64)*256);
+  bzero(stats->delRun,sizeof(uint64)*256);
+  bzero(stats->mrgHist,sizeof(uint64)*256);
+  bzero(stats->insHist,sizeof(uint64)*256);
+  bzero(stats->subHist,sizeof(uint64)*256);
+  bzero(stats->subRun,sizeof(uint64)*256);
 
-  // Referred by:  QVcoding_Scan, Create_QVcoding
+  stats->totChar = 0;
+  stats->delChar = -1;
+  stats->subChar = -1;
+}
 
-void QVcoding_Scan(FILE *input)
-{ char *slash;
-  int   rlen;
+  //  Histogram the relevant things in the 5 streams of an entry and figure out the run chars
+  //    for the deletion and substitution streams if not yet known.
 
-  //  Zero histograms
+void QVstats_Entry(QVstats *stats, char **entry, int rlen)
+{ Histogram_Seqs(stats->delHist,(uint8 *) (entry[0]),rlen);
+  Histogram_Seqs(stats->insHist,(uint8 *) (entry[2]),rlen);
+  Histogram_Seqs(stats->mrgHist,(uint8 *) (entry[3]),rlen);
+  Histogram_Seqs(stats->subHist,(uint8 *) (entry[4]),rlen);
 
-  bzero(delHist,sizeof(uint64)*256);
-  bzero(delRun,sizeof(uint64)*256);
-  bzero(mrgHist,sizeof(uint64)*256);
-  bzero(insHist,sizeof(uint64)*256);
-  bzero(subHist,sizeof(uint64)*256);
-  bzero(subRun,sizeof(uint64)*256);
+  if (stats->delChar < 0)
+    { int   k;
+      char *del = entry[1];
+
+      for (k = 0; k < rlen; k++)
+        if (del[k] == 'n' || del[k] == 'N')
+          { stats->delChar = entry[0][k];
+            break;
+          }
+    }
+  if (stats->delChar >= 0)
+    Histogram_Runs(stats->delRun,(uint8 *) (entry[0]),rlen,stats->delChar);
+  stats->totChar += rlen;
+  if (stats->subChar < 0)
+    { if (stats->totChar >= 100000)
+        { int k;
+
+          stats->subChar = 0;
+          for (k = 1; k < 256; k++)
+            if (stats->subHist[k] > stats->subHist[stats->subChar])
+              stats->subChar = k;
+        }
+    }
+  if (stats->subChar >= 0)
+    Histogram_Runs(stats->subRun,(uint8 *) (entry[4]),rlen,stats->subChar);
+}
 
-  totChar    = 0;
-  delChar    = -1;
-  subChar    = -1;
+  //  Add the counts of part to those of stats.  The run chars of stats are unchanged.
+
+void QVstats_Merge(QVstats *stats, QVstats *part)
+{ int k;
+
+  for (k = 0; k < 256; k++)
+    { stats->delHist[k] += part->delHist[k];
+      stats->insHist[k] += part->insHist[k];
+      stats->mrgHist[k] += part->mrgHist[k];
+      stats->subHist[k] += part->subHist[k];
+      stats->delRun[k]  += part->delRun[k];
+      stats->subRun[k]  += part->subRun[k];
+    }
+  stats->totChar += part->totChar;
+}
+
+  //  Give every value a count of at least 1 in each histogram, so that the scheme created
+  //    from stats can code any entry, not just those that were scanned.
+
+void QVstats_Cover(QVstats *stats)
+{ int k;
+
+  for (k = 0; k < 256; k++)
+    { if (stats->delHist[k] == 0) stats->delHist[k] = 1;
+      if (stats->insHist[k] == 0) stats->insHist[k] = 1;
+      if (stats->mrgHist[k] == 0) stats->mrgHist[k] = 1;
+      if (stats->subHist[k] == 0) stats->subHist[k] = 1;
+      if (stats->delRun[k] == 0)  stats->delRun[k]  = 1;
+      if (stats->subRun[k] == 0)  stats->subRun[k]  = 1;
+    }
+}
+
+  // Read .quiva file from input, recording stats in the histograms of ctx.  The stats are
+  //   started anew with each file.
+
+void QV_Scan(QVcontext *ctx, FILE *input)
+{ char *slash;
+  char *entry[5];
+  int   rlen, k;
+
+  QVstats_Init(&(ctx->stats));
 
   //  Make a sweep through the .quiva entries, histogramming the relevant things
   //    and figuring out the run chars for the deletion and substition streams
 
-  Nline = 0;
+  ctx->nline = 0;
   while (1)
     { int well, beg, end, qv;
 
-      rlen = Read_Lines(input,1);
+      rlen = QV_Read_Lines(ctx,input,1);
       if (rlen < 0)
         break;
 
-      if (rlen == 0 || Read[0] != '@')
-        { fprintf(stderr,"Line %d: Header in quiv file is missing\n",Nline);
+      if (rlen == 0 || ctx->read[0] != '@')
+        { fprintf(stderr,"Line %d: Header in quiv file is missing\n",ctx->nline);
           exit (1);
         }
-      slash = index(Read+1,'/');
+      slash = index(ctx->read+1,'/');
       if (slash == NULL)
   	    { fprintf(stderr,"%s: Line %d: Header line incorrectly formatted ?\n",
-                         Prog_Name,Nline);
+                         Prog_Name,ctx->nline);
           exit (1);
         }
       if (sscanf(slash+1,"%d/%d_%d RQ=0.%d\n",&well,&beg,&end,&qv) != 4)
         { fprintf(stderr,"%s: Line %d: Header line incorrectly formatted ?\n",
-                         Prog_Name,Nline);
+                         Prog_Name,ctx->nline);
           exit (1);
         }
 
-      rlen = Read_Lines(input,5);
+      rlen = QV_Read_Lines(ctx,input,5);
       if (rlen < 0)
-        { fprintf(stderr,"Line %d: incomplete last entry of .quiv file\n",Nline);
+        { fprintf(stderr,"Line %d: incomplete last entry of .quiv file\n",ctx->nline);
           exit (1);
         }
 
-      Histogram_Seqs(delHist,(uint8 *) (Read),rlen);
-      Histogram_Seqs(insHist,(uint8 *) (Read+2*Rmax),rlen);
-      Histogram_Seqs(mrgHist,(uint8 *) (Read+3*Rmax),rlen);
-      Histogram_Seqs(subHist,(uint8 *) (Read+4*Rmax),rlen);
-
-      if (delChar < 0)
-        { int   k;
-          char *del = Read+Rmax;
-
-          for (k = 0; k < rlen; k++)
-            if (del[k] == 'n' || del[k] == 'N')
-              { delChar = Read[k];
-                break;
-              }
-        }
-      if (delChar >= 0)
-        Histogram_Runs( delRun,(uint8 *) (Read),rlen,delChar);
-      totChar += rlen;
-      if (subChar < 0)
-        { if (totChar >= 100000)
-            { int k;
-
-              subChar = 0;
-              for (k = 1; k < 256; k++)
-                if (subHist[k] > subHist[subChar])
-                  subChar = k;
-            }
-        }
-      if (subChar >= 0)
-        Histogram_Runs( subRun,(uint8 *) (Read+4*Rmax),rlen,subChar);
+      for (k = 0; k < 5; k++)
+        entry[k] = ctx->read + k*ctx->rmax;
+      QVstats_Entry(&(ctx->stats),entry,rlen);
     }
 }
 
-  //   Using the statistics in the global stat tables, create the Huffman schemes and write
-  //   them to output.  If lossy is set, then create a lossy table for the insertion and merge
-  //   QVs.
+void QVcoding_Scan(FILE *input)
+{ QV_Scan(&Context,input); }
 
-QVcoding *Create_QVcoding(int lossy)
-{ static QVcoding coding;
-  static HScheme *delScheme, *insScheme, *mrgScheme, *subScheme;
-  static HScheme *dRunScheme, *sRunScheme;
+  //   Using the statistics in stats, create the Huffman schemes and place them in coding.
+  //   If lossy is set, then create a lossy table for the insertion and merge QVs.  The
+  //   histograms of stats are altered in the process.
+
+QVcoding *QVstats_Coding(QVstats *stats, int lossy, QVcoding *coding)
+{ uint64  *delHist = stats->delHist, *insHist = stats->insHist;
+  uint64  *mrgHist = stats->mrgHist, *subHist = stats->subHist;
+  uint64  *delRun  = stats->delRun,  *subRun  = stats->subRun;
+  int      delChar = stats->delChar,  subChar = stats->subChar;
+  HScheme *delScheme, *insScheme, *mrgScheme, *subScheme;
+  HScheme *dRunScheme, *sRunScheme;
 
   //  Check whether using a subtitution run char is a win
 
-  if (totChar < 200000 || subHist[subChar] < .5*totChar)
-    subChar = -1;
+  if (stats->totChar < 200000 || subHist[subChar] < .5*stats->totChar)
+    stats->subChar = subChar = -1;
 
   //  If lossy encryption is enabled then scale insertions and merge QVs.
 
@@ -1013,23 +1110,28 @@ QVcoding *Create_QVcoding(int lossy)
       }
   }
 
-  //  Setup endian handling
+  coding->delScheme  = delScheme;
+  coding->insScheme  = insScheme;
+  coding->mrgScheme  = mrgScheme;
+  coding->subScheme  = subScheme;
+  coding->dRunScheme = dRunScheme;
+  coding->sRunScheme = sRunScheme;
+  coding->delChar    = delChar;
+  coding->subChar    = subChar;
+  coding->prefix     = NULL;
+  coding->flip       = 0;
+
+  return (coding);
+}
 
-  Set_Endian(0);
+  //   Using the statistics gathered by the last scan of ctx, create the Huffman schemes.
+  //   The encoding object returned is that of ctx.
 
-  coding.delScheme  = delScheme;
-  coding.insScheme  = insScheme;
-  coding.mrgScheme  = mrgScheme;
-  coding.subScheme  = subScheme;
-  coding.dRunScheme = dRunScheme;
-  coding.sRunScheme = sRunScheme;
-  coding.delChar    = delChar;
-  coding.subChar    = subChar;
-  coding.prefix     = NULL;
-  coding.flip       = 0;
+QVcoding *QV_Create_Coding(QVcontext *ctx, int lossy)
+{ return (QVstats_Coding(&(ctx->stats),lossy,&(ctx->coding))); }
 
-  return (&coding);
-}
+QVcoding *Create_QVcoding(int lossy)
+{ return (QV_Create_Coding(&Context,lossy)); }
 
   // Write the encoding scheme 'coding' to 'output'
 
@@ -1074,8 +1176,8 @@ void Write_QVcoding(FILE *output, QVcoding *coding)
 
   // Read the encoding scheme 'coding' to 'output'
 
-QVcoding *Read_QVcoding(FILE *input)
-{ static QVcoding coding;
+QVcoding *QV_Read_Coding(QVcontext *ctx, FILE *input)
+{ QVcoding *coding = &(ctx->coding);
 
   // Read endian key, run chars, and short name common to all headers
 
@@ -1083,49 +1185,48 @@ QVcoding *Read_QVcoding(FILE *input)
     int    len;
 
     fread(&half,sizeof(uint16),1,input);
-    coding.flip = (half != 0x33cc);
+    coding->flip = (half != 0x33cc);
 
     fread(&half,sizeof(uint16),1,input);
-    if (coding.flip) Flip_Short(&half);
-    coding.delChar = half;
-    if (coding.delChar >= 256)
-      coding.delChar = -1;
+    if (coding->flip) Flip_Short(&half);
+    coding->delChar = half;
+    if (coding->delChar >= 256)
+      coding->delChar = -1;
 
     fread(&half,sizeof(uint16),1,input);
-    if (coding.flip) Flip_Short(&half);
-    coding.subChar = half;
-    if (coding.subChar >= 256)
-      coding.subChar = -1;
+    if (coding->flip) Flip_Short(&half);
+    coding->subChar = half;
+    if (coding->subChar >= 256)
+      coding->subChar = -1;
 
     //  Read the short name common to all headers
 
     fread(&len,sizeof(int),1,input);
-    if (coding.flip) Flip_Long(&len);
-    coding.prefix = (char *) Malloc(len+1,"Allocating header prefix");
-    if (coding.prefix == NULL)
+    if (coding->flip) Flip_Long(&len);
+    coding->prefix = (char *) Malloc(len+1,"Allocating header prefix");
+    if (coding->prefix == NULL)
       exit (1);
-    fread(coding.prefix,1,len,input);
-    coding.prefix[len] = '\0';
+    fread(coding->prefix,1,len,input);
+    coding->prefix[len] = '\0';
   }
 
-  //  Setup endian handling
-
-  Set_Endian(coding.flip);
-
   //  Read the Huffman schemes used to compress the data
 
-  coding.delScheme  = Read_Scheme(input);
-  if (coding.delChar >= 0)
-    coding.dRunScheme = Read_Scheme(input);
-  coding.insScheme  = Read_Scheme(input);
-  coding.mrgScheme  = Read_Scheme(input);
-  coding.subScheme  = Read_Scheme(input);
-  if (coding.subChar >= 0)
-    coding.sRunScheme = Read_Scheme(input);
+  coding->delScheme  = Read_Scheme(input,coding->flip);
+  if (coding->delChar >= 0)
+    coding->dRunScheme = Read_Scheme(input,coding->flip);
+  coding->insScheme  = Read_Scheme(input,coding->flip);
+  coding->mrgScheme  = Read_Scheme(input,coding->flip);
+  coding->subScheme  = Read_Scheme(input,coding->flip);
+  if (coding->subChar >= 0)
+    coding->sRunScheme = Read_Scheme(input,coding->flip);
 
-  return (&coding);
+  return (coding);
 }
 
+QVcoding *Read_QVcoding(FILE *input)
+{ return (QV_Read_Coding(&Context,input)); }
+
   //  Free all the auxilliary storage associated with the encoding argument
 
 void Free_QVcoding(QVcoding *coding)
@@ -1147,33 +1248,31 @@ void Free_QVcoding(QVcoding *coding)
  *
  ********************************************************************************************/
 
-void Compress_Next_QVentry(FILE *input, FILE *output, QVcoding *coding, int lossy)
-{ int rlen, clen;
+  //  Compress the 5 streams of entry (each of length rlen) into buffer according to coding,
+  //    returning the number of bytes produced.  The contents of entry are altered.
 
-  //  Get all 5 streams, compress each with its scheme, and output
-
-  rlen = Read_Lines(input,5);
-  if (rlen < 0)
-    { fprintf(stderr,"Line %d: incomplete last entry of .quiv file\n",Nline);
-      exit (1);
-    }
+int64 Compress_QVentry(char **entry, int rlen, void *buffer, QVcoding *coding, int lossy)
+{ uint8 *buf = (uint8 *) buffer;
+  int64  o;
+  int    clen;
 
   if (coding->delChar < 0)
-    { Encode(coding->delScheme, output, (uint8 *) Read, rlen);
+    { o    = Encode(coding->delScheme, buf, (uint8 *) entry[0], rlen);
       clen = rlen;
     }
   else
-    { Encode_Run(coding->delScheme, coding->dRunScheme, output,
-                 (uint8 *) Read, rlen, coding->delChar);
-      clen = Pack_Tag(Read+Rmax,Read,rlen,coding->delChar);
+    { o    = Encode_Run(coding->delScheme, coding->dRunScheme, buf,
+                        (uint8 *) entry[0], rlen, coding->delChar);
+      clen = Pack_Tag(entry[1],entry[0],rlen,coding->delChar);
     }
-  Number_Read(Read+Rmax);
-  Compress_Read(clen,Read+Rmax);
-  fwrite(Read+Rmax,1,COMPRESSED_LEN(clen),output);
+  Number_Read_Count(clen,entry[1],NULL);
+  Compress_Read(clen,entry[1]);
+  memcpy(buf+o,entry[1],COMPRESSED_LEN(clen));
+  o += COMPRESSED_LEN(clen);
 
   if (lossy)
-    { uint8 *insert = (uint8 *) (Read+2*Rmax);
-      uint8 *merge  = (uint8 *) (Read+3*Rmax);
+    { uint8 *insert = (uint8 *) entry[2];
+      uint8 *merge  = (uint8 *) entry[3];
       int    k;
 
       for (k = 0; k < rlen; k++)
@@ -1182,47 +1281,118 @@ void Compress_Next_QVentry(FILE *input, FILE *output, QVcoding *coding, int loss
         }
     }
 
-  Encode(coding->insScheme, output, (uint8 *) (Read+2*Rmax), rlen);
-  Encode(coding->mrgScheme, output, (uint8 *) (Read+3*Rmax), rlen);
+  o += Encode(coding->insScheme, buf+o, (uint8 *) entry[2], rlen);
+  o += Encode(coding->mrgScheme, buf+o, (uint8 *) entry[3], rlen);
   if (coding->subChar < 0)
-    Encode(coding->subScheme, output, (uint8 *) (Read+4*Rmax), rlen);
+    o += Encode(coding->subScheme, buf+o, (uint8 *) entry[4], rlen);
   else
-    Encode_Run(coding->subScheme, coding->sRunScheme, output,
-               (uint8 *) (Read+4*Rmax), rlen, coding->subChar);
+    o += Encode_Run(coding->subScheme, coding->sRunScheme, buf+o,
+                    (uint8 *) entry[4], rlen, coding->subChar);
+
+  return (o);
 }
 
-void Uncompress_Next_QVentry(FILE *input, char **entry, QVcoding *coding, int rlen)
-{ int clen;
+void QV_Compress(QVcontext *ctx, FILE *input, FILE *output, QVcoding *coding, int lossy)
+{ char *entry[5];
+  int   rlen, k;
+  int64 o;
+
+  //  Get all 5 streams, compress each with its scheme into ctx->obuf, and output
+
+  rlen = QV_Read_Lines(ctx,input,5);
+  if (rlen < 0)
+    { fprintf(stderr,"Line %d: incomplete last entry of .quiv file\n",ctx->nline);
+      exit (1);
+    }
+
+  if (ctx->omax < QV_ENTRY_MAX(rlen))
+    { ctx->omax = 1.2*QV_ENTRY_MAX(rlen);
+      ctx->obuf = (uint8 *) Realloc(ctx->obuf,ctx->omax,"Allocating QV entry output buffer");
+      if (ctx->obuf == NULL)
+        exit (1);
+    }
+
+  for (k = 0; k < 5; k++)
+    entry[k] = ctx->read + k*ctx->rmax;
+  o = Compress_QVentry(entry,rlen,ctx->obuf,coding,lossy);
+  fwrite(ctx->obuf,1,o,output);
+}
+
+void Compress_Next_QVentry(FILE *input, FILE *output, QVcoding *coding, int lossy)
+{ QV_Compress(&Context,input,output,coding,lossy); }
+
+int64 Uncompress_QVentry(void *buffer, int64 blen, char **entry, QVcoding *coding, int rlen)
+{ uint8 *buf  = (uint8 *) buffer;
+  int    flip = coding->flip;
+  int64  o;
+  int    clen, tlen;
 
   //  Decode each stream and write to output
 
   if (coding->delChar < 0)
-    { Decode(coding->delScheme, input, entry[0], rlen);
+    { o    = Decode(coding->delScheme, buf, blen, flip, entry[0], rlen);
       clen = rlen;
-
-      fread(entry[1],1,COMPRESSED_LEN(clen),input);
-      Uncompress_Read(clen,entry[1]);
-      Lower_Read(entry[1]);
     }
   else
-    { Decode_Run(coding->delScheme, coding->dRunScheme, input,
-                 entry[0], rlen, coding->delChar);
+    { o    = Decode_Run(coding->delScheme, coding->dRunScheme, buf, blen, flip,
+                        entry[0], rlen, coding->delChar);
       clen = Packed_Length(entry[0],rlen,coding->delChar);
+    }
 
-      fread(entry[1],1,COMPRESSED_LEN(clen),input);
-      Uncompress_Read(clen,entry[1]);
-      Lower_Read(entry[1]);
-
-      Unpack_Tag(entry[1],clen,entry[0],rlen,coding->delChar);
+  tlen = COMPRESSED_LEN(clen);
+  if (o+tlen <= blen)
+    memcpy(entry[1],buf+o,tlen);
+  else
+    { memset(entry[1],0,tlen);
+      if (o < blen)
+        memcpy(entry[1],buf+o,blen-o);
     }
+  o += tlen;
+  Uncompress_Read_Ascii(clen,entry[1],1);
+
+  if (coding->delChar >= 0)
+    Unpack_Tag(entry[1],clen,entry[0],rlen,coding->delChar);
 
-  Decode(coding->insScheme, input, entry[2], rlen);
+  o += Decode(coding->insScheme, buf+o, blen-o, flip, entry[2], rlen);
 
-  Decode(coding->mrgScheme, input, entry[3], rlen);
+  o += Decode(coding->mrgScheme, buf+o, blen-o, flip, entry[3], rlen);
 
   if (coding->subChar < 0)
-    Decode(coding->subScheme, input, entry[4], rlen);
+    o += Decode(coding->subScheme, buf+o, blen-o, flip, entry[4], rlen);
   else
-    Decode_Run(coding->subScheme, coding->sRunScheme, input,
-               entry[4], rlen, coding->subChar);
+    o += Decode_Run(coding->subScheme, coding->sRunScheme, buf+o, blen-o, flip,
+                    entry[4], rlen, coding->subChar);
+
+  return (o);
 }
+
+  //  The size of an entry is not known until it is decoded, so read a block that is almost
+  //    always big enough, and if it was not, read a block of the maximum possible size (a
+  //    position takes at most 56 bits in any stream) and decode again.  Then position input
+  //    just beyond the entry.
+
+void QV_Uncompress(QVcontext *ctx, FILE *input, char **entry, QVcoding *coding, int rlen)
+{ int64 bmax, blen, used;
+  off_t start;
+
+  start = ftello(input);
+  bmax  = 4ll*rlen + 64;
+  while (1)
+    { if (ctx->imax < bmax)
+        { ctx->imax = bmax;
+          ctx->ibuf = (uint8 *) Realloc(ctx->ibuf,ctx->imax,"Allocating QV entry buffer");
+          if (ctx->ibuf == NULL)
+            exit (1);
+        }
+      blen = fread(ctx->ibuf,1,bmax,input);
+      used = Uncompress_QVentry(ctx->ibuf,blen,entry,coding,rlen);
+      if (used <= blen || blen < bmax || bmax >= QV_ENTRY_MAX(rlen))
+        break;
+      fseeko(input,start,SEEK_SET);
+      bmax = QV_ENTRY_MAX(rlen);
+    }
+  fseeko(input,start+used,SEEK_SET);
+}
+
+void Uncompress_Next_QVentry(FILE *input, char **entry, QVcoding *coding, int rlen)
+{ QV_Uncompress(&Context,input,entry,coding,rlen); }
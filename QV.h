@@ -39,6 +39,29 @@ char     *QVentry();
 
 void     QVcoding_Scan(FILE *input);
 
+  // The frequency statistics of a set of .quiva entries.  QVstats_Init starts them anew, and
+  //   QVstats_Entry adds the 5 streams of the next entry (each of length rlen), determining
+  //   the run chars as it goes.  Statistics of entries that follow each other can be gathered
+  //   separately (e.g. by different threads) and summed with QVstats_Merge, provided that the
+  //   run chars of every part but the first are set to those determined by the entries that
+  //   precede it (the first part suffices once both are >= 0).  QVstats_Cover gives every
+  //   value a non-zero count so that a scheme built from a sample of the entries of a file
+  //   can code all of them.  QVstats_Coding creates the encoding scheme for the statistics
+  //   in coding (altering the histograms).
+
+typedef struct
+  { uint64 delHist[256], insHist[256], mrgHist[256], subHist[256];
+    uint64 delRun[256], subRun[256];
+    uint64 totChar;
+    int    delChar, subChar;
+  } QVstats;
+
+void      QVstats_Init(QVstats *stats);
+void      QVstats_Entry(QVstats *stats, char **entry, int rlen);
+void      QVstats_Merge(QVstats *stats, QVstats *part);
+void      QVstats_Cover(QVstats *stats);
+QVcoding *QVstats_Coding(QVstats *stats, int lossy, QVcoding *coding);
+
   // Given QVcoding_Scan has been called at least once, create an encoding scheme based on
   //   the accumulated statistics and return a pointer to it.  The returned encoding object
   //   is *statically allocated within the routine.  If lossy is set then use a lossy scaling
@@ -62,6 +85,14 @@ void      Free_QVcoding(QVcoding *coding);
 
 void      Compress_Next_QVentry(FILE *input, FILE *output, QVcoding *coding, int lossy);
 
+  //  As above, but the 5 streams of the entry (each of length rlen) are in entry, they are
+  //    compressed into the memory block buffer, and the number of bytes produced is returned.
+  //    The buffer must have QV_ENTRY_MAX(rlen) bytes, and the streams are altered.
+
+#define QV_ENTRY_MAX(rlen)  (36ll*(rlen) + 64)
+
+int64     Compress_QVentry(char **entry, int rlen, void *buffer, QVcoding *coding, int lossy);
+
   //  Assuming the input is position just beyond the compressed encoding of an entry header,
   //    read the set of compressed encodings for the ensuing 5 QV vectors, decompress them,
   //    and place their decompressed values into entry which is a 5 element array of character
@@ -70,4 +101,35 @@ void      Compress_Next_QVentry(FILE *input, FILE *output, QVcoding *coding, int
 
 void      Uncompress_Next_QVentry(FILE *input, char **entry, QVcoding *coding, int rlen);
 
+  //  As above, but the compressed encoding of the entry is at the start of the memory block
+  //    buffer[0..blen-1], and the number of bytes it occupies is returned.  Bytes beyond blen
+  //    are taken to be 0, so a block that ends with the entry suffices.
+
+int64     Uncompress_QVentry(void *buffer, int64 blen, char **entry, QVcoding *coding, int rlen);
+
+  //  A QV codec context holds all the state of the routines above that read, scan, compress,
+  //    or decompress .quiva entries: the line buffer, the scan statistics, the scheme last
+  //    created or read, and the buffers for compressed entries.  The routines above all
+  //    share a single static context, so only one file can be processed by one thread at a
+  //    time through them.  Each of the QV_ routines below does the same as its counterpart
+  //    above but with the given context, so that any number of files can be processed
+  //    concurrently, each (or each thread) with its own context.  The object returned by
+  //    QV_Create_Coding or QV_Read_Coding belongs to the context and is overwritten by the
+  //    next such call on it.
+
+typedef struct _QVcontext QVcontext;
+
+QVcontext *QV_New();
+void       QV_Free(QVcontext *ctx);
+
+int        QV_Read_Lines(QVcontext *ctx, FILE *input, int nlines);
+char      *QV_Entry(QVcontext *ctx);
+
+void       QV_Scan(QVcontext *ctx, FILE *input);
+QVcoding  *QV_Create_Coding(QVcontext *ctx, int lossy);
+QVcoding  *QV_Read_Coding(QVcontext *ctx, FILE *input);
+
+void       QV_Compress(QVcontext *ctx, FILE *input, FILE *output, QVcoding *coding, int lossy);
+void       QV_Uncompress(QVcontext *ctx, FILE *input, char **entry, QVcoding *coding, int rlen);
+
 #endif // _QV_COMPRESSOR
@@ -0,0 +1,58 @@
+#!/bin/sh
+#
+#  Time DBdust with and without the fast engine (-f), single threaded and with -T, on a
+#    simulated data set, and check that every run produces exactly the same track as the
+#    original engine with the same settings.  Run from the directory holding the binaries
+#    (make bench-dust).
+#
+#    Usage: bench/dust.sh [<genome:Mbp(2)> [<threads(4)>]]
+
+GENOME=${1:-2}
+THREADS=${2:-4}
+
+DIR=`mktemp -d`
+trap 'rm -rf $DIR' EXIT
+
+./simulator $GENOME -r17 > $DIR/sim.fasta || exit 1
+./fasta2DB $DIR/B $DIR/sim.fasta || exit 1
+echo "DBdust on `./DBstats $DIR/B 2>/dev/null | sed -n 5p | awk '{print $1}'` bp of simulated reads"
+
+STATUS=0
+
+#  run <name> <options>: time DBdust with the given options and save its track as <name>
+
+run()
+{ NAME=$1
+  shift
+  BEG=`date +%s.%N`
+  ./DBdust "$@" $DIR/B || exit 1
+  END=`date +%s.%N`
+  printf "  DBdust %-14s %7.3fs\n" "$*" `echo "$END $BEG" | awk '{print $1-$2}'`
+  mv $DIR/.B.dust.anno $DIR/$NAME.anno
+  mv $DIR/.B.dust.data $DIR/$NAME.data
+}
+
+#  same <name> <base>: check track <name> is identical to track <base>
+
+same()
+{ if ! cmp -s $DIR/$1.anno $DIR/$2.anno || ! cmp -s $DIR/$1.data $DIR/$2.data
+    then echo "  ** Track of $1 differs from that of $2"
+         STATUS=1
+  fi
+}
+
+for OPTS in "" "-b" "-t1"
+do
+  run base $OPTS
+  run fast $OPTS -f
+  run thrd $OPTS -T$THREADS
+  run both $OPTS -f -T$THREADS
+  same fast base
+  same thrd base
+  same both base
+done
+
+if [ $STATUS -eq 0 ]
+  then echo "All tracks identical"
+fi
+exit $STATUS
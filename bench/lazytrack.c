@@ -0,0 +1,128 @@
+/*******************************************************************************************
+ *
+ *  Check lazy track access against a loaded track:
+ *     Load the track of the db or block with Load_Track and open a lazy handle on it with
+ *     Open_Lazy_Track, then check that Track_Get returns exactly the slice of the loaded
+ *     track for every read in order, again for every read in reverse order, and then for
+ *     -r reads chosen at random, so that slices crossing cache pages and the replacement
+ *     of the least recently used pages are all exercised on a large enough track (see
+ *     bench/track.sh).
+ *
+ *  Date  :  October 2026
+ *
+ ********************************************************************************************/
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "DB.h"
+
+static char *Usage = "[-r<int(100000)>] <path:db> <track:name>";
+
+static HITS_TRACK      *Track;
+static HITS_LAZY_TRACK *Lazy;
+
+//  Check read i, reporting the first difference and returning nonzero if there is one
+
+static int Check_Read(int i)
+{ void  *ptr, *slice;
+  int64  len, beg, end;
+
+  if (Track_Get(Lazy,i,&ptr,&len))
+    exit (1);
+
+  if (Track->data == NULL)
+    { slice = ((char *) Track->anno) + Track->size*((int64) i);
+      beg   = 0;
+      end   = Track->size;
+    }
+  else
+    { if (Track->size == 4)
+        { beg = ((int *) Track->anno)[i];
+          end = ((int *) Track->anno)[i+1];
+        }
+      else
+        { beg = ((int64 *) Track->anno)[i];
+          end = ((int64 *) Track->anno)[i+1];
+        }
+      slice = ((char *) Track->data) + (beg - Track->base);
+    }
+
+  if (len != end-beg)
+    { fprintf(stderr,"%s: Read %d: Track_Get gives %lld bytes, Load_Track %lld\n",
+                     Prog_Name,i,len,end-beg);
+      return (1);
+    }
+  if (len > 0 && memcmp(ptr,slice,len) != 0)
+    { fprintf(stderr,"%s: Read %d: Track_Get and Load_Track data differ\n",Prog_Name,i);
+      return (1);
+    }
+  return (0);
+}
+
+int main(int argc, char *argv[])
+{ HITS_DB _db, *db = &_db;
+  int     i, r, bad;
+
+  int     RAND;
+
+  { int   j, k;
+    int   flags[128];
+    char *eptr;
+
+    ARG_INIT("lazytrack")
+    (void) flags;
+
+    RAND = 100000;
+
+    j = 1;
+    for (i = 1; i < argc; i++)
+      if (argv[i][0] == '-')
+        switch (argv[i][1])
+        { default:
+            ARG_FLAGS("")
+            break;
+          case 'r':
+            ARG_NON_NEGATIVE(RAND,"Number of random reads")
+            break;
+        }
+      else
+        argv[j++] = argv[i];
+    argc = j;
+
+    if (argc != 3)
+      { fprintf(stderr,"Usage: %s %s\n",Prog_Name,Usage);
+        exit (1);
+      }
+  }
+
+  if (Open_DB(argv[1],db))
+    exit (1);
+
+  Track = Load_Track(db,argv[2]);
+  if (Track == NULL)
+    { fprintf(stderr,"%s: Track %s does not exist\n",Prog_Name,argv[2]);
+      exit (1);
+    }
+  Lazy = Open_Lazy_Track(db,argv[2]);
+  if (Lazy == NULL)
+    exit (1);
+
+  bad = 0;
+  for (i = 0; i < db->nreads && !bad; i++)
+    bad = Check_Read(i);
+  for (i = db->nreads-1; i >= 0 && !bad; i--)
+    bad = Check_Read(i);
+  srand48(17);
+  for (r = 0; r < RAND && !bad; r++)
+    bad = Check_Read(lrand48() % db->nreads);
+
+  if (!bad)
+    printf("%s: %d reads, %d random reads, all slices identical\n",argv[1],db->nreads,RAND);
+
+  Close_Lazy_Track(Lazy);
+  Close_DB(db);
+
+  exit (bad);
+}
@@ -0,0 +1,83 @@
+#!/bin/sh
+#
+#  Compare the QV encoder of the current QV.c with that of QV.c at an earlier git revision
+#    (by default the first one of the repository): bench/qvbench is built against each and
+#    run on the same .quiva file, reporting the best scan and compression times of each and
+#    checking that the two compressed outputs are identical.  If no .quiva file is given, a
+#    synthetic one is made for the reads of a simulated genome.  Run from the directory
+#    holding the sources and binaries (make bench-qv).
+#
+#    Usage: bench/qv.sh [<input:quiva> [<revision>]]
+
+DIR=`mktemp -d`
+trap 'rm -rf $DIR' EXIT
+
+REV=${2:-`git rev-list --max-parents=0 HEAD 2>/dev/null | tail -1`}
+
+if [ -n "$1" ]
+  then QUIVA=$1
+  else QUIVA=$DIR/sim.quiva
+       ./simulator 1 -r17 > $DIR/sim.fasta || exit 1
+
+       #  Entries of QVs drawn from fixed random pools (by an awk too slow to draw every one)
+
+       awk 'BEGIN { srand(17)
+                    for (s = 0; s < 4; s++)
+                      { p = ""
+                        for (i = 0; i < 8192; i++)
+                          { q = int(-log(1-rand())*(6+2*s))
+                            p = p sprintf("%c",33+(q > 40 ? 40 : q))
+                          }
+                        pool[s] = p p p p
+                      }
+                    p = ""
+                    for (i = 0; i < 8192; i++)
+                      p = p (rand() < .3 ? substr("acgtn",1+int(5*rand()),1) : "n")
+                    tags = p p p p
+                  }
+            function draw(p, len,   o, s)
+                  { s = ""
+                    while (len > 0)
+                      { o = 1+int(8192*rand())
+                        n = (len > 16384 ? 16384 : len)
+                        s = s substr(p,o,n)
+                        len -= n
+                      }
+                    return s
+                  }
+            /^>/  { split($1,f,"/")
+                    split(f[3],r,"_")
+                    len = r[2]-r[1]
+                    print "@" substr($0,2)
+                    print draw(pool[0],len)
+                    print draw(tags,len)
+                    print draw(pool[1],len)
+                    print draw(pool[2],len)
+                    print draw(pool[3],len)
+                  }' $DIR/sim.fasta > $QUIVA || exit 1
+fi
+echo "Encoding `wc -c < $QUIVA` bytes of .quiva entries"
+
+gcc -O4 -w -I. -o $DIR/qv_new bench/qvbench.c DB.c QV.c -lm -lpthread || exit 1
+printf "  %-12s " "current:"
+$DIR/qv_new -r5 $QUIVA $DIR/new.qvs || exit 1
+
+if [ -z "$REV" ]
+  then echo "  (not a git repository, no earlier QV.c to compare with)"
+       exit 0
+fi
+mkdir $DIR/old
+for F in DB.c DB.h QV.c QV.h
+do
+  git show $REV:$F > $DIR/old/$F || exit 1
+done
+gcc -O4 -w -I$DIR/old -o $DIR/qv_old bench/qvbench.c $DIR/old/DB.c $DIR/old/QV.c -lm -lpthread || exit 1
+printf "  %-12s " "`git rev-parse --short $REV`:"
+$DIR/qv_old -r5 $QUIVA $DIR/old.qvs || exit 1
+
+if cmp -s $DIR/new.qvs $DIR/old.qvs
+  then echo "Compressed outputs identical"
+  else echo "** Compressed outputs differ"
+       exit 1
+fi
+exit 0
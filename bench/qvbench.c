@@ -0,0 +1,111 @@
+/*******************************************************************************************
+ *
+ *  Time the QV encoder on a .quiva file:
+ *     Scan the file and create its coding scheme (QVcoding_Scan, Create_QVcoding), then
+ *     compress every entry of the file into the output file (Compress_Next_QVentry), each
+ *     step -r times, reporting the best time of each.  Only the routines that every
+ *     version of QV.c has are used, so the driver can be linked against an old QV.c to
+ *     compare encoders (see bench/qv.sh), the outputs being identical if the .qvs format
+ *     is unchanged.
+ *
+ *  Date  :  October 2026
+ *
+ ********************************************************************************************/
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/time.h>
+
+#include "DB.h"
+#include "QV.h"
+
+static char *Usage = "[-r<int(3)>] <input:quiva> <output>";
+
+static double Seconds()
+{ struct timeval tv;
+
+  gettimeofday(&tv,NULL);
+  return (tv.tv_sec + tv.tv_usec/1e6);
+}
+
+int main(int argc, char *argv[])
+{ FILE     *input, *output;
+  QVcoding *coding;
+  double    scan, comp, t;
+  int       nentry;
+
+  int       REPS;
+
+  { int   i, j, k;
+    int   flags[128];
+    char *eptr;
+
+    ARG_INIT("qvbench")
+    (void) flags;
+
+    REPS = 3;
+
+    j = 1;
+    for (i = 1; i < argc; i++)
+      if (argv[i][0] == '-')
+        switch (argv[i][1])
+        { default:
+            ARG_FLAGS("")
+            break;
+          case 'r':
+            ARG_POSITIVE(REPS,"Number of repetitions")
+            break;
+        }
+      else
+        argv[j++] = argv[i];
+    argc = j;
+
+    if (argc != 3)
+      { fprintf(stderr,"Usage: %s %s\n",Prog_Name,Usage);
+        exit (1);
+      }
+  }
+
+  input = Fopen(argv[1],"r");
+  if (input == NULL)
+    exit (1);
+
+  scan   = comp = 1e30;
+  nentry = 0;
+  coding = NULL;
+  while (REPS-- > 0)
+    { if (coding != NULL)
+        Free_QVcoding(coding);
+
+      rewind(input);
+      t = Seconds();
+      QVcoding_Scan(input);
+      coding = Create_QVcoding(0);
+      coding->prefix = Strdup(".qvs","Allocating header prefix");
+      t = Seconds() - t;
+      if (t < scan)
+        scan = t;
+
+      output = Fopen(argv[2],"w");
+      if (output == NULL)
+        exit (1);
+      rewind(input);
+      nentry = 0;
+      t = Seconds();
+      Write_QVcoding(output,coding);
+      while (Read_Lines(input,1) > 0)
+        { Compress_Next_QVentry(input,output,coding,0);
+          nentry += 1;
+        }
+      fclose(output);
+      t = Seconds() - t;
+      if (t < comp)
+        comp = t;
+    }
+
+  printf("%d entries: scan %.3fs, compress %.3fs\n",nentry,scan,comp);
+
+  fclose(input);
+  exit (0);
+}
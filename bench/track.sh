@@ -0,0 +1,34 @@
+#!/bin/sh
+#
+#  Check lazy track access (Open_Lazy_Track, Track_Get) against Load_Track: a dense dust
+#    track is made for a simulated data set of many short reads, large enough that the
+#    lazy handle's page cache must cross page boundaries and replace pages, and then
+#    bench/lazytrack checks every read's slice of it for the whole DB and for each of
+#    its blocks.  Run from the directory holding the sources and binaries
+#    (make check-track).
+#
+#    Usage: bench/track.sh [<genome:Mbp(4)>]
+
+GENOME=${1:-4}
+
+DIR=`mktemp -d`
+trap 'rm -rf $DIR' EXIT
+
+gcc -O4 -w -I. -o $DIR/lazytrack bench/lazytrack.c DB.c QV.c -lm -lpthread || exit 1
+
+./simulator $GENOME -r17 -m1000 -s300 -x200 > $DIR/sim.fasta || exit 1
+./fasta2DB $DIR/S $DIR/sim.fasta || exit 1
+./DBdust -f -t1 -m4 $DIR/S || exit 1
+./DBsplit -s5 $DIR/S || exit 1
+echo "Dust track of `ls -l $DIR/.S.dust.data | awk '{print $5}'` bytes"
+
+NBLOCK=`sed -n 's/^blocks = *//p' $DIR/S.db`
+
+$DIR/lazytrack $DIR/S dust || exit 1
+B=1
+while [ $B -le $NBLOCK ]
+do
+  $DIR/lazytrack -r10000 $DIR/S.$B dust > /dev/null || exit 1
+  B=`expr $B + 1`
+done
+echo "All $NBLOCK blocks identical"
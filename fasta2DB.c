@@ -17,6 +17,9 @@
  *  Modify:  DB upgrade: now *add to* or create a DB depending on whether it exists, read
  *             multiple .fasta files (no longer a stdin pipe).
  *  Date  :  April 2014
+ *  Modify:  Block-buffered input that may be gzip'd or the standard input (-), and -T
+ *             threads that each parse and compress a file
+ *  Modify:  Refresh the summary of the DB, and the block directory of a partitioned DB
  *
  ********************************************************************************************/
 
@@ -26,6 +29,8 @@
 #include <strings.h>
 #include <sys/stat.h>
 #include <unistd.h>
+#include <zlib.h>
+#include <pthread.h>
 
 #include "DB.h"
 
@@ -35,26 +40,401 @@
 #define PATHSEP "/"
 #endif
 
-static char *Usage = "[-v] <path:string> <input:fasta> ...";
-
-static char number[128] =
-    { 0, 0, 0, 0, 0, 0, 0, 0,
-      0, 0, 0, 0, 0, 0, 0, 0,
-      0, 0, 0, 0, 0, 0, 0, 0,
-      0, 0, 0, 0, 0, 0, 0, 0,
-      0, 0, 0, 0, 0, 0, 0, 0,
-      0, 0, 0, 0, 0, 0, 0, 0,
-      0, 0, 0, 0, 0, 0, 0, 0,
-      0, 0, 0, 0, 0, 0, 0, 0,
-      0, 0, 0, 1, 0, 0, 0, 2,
-      0, 0, 0, 0, 0, 0, 0, 0,
-      0, 0, 0, 0, 3, 0, 0, 0,
-      0, 0, 0, 0, 0, 0, 0, 0,
-      0, 0, 0, 1, 0, 0, 0, 2,
-      0, 0, 0, 0, 0, 0, 0, 0,
-      0, 0, 0, 0, 3, 0, 0, 0,
-      0, 0, 0, 0, 0, 0, 0, 0,
-    };
+static char *Usage = "[-v] [-T<int(1)>] <path:string> <input:fasta|-> ...";
+
+  //  Block-buffered .fasta input: the file is read (and inflated if gzip'd) through zlib in
+  //    blocks of FA_BLOCK bytes, and lines are located in the block with memchr.  Header
+  //    lines must fit in a block, sequence lines may be of any length.
+
+#define FA_BLOCK 0x400000
+
+typedef struct
+  { gzFile input;   //  zlib handle, reads plain files transparently
+    char  *buf;     //  block buffer buf[0..FA_BLOCK]
+    int    bptr;    //  next unparsed char in buf
+    int    bend;    //  end of the valid data in buf
+    int    eof;     //  input exhausted
+    int    nline;   //  line number of the next line
+  } Fasta_File;
+
+static Fasta_File *Open_Fasta(char *name)
+{ Fasta_File *ff;
+
+  ff = (Fasta_File *) Malloc(sizeof(Fasta_File),"Allocating fasta reader");
+  if (ff == NULL)
+    return (NULL);
+  ff->buf = (char *) Malloc(FA_BLOCK+1,"Allocating fasta block");
+  if (ff->buf == NULL)
+    { free(ff);
+      return (NULL);
+    }
+  if (name == NULL)
+    ff->input = gzdopen(fileno(stdin),"r");
+  else
+    ff->input = gzopen(name,"r");
+  if (ff->input == NULL)
+    { if (name == NULL)
+        fprintf(stderr,"%s: Cannot read the standard input\n",Prog_Name);
+      else
+        fprintf(stderr,"%s: Cannot open %s for 'r'\n",Prog_Name,name);
+      free(ff->buf);
+      free(ff);
+      return (NULL);
+    }
+  gzbuffer(ff->input,FA_BLOCK);
+  ff->bptr  = 0;
+  ff->bend  = 0;
+  ff->eof   = 0;
+  ff->nline = 1;
+  return (ff);
+}
+
+static void Close_Fasta(Fasta_File *ff)
+{ gzclose(ff->input);
+  free(ff->buf);
+  free(ff);
+}
+
+  //  Shift the unparsed data to the front of the block and fill the rest from the input.
+  //    Return the number of bytes added, or -1 if the input could not be read.
+
+static int Fill_Block(Fasta_File *ff)
+{ int n;
+
+  if (ff->eof)
+    return (0);
+  n = ff->bend - ff->bptr;
+  if (ff->bptr > 0)
+    { memmove(ff->buf,ff->buf+ff->bptr,n);
+      ff->bptr = 0;
+      ff->bend = n;
+    }
+  n = gzread(ff->input,ff->buf+n,FA_BLOCK-n);
+  if (n < 0)
+    { int err;
+
+      fprintf(stderr,"%s: Read error: %s\n",Prog_Name,gzerror(ff->input,&err));
+      return (-1);
+    }
+  if (n == 0)
+    ff->eof = 1;
+  ff->bend += n;
+  return (n);
+}
+
+  //  Return the next line (without its new-line) or NULL at the end of the input.  The line
+  //    is only valid until the next call.  *error is set to 1 if the line is over MAX_NAME-2
+  //    chars and to -1 if the input cannot be read (which has been reported).
+
+static char *Fasta_Line(Fasta_File *ff, int *error)
+{ char *line, *eol;
+
+  *error = 0;
+  while ((eol = memchr(ff->buf+ff->bptr,'\n',ff->bend-ff->bptr)) == NULL)
+    { if (ff->bend - ff->bptr > MAX_NAME-2)
+        { *error = 1;
+          return (NULL);
+        }
+      if (ff->eof)
+        break;
+      if (Fill_Block(ff) < 0)
+        { *error = -1;
+          return (NULL);
+        }
+    }
+  line = ff->buf + ff->bptr;
+  if (eol == NULL)
+    { if (ff->bptr >= ff->bend)
+        return (NULL);
+      eol = ff->buf + ff->bend;
+    }
+  else if (eol - line > MAX_NAME-2)
+    { *error = 1;
+      return (NULL);
+    }
+  *eol = '\0';
+  ff->bptr   = (eol - ff->buf) + 1;
+  ff->nline += 1;
+  return (line);
+}
+
+  //  Append all the sequence lines up to the next header line or the end of the input to
+  //    (*read)[0..*rmax] (enlarging it as needed), and return the length of the sequence
+  //    or -1 if out of memory or the input cannot be read.
+
+static int Fasta_Sequence(Fasta_File *ff, char **read, int *rmax)
+{ char *beg, *eol;
+  int   rlen, len, bol;
+
+  rlen = 0;
+  bol  = 1;
+  while (1)
+    { if (ff->bptr >= ff->bend)
+        { int n;
+
+          n = Fill_Block(ff);
+          if (n < 0)
+            return (-1);
+          if (n == 0)
+            break;
+        }
+      beg = ff->buf + ff->bptr;
+      if (bol && *beg == '>')
+        break;
+      eol = memchr(beg,'\n',ff->bend-ff->bptr);
+      if (eol == NULL)
+        { len = ff->bend - ff->bptr;
+          bol = 0;
+        }
+      else
+        { len = eol - beg;
+          bol = 1;
+          ff->nline += 1;
+        }
+      if (rlen + len > *rmax)
+        { *rmax = 1.2*(rlen+len) + 60000;
+          *read = (char *) Realloc(*read,*rmax+1,"Allocating line buffer");
+          if (*read == NULL)
+            return (-1);
+        }
+      memcpy(*read+rlen,beg,len);
+      rlen     += len;
+      ff->bptr += len + bol;
+    }
+  (*read)[rlen] = '\0';
+  return (rlen);
+}
+
+  //  The parse of an input file by a thread: the records of its reads (where boff is relative
+  //    to the start of the file's bases) and the tallies of its reads.  If bases is not NULL
+  //    then the compressed bases are appended to it directly as the file's place in the .bps
+  //    is already known, otherwise they are accumulated in bps[0..blen-1].
+
+typedef struct
+  { char      *name;      //  Path name of the file (NULL for the standard input)
+    char      *core;      //  Root name of the file
+    char      *prolog;    //  Prolog of its headers
+    HITS_READ *prec;      //  prec[0..nreads-1] are the records of its reads
+    int        pmax;
+    int        nreads;
+    FILE      *bases;
+    uint8     *bps;
+    int64      blen;
+    int64      bmax;
+    int64      totlen;    //  # of bases, count of each of acgt, and the longest read length
+    int64      count[4];
+    int        maxlen;
+    int        error;     //  The file could not be read or is malformed (which has been reported)
+  } Fasta_Job;
+
+static int VERBOSE;
+static int NTHREADS;
+
+static void *fasta_thread(void *arg)
+{ Fasta_Job  *job = (Fasta_Job *) arg;
+  Fasta_File *input;
+  HITS_READ  *prec;
+  char       *core, *prolog, *line, *read;
+  int         rmax, pbeg, pwell, piped;
+  int         c, i, x, err;
+
+  job->error  = 1;
+  job->prec   = NULL;
+  job->bps    = NULL;
+  job->nreads = 0;
+  job->blen   = 0;
+  job->totlen = 0;
+  job->maxlen = 0;
+  for (c = 0; c < 4; c++)
+    job->count[c] = 0;
+
+  //  Buffers for the read records and for accumulating .fasta sequence over multiple lines
+
+  job->pmax = 100;
+  job->prec = prec = (HITS_READ *) Malloc(sizeof(HITS_READ)*job->pmax,"Allocating record buffer");
+  if (prec == NULL)
+    return (NULL);
+
+  rmax = MAX_NAME + 60000;
+  read = (char *) Malloc(rmax+1,"Allocating line buffer");
+  if (read == NULL)
+    return (NULL);
+
+  //  Open it, the standard input if it has no name, in which case its core name will be
+  //    the prolog of its first header.
+
+  core  = job->core;
+  piped = (job->name == NULL);
+  input = Open_Fasta(job->name);
+  if (input == NULL)
+    { free(read);
+      return (NULL);
+    }
+
+  //  Get the header of the first line, check that it has PACBIO format, and record
+  //    prolog in 'prolog'.
+
+  line = Fasta_Line(input,&err);
+  if (err > 0)
+    { fprintf(stderr,"File %s.fasta, Line 1: Fasta line is too long (> %d chars)\n",
+                     core,MAX_NAME-2);
+      goto error;
+    }
+  if (err < 0)
+    goto error;
+  if (line != NULL && line[0] != '>')
+    { fprintf(stderr,"File %s.fasta, Line 1: First header in fasta file is missing\n",core);
+      goto error;
+    }
+
+  { char *find;
+    int   well, beg, end, qv;
+
+    find = NULL;
+    if (line != NULL)
+      find = index(line+1,'/');
+    if (find != NULL && sscanf(find+1,"%d/%d_%d RQ=0.%d\n",&well,&beg,&end,&qv) >= 3)
+      { *find = '\0';
+        prolog = Strdup(line+1,"Extracting prolog");
+        *find = '/';
+        if (prolog == NULL) goto error;
+      }
+    else
+      { fprintf(stderr,"File %s.fasta, Line 1: Pacbio header line format error\n",core);
+        goto error;
+      }
+  }
+
+  if (piped && (core = Strdup(prolog,"Adding to file list")) == NULL)
+    goto error;
+  job->core   = core;
+  job->prolog = prolog;
+
+  if (VERBOSE)
+    { fprintf(stderr,"Adding '%s' ...\n",core);
+      fflush(stderr);
+    }
+
+  //  Read in all the sequences until end-of-file, where prec[pbeg..nreads-1] are the reads of
+  //    the current well
+
+  pbeg  = 0;
+  pwell = -1;
+  while (line != NULL)
+    { int   beg, end, clen;
+      int   well, qv, nline, rlen, n;
+      char *find;
+
+      nline = input->nline-1;
+      find  = index(line+1,'/');
+      if (find == NULL)
+        { fprintf(stderr,"File %s.fasta, Line %d: Pacbio header line format error\n",
+                         core,nline);
+          goto error;
+        }
+      *find = '\0';
+      if (strcmp(line+1,prolog) != 0)
+        { fprintf(stderr,"File %s.fasta, Line %d: Pacbio header line name inconsisten\n",
+                         core,nline);
+          goto error;
+        }
+      *find = '/';
+      x = sscanf(find+1,"%d/%d_%d RQ=0.%d\n",&well,&beg,&end,&qv);
+      if (x < 3)
+        { fprintf(stderr,"File %s.fasta, Line %d: Pacbio header line format error\n",
+                         core,nline);
+          goto error;
+        }
+      else if (x == 3)
+        qv = 0;
+
+      rlen = Fasta_Sequence(input,&read,&rmax);
+      if (rlen < 0)
+        { fprintf(stderr,"File %s.fasta, Line %d:",core,input->nline);
+          fprintf(stderr," Could not read sequence\n");
+          goto error;
+        }
+
+      //  line, the next header, stays valid as the block is not refilled until the
+      //    next call to Fasta_Sequence
+
+      line = Fasta_Line(input,&err);
+      if (err > 0)
+        { fprintf(stderr,"File %s.fasta, Line %d:",core,input->nline);
+          fprintf(stderr," Fasta line is too long (> %d chars)\n",MAX_NAME-2);
+          goto error;
+        }
+      if (err < 0)
+        goto error;
+
+      Number_Read_Count(rlen,read,job->count);
+      job->totlen += rlen;
+      if (rlen > job->maxlen)
+        job->maxlen = rlen;
+
+      n = job->nreads;
+      if (n >= job->pmax)
+        { job->pmax = n*1.2 + 100;
+          job->prec = prec = (HITS_READ *) realloc(prec,sizeof(HITS_READ)*job->pmax);
+          if (prec == NULL)
+            { fprintf(stderr,"File %s.fasta, Line %d: Out of memory",core,nline);
+              fprintf(stderr," (Allocating read records)\n");
+              goto error;
+            }
+        }
+
+      bzero(prec+n,sizeof(HITS_READ));   //  so its padding is always the same
+      prec[n].origin = well;
+      prec[n].beg    = beg;
+      prec[n].end    = end;
+      prec[n].boff   = job->blen;
+      prec[n].coff   = 0;
+      prec[n].flags  = qv;
+
+      Compress_Read(rlen,read);
+      clen = COMPRESSED_LEN(rlen);
+      if (job->bases != NULL)
+        fwrite(read,1,clen,job->bases);
+      else
+        { if (job->blen + clen > job->bmax)
+            { job->bmax = 1.2*(job->blen+clen) + 0x100000;
+              job->bps  = (uint8 *) Realloc(job->bps,job->bmax,"Allocating base buffer");
+              if (job->bps == NULL)
+                goto error;
+            }
+          memcpy(job->bps+job->blen,read,clen);
+        }
+      job->blen += clen;
+
+      if (pwell == well)
+        prec[n].flags |= DB_CSS;
+      else if (n > 0)
+        { x = pbeg;
+          for (i = pbeg+1; i < n; i++)
+            if (prec[i].end - prec[i].beg > prec[x].end - prec[x].beg)
+              x = i;
+          prec[x].flags |= DB_BEST;
+          pbeg = n;
+        }
+      job->nreads = n+1;
+      pwell = well;
+    }
+
+  //  Complete processing of .fasta file: mark the best read of the last well, and close file
+
+  x = pbeg;
+  for (i = pbeg+1; i < job->nreads; i++)
+    if (prec[i].end - prec[i].beg > prec[x].end - prec[i].beg)
+      x = i;
+  prec[x].flags |= DB_BEST;
+
+  job->error = 0;
+
+error:
+  Close_Fasta(input);
+  free(read);
+  return (NULL);
+}
 
 int main(int argc, char *argv[])
 { FILE  *istub, *ostub;
@@ -71,19 +451,27 @@ int main(int argc, char *argv[])
   int     oreads;
   int64   offset;
 
-  int     VERBOSE;
-
-  //   Usage: <path:string> <input:fasta> ...
+  //   Usage: <path:string> <input:fasta|-> ...
 
   { int   i, j, k;
     int   flags[128];
+    char *eptr;
 
     ARG_INIT("fasta2DB")
 
+    NTHREADS = 1;
+
     j = 1;
     for (i = 1; i < argc; i++)
-      if (argv[i][0] == '-')
-        { ARG_FLAGS("v") }
+      if (argv[i][0] == '-' && argv[i][1] != '\0')
+        switch (argv[i][1])
+        { default:
+            ARG_FLAGS("v")
+            break;
+          case 'T':
+            ARG_POSITIVE(NTHREADS,"Number of threads")
+            break;
+        }
       else
         argv[j++] = argv[i];
     argc = j;
@@ -174,23 +562,13 @@ int main(int argc, char *argv[])
 
   { int        maxlen;
     int64      totlen, count[4];
-    int        pmax, rmax;
-    HITS_READ *prec;
-    char      *read;
-    int        c;
-
-    //  Buffer for reads all in the same well
-
-    pmax = 100;
-    prec = (HITS_READ *) Malloc(sizeof(HITS_READ)*pmax,"Allocating record buffer");
-    if (prec == NULL)
-      goto error;
+    Fasta_Job *job;
+    pthread_t *threads;
+    int        c, t, u, n;
 
-    //  Buffer for accumulating .fasta sequence over multiple lines
-
-    rmax  = MAX_NAME + 60000;
-    read  = (char *) Malloc(rmax+1,"Allocating line buffer");
-    if (read == NULL)
+    job     = (Fasta_Job *) Malloc(sizeof(Fasta_Job)*NTHREADS,"Allocating file jobs");
+    threads = (pthread_t *) Malloc(sizeof(pthread_t)*NTHREADS,"Allocating threads");
+    if (job == NULL || threads == NULL)
       goto error;
 
     totlen = 0;              //  total # of bases in new .fasta files
@@ -198,203 +576,119 @@ int main(int argc, char *argv[])
     for (c = 0; c < 4; c++)  //  count of acgt in new .fasta files
       count[c] = 0;
 
-    //  For each new .fasta file do:
-
-    for (c = 2; c < argc; c++)
-      { FILE *input;
-        char *path, *core, *prolog;
-        int   nline, eof, rlen, pcnt;
-        int   pwell;
+    //  Parse the new .fasta files in rounds of NTHREADS, one per thread, where the first
+    //    file of a round writes its bases directly to the .bps
 
-        //  Open it: <path>/<core>.fasta, check that core is not too long, and add it to
-        //           list of added files, flist[0..ofiles), after checking that it is not
-        //           already in the list.
+    for (c = 2; c < argc; c += NTHREADS)
+      { n = argc-c;
+        if (n > NTHREADS)
+          n = NTHREADS;
 
-        path  = PathTo(argv[c]);
-        core  = Root(argv[c],".fasta");
-        if ((input = Fopen(Catenate(path,"/",core,".fasta"),"r")) == NULL)
-          goto error;
-        if (strlen(core) >= MAX_NAME)
-          { fprintf(stderr,"%s: File name over %d chars: '%.200s'\n",
-                           Prog_Name,MAX_NAME,core);
-            goto error;
-          }
+        //  Name each file: <path>/<core>.fasta, or <path>/<core>.fasta.gz if the former does
+        //    not exist or the argument ends in .gz, or the standard input if the argument
+        //    is -, in which case core is taken to be the prolog of its first header.
 
-        { int j;
+        for (t = 0; t < n; t++)
+          { char *arg, *path, *name;
+            int   len;
 
-          for (j = 0; j < ofiles; j++)
-            if (strcmp(core,flist[j]) == 0)
-              { fprintf(stderr,"%s: File %s.fasta is already in database %s.db\n",
-                               Prog_Name,core,Root(argv[1],".db"));
-                goto error;
+            arg = argv[c+t];
+            if (strcmp(arg,"-") == 0)
+              { job[t].core = "-";
+                job[t].name = NULL;
               }
-          flist[ofiles++] = core;
-          free(path);
-        }
-
-        if (VERBOSE)
-          { fprintf(stderr,"Adding '%s' ...\n",core);
-            fflush(stderr);
+            else
+              { path = PathTo(arg);
+                len  = strlen(arg);
+                if (len > 3 && strcasecmp(arg+(len-3),".gz") == 0)
+                  { arg[len-3] = '\0';
+                    job[t].core = Root(arg,".fasta");
+                    arg[len-3] = '.';
+                    name = Catenate(path,"/",job[t].core,".fasta.gz");
+                  }
+                else
+                  { job[t].core = Root(arg,".fasta");
+                    name = Catenate(path,"/",job[t].core,".fasta");
+                    if (access(name,F_OK) != 0)
+                      { name = Catenate(path,"/",job[t].core,".fasta.gz");
+                        if (access(name,F_OK) != 0)
+                          name = Catenate(path,"/",job[t].core,".fasta");
+                      }
+                  }
+                job[t].name = Strdup(name,"Allocating file name");
+                if (job[t].name == NULL)
+                  goto error;
+                free(path);
+              }
+            job[t].bmax  = 0;
+            if (t == 0)
+              job[t].bases = bases;
+            else
+              job[t].bases = NULL;
           }
 
-        //  Get the header of the first line, check that it has PACBIO format, and record
-        //    prolog in 'prolog'.
-
-        pcnt  = 0;
-        rlen  = 0;
-        nline = 1;
-        eof   = (fgets(read,MAX_NAME,input) == NULL);
-        if (read[strlen(read)-1] != '\n')
-          { fprintf(stderr,"File %s.fasta, Line 1: Fasta line is too long (> %d chars)\n",
-                           core,MAX_NAME-2);
-            goto error;
-          }
-        if (!eof && read[0] != '>')
-          { fprintf(stderr,"File %s.fasta, Line 1: First header in fasta file is missing\n",core);
+        for (t = 1; t < n; t++)
+          if (pthread_create(threads+t,NULL,fasta_thread,job+t) != 0)
+            break;
+        for (u = t; u < n; u++)      //  Run here any range no thread could be created for
+          fasta_thread(job+u);
+        fasta_thread(job);
+        for (u = 1; u < t; u++)
+          pthread_join(threads[u],NULL);
+
+        //  In command line order: check that the file's core name is not too long and not
+        //    already in the list of added files, flist[0..ofiles), and add it, then append
+        //    its bases and records to the .bps and .idx, and write its file line in the db
+        //    image.
+
+        for (t = 0; t < n; t++)
+          if (job[t].error)
             goto error;
-          }
-
-        { char *find;
-          int   well, beg, end, qv;
-
-          find = index(read+1,'/');
-          if (find != NULL && sscanf(find+1,"%d/%d_%d RQ=0.%d\n",&well,&beg,&end,&qv) >= 3)
-            { *find = '\0';
-              prolog = Strdup(read+1,"Extracting prolog");
-              *find = '/';
-              if (prolog == NULL) goto error;
-            }
-          else
-            { fprintf(stderr,"File %s.fasta, Line %d: Pacbio header line format error\n",
-                             core,nline);
-              goto error;
-            }
-        }
-
-        //  Read in all the sequences until end-of-file
-
-        { int i, x;
 
-          pwell = -1;
-          while (!eof)
-            { int   beg, end, clen;
-              int   well, qv;
-              char *find;
+        for (t = 0; t < n; t++)
+          { Fasta_Job *jb = job+t;
+            char      *core = jb->core;
+            int        j;
 
-              find = index(read+(rlen+1),'/');
-              if (find == NULL)
-                { fprintf(stderr,"File %s.fasta, Line %d: Pacbio header line format error\n",
-                                 core,nline);
-                  goto error;
-                }
-              *find = '\0';
-              if (strcmp(read+(rlen+1),prolog) != 0)
-                { fprintf(stderr,"File %s.fasta, Line %d: Pacbio header line name inconsisten\n",
-                                 core,nline);
-                  goto error;
-                }
-              *find = '/';
-              x = sscanf(find+1,"%d/%d_%d RQ=0.%d\n",&well,&beg,&end,&qv);
-              if (x < 3)
-                { fprintf(stderr,"File %s.fasta, Line %d: Pacbio header line format error\n",
-                                 core,nline);
+            if (strlen(core) >= MAX_NAME)
+              { fprintf(stderr,"%s: File name over %d chars: '%.200s'\n",
+                               Prog_Name,MAX_NAME,core);
+                goto error;
+              }
+            for (j = 0; j < ofiles; j++)
+              if (strcmp(core,flist[j]) == 0)
+                { fprintf(stderr,"%s: File %s.fasta is already in database %s.db\n",
+                                 Prog_Name,core,Root(argv[1],".db"));
                   goto error;
                 }
-              else if (x == 3)
-                qv = 0;
-
-              rlen = 0;
-              while (1)
-                { eof = (fgets(read+rlen,MAX_NAME,input) == NULL);
-                  nline += 1;
-                  x = strlen(read+rlen)-1;
-                  if (read[rlen+x] != '\n')
-                    { fprintf(stderr,"File %s.fasta, Line %d:",core,nline);
-                      fprintf(stderr," Fasta line is too long (> %d chars)\n",MAX_NAME-2);
-                      goto error;
-                    }
-                  if (eof || read[rlen] == '>')
-                    break;
-                  rlen += x;
-                  if (rlen + MAX_NAME > rmax)
-                    { rmax = 1.2 * rmax + 1000 + MAX_NAME;
-                      read = (char *) realloc(read,rmax+1);
-                      if (read == NULL)
-                        { fprintf(stderr,"File %s.fasta, Line %d:",core,nline);
-                          fprintf(stderr," Out of memory (Allocating line buffer)\n");
-                          goto error;
-                        }
-                    }
-                }
-              read[rlen] = '\0';
-
-              for (i = 0; i < rlen; i++)
-                { x = number[(int) read[i]];
-                  count[x] += 1;
-                  read[i]   = x;
-                }
-              oreads += 1;
-              totlen += rlen;
-              if (rlen > maxlen)
-                maxlen = rlen;
-
-              prec[pcnt].origin = well;
-              prec[pcnt].beg    = beg;
-              prec[pcnt].end    = end;
-              prec[pcnt].boff   = offset;
-              prec[pcnt].coff   = 0;
-              prec[pcnt].flags  = qv;
-
-              Compress_Read(rlen,read);
-              clen = COMPRESSED_LEN(rlen);
-              fwrite(read,1,clen,bases);
-              offset += clen;
-
-              if (pwell == well)
-                { prec[pcnt].flags |= DB_CSS;
-                  pcnt += 1;
-                  if (pcnt >= pmax)
-                    { pmax = pcnt*1.2 + 100;
-                      prec = (HITS_READ *) realloc(prec,sizeof(HITS_READ)*pmax);
-                      if (prec == NULL)
-                        { fprintf(stderr,"File %s.fasta, Line %d: Out of memory",core,nline);
-                          fprintf(stderr," (Allocating read records)\n");
-                          goto error;
-                        }
-                    }
-                }
-              else if (pcnt == 0)
-                pcnt += 1;
-              else
-                { x = 0;
-                  for (i = 1; i < pcnt; i++)
-                    if (prec[i].end - prec[i].beg > prec[x].end - prec[x].beg)
-                      x = i;
-                  prec[x].flags |= DB_BEST;
-                  fwrite(prec,sizeof(HITS_READ),pcnt,indx);
-                  prec[0] = prec[pcnt];
-                  pcnt = 1;
-                }
-              pwell = well;
-            }
-
-          //  Complete processing of .fasta file: flush last well group, write file line
-          //      in db image, free prolog, and close file
-
-          x = 0;
-          for (i = 1; i < pcnt; i++)
-            if (prec[i].end - prec[i].beg > prec[x].end - prec[i].beg)
-              x = i;
-          prec[x].flags |= DB_BEST;
-          fwrite(prec,sizeof(HITS_READ),pcnt,indx);
-
-          fprintf(ostub,DB_FDATA,oreads,core,prolog);
-
-	  free(prolog);
-          fclose(input);
-        }
+            flist[ofiles++] = core;
+
+            if (jb->bases == NULL)
+              fwrite(jb->bps,1,jb->blen,bases);
+            for (j = 0; j < jb->nreads; j++)
+              jb->prec[j].boff += offset;
+            fwrite(jb->prec,sizeof(HITS_READ),jb->nreads,indx);
+
+            offset += jb->blen;
+            oreads += jb->nreads;
+            totlen += jb->totlen;
+            for (j = 0; j < 4; j++)
+              count[j] += jb->count[j];
+            if (jb->maxlen > maxlen)
+              maxlen = jb->maxlen;
+
+            fprintf(ostub,DB_FDATA,oreads,core,jb->prolog);
+
+            free(jb->prolog);
+            free(jb->prec);
+            free(jb->bps);
+            free(jb->name);
+          }
       }
 
+    free(threads);
+    free(job);
+
     //  Finished loading all sequences: update relevant fields in db record
 
     db.oreads = oreads;
@@ -498,6 +792,20 @@ int main(int argc, char *argv[])
 
   rename(Catenate(pwd,"/",root,".dbx"),dbname);   //  New image replaces old image
 
+  //  Rewrite the summary of the db, and if it is partitioned, its block directory for the
+  //    extended partition
+
+  { HITS_DB dbn;
+
+    if (Open_DB(dbname,&dbn))
+      exit (1);
+    if ((db.cutoff >= 0 && Write_Block_Directory(dbname,&dbn)) || Write_DB_Summary(dbname,&dbn))
+      { Close_DB(&dbn);
+        exit (1);
+      }
+    Close_DB(&dbn);
+  }
+
   exit (0);
 
   //  Error exit:  Either truncate or remove the .idx and .bps files as appropriate.
@@ -2,10 +2,18 @@
  *
  *  Adds the given .quiva files to an existing DB "path".  The input files must be added in
  *  the same order as the .fasta files were and have the same root names, e.g. FOO.fasta
- *  and FOO.quiva.  The files can be added incrementally but must be added in the same order  
+ *  and FOO.quiva.  The files can be added incrementally but must be added in the same order
  *  as the .fasta files.  This is enforced by the program.  With the -l option set the
  *  compression scheme is a bit lossy to get more compression (see the description of dexqv
- *  in the DEXTRACTOR module).
+ *  in the DEXTRACTOR module).  With -T the statistics scan and the compression of the files
+ *  are each performed by the given number of threads working on consecutive chunks of the
+ *  (memory mapped) input files, the compressed chunks being appended to the .qvs in order.
+ *
+ *  An input given as - is read from the standard input and is taken to be the next file of
+ *  the DB in order.  Such an input, or one that is not a regular file (e.g. a named pipe),
+ *  is streamed through memory in a single pass: its compression scheme is built from its
+ *  first QV_SAMPLE bytes, and if the input is longer than that, every value is given a code
+ *  so that the remainder can be compressed with the scheme as it arrives.
  *
  *  Author:  Gene Myers
  *  Date  :  July 2014
@@ -17,7 +25,10 @@
 #include <string.h>
 #include <strings.h>
 #include <sys/stat.h>
+#include <sys/mman.h>
+#include <fcntl.h>
 #include <unistd.h>
+#include <pthread.h>
 
 #include "DB.h"
 #include "QV.h"
@@ -28,29 +39,537 @@
 #define PATHSEP "/"
 #endif
 
-static char *Usage = "[-vl] <path:string> <input:quiva> ...";
+static char *Usage = "[-vl] [-T<int(1)>] <path:string> <input:quiva|-> ...";
+
+#define QV_CHUNK   0x1000000   //  Target size of the chunks of input handed to a thread
+#define QV_SAMPLE  0x4000000   //  Size of the prefix of a streamed input its scheme is built from
+
+static int VERBOSE;
+static int LOSSY;
+static int NTHREADS;
+
+  //  A .quiva file (or a segment of it if it is streamed) in memory, and the location of
+  //    each of its entries
+
+typedef struct
+  { char     *root;     //  Root name of the file
+    FILE     *input;    //  Stream the file is read from (NULL if it is memory mapped)
+    char     *data;     //  data[0..dlen-1] is the contents of the file (segment), and
+    int64     dlen;     //    if streamed, data has room for dmax bytes
+    int64     dmax;
+    int       nent;     //  # of entries in data
+    int64    *eoff;     //  eoff[e] is the offset of the header of entry e, eoff[nent] is the
+    int       emax;     //    end of the last entry, eoff has room for emax+1 offsets
+    int       ebase;    //  # of entries of the file before those in data
+    int       first;    //  Index in the DB of the read of the first entry of the file
+    int       nreads;   //  # of reads the file has in the DB
+    int       pref;     //  Entries [0,pref) are scanned serially (to fix the run chars)
+    int       check;    //  Entries have not been scanned and so are checked when compressed
+    QVstats   stats;
+    QVcoding  coding;
+  } QV_File;
+
+  //  A thread's work space: buffer is a scratch area for headers and entries, and out
+  //    receives the compressed entries of a chunk
+
+typedef struct
+  { char     *buffer;
+    int64     bmax;
+    uint8    *out;
+    int64     omax;
+  } Work;
+
+  //  A chunk of consecutive entries [beg,end) of a file.
+
+typedef struct
+  { QV_File   *qf;
+    int        beg, end;
+    QVstats    stats;     //  Statistics of entries [max(beg,pref),end)
+    Work      *work;
+    int64      olen;      //  # of compressed bytes in work->out
+    int        error;     //  An entry of the chunk is malformed
+  } Chunk;
+
+static HITS_READ *Reads;      //  The DB's read records
+static FILE      *Quiva;      //  The .qvs file being appended to
+static Work      *Space;      //  Work space for each thread
+static pthread_t *Threads;
+
+static void *Enlarge(void *block, int64 *max, int64 need, char *mesg)
+{ if (need > *max)
+    { *max  = 1.2*need + 1000;
+      block = Realloc(block,*max,mesg);
+      if (block == NULL)
+        exit (1);
+    }
+  return (block);
+}
+
+  //  Find the start of each complete entry (of 6 lines) in qf->data.  If eof is set then the
+  //    data must end with a complete entry.  Return non-zero if the data is malformed.
+
+static int Index_Entries(QV_File *qf, int eof)
+{ char *nl;
+  int64 o, s;
+  int   k, line;
+
+  qf->nent = 0;
+  o  = 0;
+  nl = NULL;
+  while (o < qf->dlen)
+    { if (qf->nent >= qf->emax)
+        { qf->emax = 1.2*qf->emax + 1000;
+          qf->eoff = (int64 *) Realloc(qf->eoff,sizeof(int64)*(qf->emax+1),
+                                       "Reallocating entry index");
+          if (qf->eoff == NULL)
+            return (1);
+        }
+      line = 6*(qf->ebase+qf->nent) + 1;
+      s    = o;
+      for (k = 0; k < 6; k++)
+        { nl = memchr(qf->data+o,'\n',qf->dlen-o);
+          if (nl == NULL)
+            break;
+          o = (nl - qf->data) + 1;
+          if (o >= qf->dlen && k < 5)
+            { k += 1;
+              break;
+            }
+        }
+      if (k < 6)
+        { if (!eof)
+            { o = s;
+              break;
+            }
+          if (nl == NULL)
+            fprintf(stderr,"Line %d: Last line does not end with a newline !\n",line+k);
+          else
+            fprintf(stderr,"Line %d: incomplete last entry of .quiv file\n",line+k);
+          return (1);
+        }
+      qf->eoff[qf->nent++] = s;
+    }
+  if (qf->eoff == NULL)
+    { qf->eoff = (int64 *) Malloc(sizeof(int64),"Allocating entry index");
+      if (qf->eoff == NULL)
+        return (1);
+    }
+  qf->eoff[qf->nent] = o;
+  return (0);
+}
+
+  //  Set entry[0..4] to the 5 QV lines of entry e of qf and return their length.  If check
+  //    is set then also verify the header and that the lines have the same length as done
+  //    by QVcoding_Scan and Read_Lines, returning -1 if not.
+
+static int Get_Entry(QV_File *qf, int e, char **entry, Work *work, int check)
+{ char *line, *next, *slash;
+  int   k, rlen, hlen, lno;
+
+  line = qf->data + qf->eoff[e];
+  next = ((char *) memchr(line,'\n',qf->eoff[e+1] - qf->eoff[e])) + 1;
+  hlen = next-line;
+  lno  = 6*(qf->ebase+e) + 1;
+
+  if (check)
+    { int well, beg, end, qv;
+
+      if (hlen <= 1 || line[0] != '@')
+        { fprintf(stderr,"Line %d: Header in quiv file is missing\n",lno);
+          return (-1);
+        }
+      work->buffer = Enlarge(work->buffer,&(work->bmax),hlen+1,"Allocating header buffer");
+      memcpy(work->buffer,line,hlen);
+      work->buffer[hlen] = '\0';
+      slash = index(work->buffer+1,'/');
+      if (slash == NULL)
+        { fprintf(stderr,"%s: Line %d: Header line incorrectly formatted ?\n",Prog_Name,lno);
+          return (-1);
+        }
+      if (sscanf(slash+1,"%d/%d_%d RQ=0.%d\n",&well,&beg,&end,&qv) != 4)
+        { fprintf(stderr,"%s: Line %d: Header line incorrectly formatted ?\n",Prog_Name,lno);
+          return (-1);
+        }
+    }
+
+  rlen = (qf->eoff[e+1] - qf->eoff[e] - hlen)/5 - 1;
+  for (k = 0; k < 5; k++)
+    { entry[k] = next + k*(rlen+1);
+      if (check && entry[k][rlen] != '\n')
+        { fprintf(stderr,"Line %d: Lines for an entry are not the same length\n",lno+k+1);
+          return (-1);
+        }
+    }
+  return (rlen);
+}
+
+  //  Accumulate the statistics of the entries of a chunk beyond the serially scanned prefix
+
+static void *scan_thread(void *arg)
+{ Chunk   *chunk = (Chunk *) arg;
+  QV_File *qf    = chunk->qf;
+  char    *entry[5];
+  int      e, rlen;
+
+  QVstats_Init(&(chunk->stats));
+  chunk->stats.delChar = qf->stats.delChar;
+  chunk->stats.subChar = qf->stats.subChar;
+  e = chunk->beg;
+  if (e < qf->pref)
+    e = qf->pref;
+  for ( ; e < chunk->end; e++)
+    { rlen = Get_Entry(qf,e,entry,chunk->work,1);
+      if (rlen < 0)
+        { chunk->error = 1;
+          break;
+        }
+      QVstats_Entry(&(chunk->stats),entry,rlen);
+    }
+  return (NULL);
+}
+
+  //  Compress the entries of a chunk into its work->out, setting the coff of each read to
+  //    the offset of its entry therein
+
+static void *compress_thread(void *arg)
+{ Chunk   *chunk = (Chunk *) arg;
+  QV_File *qf    = chunk->qf;
+  Work    *work  = chunk->work;
+  char    *entry[5];
+  int64    o;
+  int      e, k, rlen;
+
+  o = 0;
+  for (e = chunk->beg; e < chunk->end; e++)
+    { rlen = Get_Entry(qf,e,entry,work,qf->check);
+      if (rlen < 0)
+        { chunk->error = 1;
+          break;
+        }
+      work->buffer = Enlarge(work->buffer,&(work->bmax),5*(rlen+1),"Allocating entry buffer");
+      for (k = 0; k < 5; k++)
+        { memcpy(work->buffer+k*(rlen+1),entry[k],rlen);
+          entry[k] = work->buffer+k*(rlen+1);
+        }
+      work->out = Enlarge(work->out,&(work->omax),o+QV_ENTRY_MAX(rlen),"Allocating chunk buffer");
+      Reads[qf->first+qf->ebase+e].coff = o;
+      o += Compress_QVentry(entry,rlen,work->out+o,&(qf->coding),LOSSY);
+    }
+  chunk->olen = o;
+  return (NULL);
+}
+
+  //  Divide the entries of the nqf files qf into chunks of about csize bytes (at least one
+  //    per file), returning the array of chunks and their number in *nchunk.
+
+static Chunk *Make_Chunks(QV_File *qf, int nqf, int64 csize, int *nchunk)
+{ Chunk *chunk;
+  int    c, e, n, beg;
+
+  n = 0;
+  for (c = 0; c < nqf; c++)
+    n += qf[c].dlen/csize + 1;
+  chunk = (Chunk *) Malloc(sizeof(Chunk)*n,"Allocating chunks");
+  if (chunk == NULL)
+    exit (1);
+
+  n = 0;
+  for (c = 0; c < nqf; c++)
+    { beg = 0;
+      for (e = 0; e <= qf[c].nent; e++)
+        if (e == qf[c].nent || (e > beg && qf[c].eoff[e] - qf[c].eoff[beg] >= csize))
+          { chunk[n].qf    = qf+c;
+            chunk[n].beg   = beg;
+            chunk[n].end   = e;
+            chunk[n].error = 0;
+            n  += 1;
+            beg = e;
+          }
+    }
+
+  *nchunk = n;
+  return (chunk);
+}
+
+  //  Run fn on the chunks in rounds of NTHREADS threads.  If output is set then after each
+  //    round append the compressed chunks to the .qvs in order (preceded by the scheme of
+  //    a file if it is the first chunk of the file), and set the coff's of their reads to
+  //    their offsets in the .qvs (*except* the first of each file, that points at the
+  //    compression scheme immediately preceding it).  Return non-zero if a chunk had an
+  //    error.
+
+static int Run_Chunks(Chunk *chunk, int nchunk, void *(*fn)(void *), int output)
+{ int beg, t, u, e;
+
+  for (beg = 0; beg < nchunk; beg += NTHREADS)
+    { for (t = 0; t < NTHREADS && beg+t < nchunk; t++)
+        chunk[beg+t].work = Space+t;
+      for (t = 1; t < NTHREADS && beg+t < nchunk; t++)
+        if (pthread_create(Threads+t,NULL,fn,chunk+(beg+t)) != 0)
+          break;
+      for (u = t; u < NTHREADS && beg+u < nchunk; u++)   //  Run here any chunk no thread could
+        fn(chunk+(beg+u));                                //    be created for
+      fn(chunk+beg);
+      for (u = 1; u < t; u++)
+        pthread_join(Threads[u],NULL);
+
+      for (t = 0; t < NTHREADS && beg+t < nchunk; t++)
+        if (chunk[beg+t].error)
+          return (1);
+
+      if (!output)
+        continue;
+
+      for (t = 0; t < NTHREADS && beg+t < nchunk; t++)
+        { Chunk     *ch = chunk+(beg+t);
+          QV_File   *qf = ch->qf;
+          HITS_READ *r  = Reads + (qf->first+qf->ebase);
+          int64      qpos, base;
+
+          qpos = ftello(Quiva);
+          if (ch->beg == 0 && qf->ebase == 0)
+            { if (VERBOSE)
+                { fprintf(stderr,"Compressing '%s' ...\n",qf->root);
+                  fflush(stderr);
+                }
+              Write_QVcoding(Quiva,&(qf->coding));
+            }
+          base = ftello(Quiva);
+          for (e = ch->beg; e < ch->end; e++)
+            r[e].coff += base;
+          if (ch->beg == 0 && ch->end > 0 && qf->ebase == 0)
+            r[0].coff = qpos;
+          fwrite(ch->work->out,1,ch->olen,Quiva);
+        }
+    }
+  return (0);
+}
+
+  //  Determine the compression scheme of each of the nqf files qf in a scan of their entries.
+  //    The run chars of a file are determined by its first few entries, so these are scanned
+  //    serially, and then the remaining entries are scanned in parallel by NTHREADS threads.
+  //    If cover is set then the schemes must be able to code values not seen in the scan.
+  //    Return non-zero if an entry is malformed.
+
+static int Build_Schemes(QV_File *qf, int nqf, int64 csize, int cover)
+{ Chunk *chunk;
+  int    nchunk;
+  int    c, e;
+
+  for (c = 0; c < nqf; c++)
+    { char *entry[5];
+      int   rlen;
+
+      if (VERBOSE)
+        { fprintf(stderr,"Analyzing '%s' ...\n",qf[c].root);
+          fflush(stderr);
+        }
+
+      QVstats_Init(&(qf[c].stats));
+      for (e = 0; e < qf[c].nent; e++)
+        { if (qf[c].stats.delChar >= 0 && qf[c].stats.subChar >= 0)
+            break;
+          rlen = Get_Entry(qf+c,e,entry,Space,1);
+          if (rlen < 0)
+            return (1);
+          QVstats_Entry(&(qf[c].stats),entry,rlen);
+        }
+      qf[c].pref = e;
+    }
+
+  chunk = Make_Chunks(qf,nqf,csize,&nchunk);
+  if (Run_Chunks(chunk,nchunk,scan_thread,0))
+    { free(chunk);
+      return (1);
+    }
+
+  for (e = 0; e < nchunk; e++)
+    QVstats_Merge(&(chunk[e].qf->stats),&(chunk[e].stats));
+  free(chunk);
+
+  for (c = 0; c < nqf; c++)
+    { if (cover)
+        QVstats_Cover(&(qf[c].stats));
+      QVstats_Coding(&(qf[c].stats),LOSSY,&(qf[c].coding));
+      qf[c].coding.prefix = Strdup(".qvs","Allocating header prefix");
+    }
+
+  return (0);
+}
+
+  //  Compress the entries of the nqf files qf in parallel and append them to the .qvs.
+  //    Return non-zero if an entry is malformed.
+
+static int Compress_Files(QV_File *qf, int nqf, int64 csize)
+{ Chunk *chunk;
+  int    nchunk, error;
+
+  chunk = Make_Chunks(qf,nqf,csize,&nchunk);
+  error = Run_Chunks(chunk,nchunk,compress_thread,1);
+  free(chunk);
+  return (error);
+}
+
+  //  The chunk size that gives each thread an equal share of tlen bytes, up to QV_CHUNK
+
+static int64 Chunk_Size(int64 tlen)
+{ int64 csize;
+
+  csize = tlen/NTHREADS + 1;
+  if (csize > QV_CHUNK)
+    csize = QV_CHUNK;
+  return (csize);
+}
+
+  //  Check that the entries so far do not exceed the reads of the file in the DB, or if eof
+  //    is set that they equal them, returning non-zero if not.
+
+static int Check_Count(QV_File *qf, int eof)
+{ int n = qf->ebase + qf->nent;
+
+  if (n > qf->nreads || (eof && n != qf->nreads))
+    { fprintf(stderr,"%s: Number of reads in %s.quiva doesn't match number in %s.fasta\n",
+                     Prog_Name,qf->root,qf->root);
+      return (1);
+    }
+  return (0);
+}
+
+  //  Read from the input of qf until data holds at least target bytes, or the end of the
+  //    input is reached in which case return non-zero.
+
+static int Fill_Data(QV_File *qf, int64 target)
+{ int64 n;
+
+  qf->data = Enlarge(qf->data,&(qf->dmax),target,"Allocating input buffer");
+  while (qf->dlen < target)
+    { n = fread(qf->data+qf->dlen,1,qf->dmax-qf->dlen,qf->input);
+      if (n <= 0)
+        return (1);
+      qf->dlen += n;
+    }
+  return (0);
+}
+
+  //  Stream the input of qf into the .qvs: build the scheme from the first QV_SAMPLE bytes,
+  //    and then compress the input in segments of NTHREADS*QV_CHUNK bytes as it is read.
+  //    Return non-zero if an error occurred.
+
+static int Stream_File(QV_File *qf)
+{ int64 seg, keep;
+  int   eof;
+
+  seg = QV_CHUNK * ((int64) NTHREADS);
+
+  eof = Fill_Data(qf,QV_SAMPLE);
+  if (Index_Entries(qf,eof) || Check_Count(qf,eof))
+    return (1);
+  if (Build_Schemes(qf,1,Chunk_Size(qf->dlen),!eof))
+    return (1);
+
+  while (1)
+    { if (Compress_Files(qf,1,Chunk_Size(qf->dlen)))
+        return (1);
+      if (eof)
+        break;
+
+      keep = qf->dlen - qf->eoff[qf->nent];
+      memmove(qf->data,qf->data+qf->eoff[qf->nent],keep);
+      qf->dlen   = keep;
+      qf->ebase += qf->nent;
+      qf->check  = 1;
+
+      do
+        { eof = Fill_Data(qf,qf->dlen+seg);
+          if (Index_Entries(qf,eof))
+            return (1);
+        }
+      while (qf->nent == 0 && !eof);
+      if (Check_Count(qf,eof))
+        return (1);
+    }
+
+  return (0);
+}
+
+  //  Map the regular file path of qf into memory, returning non-zero if this could not be done
+
+static int Map_Quiva(QV_File *qf, char *path)
+{ struct stat info;
+  int         fd;
+
+  fd = open(path,O_RDONLY);
+  if (fd < 0)
+    { fprintf(stderr,"%s: Cannot open %s for 'r'\n",Prog_Name,path);
+      return (1);
+    }
+  if (fstat(fd,&info) < 0)
+    { fprintf(stderr,"%s: Cannot stat %s\n",Prog_Name,path);
+      close(fd);
+      return (1);
+    }
+  qf->dlen = info.st_size;
+  if (qf->dlen == 0)
+    qf->data = NULL;
+  else
+    { qf->data = mmap(NULL,qf->dlen,PROT_READ,MAP_SHARED,fd,0);
+      if (qf->data == MAP_FAILED)
+        { fprintf(stderr,"%s: Cannot memory map %s\n",Prog_Name,path);
+          qf->data = NULL;
+          close(fd);
+          return (1);
+        }
+    }
+  close(fd);
+  return (0);
+}
+
+static void Free_Quiva(QV_File *qf)
+{ if (qf->input == NULL)
+    { if (qf->data != NULL)
+        munmap(qf->data,qf->dlen);
+    }
+  else
+    { if (qf->input != stdin)
+        fclose(qf->input);
+      free(qf->data);
+    }
+  free(qf->eoff);
+  free(qf->root);
+}
 
 int main(int argc, char *argv[])
-{ FILE      *istub, *quiva, *indx;
+{ FILE      *istub, *indx;
   int64      coff;
   int        ofile;
   HITS_DB    db;
   HITS_READ *reads;
+  char     **names;
 
-  int        VERBOSE;
-  int        LOSSY;
+  QV_File   *qfile;
+  int        nqf;
 
   //  Process command line
 
   { int   i, j, k;
     int   flags[128];
+    char *eptr;
 
     ARG_INIT("quiva2DB")
 
+    NTHREADS = 1;
+
     j = 1;
     for (i = 1; i < argc; i++)
-      if (argv[i][0] == '-')
-        { ARG_FLAGS("vl") }
+      if (argv[i][0] == '-' && argv[i][1] != '\0')
+        switch (argv[i][1])
+        { default:
+            ARG_FLAGS("vl")
+            break;
+          case 'T':
+            ARG_POSITIVE(NTHREADS,"Number of threads")
+            break;
+        }
       else
         argv[j++] = argv[i];
     argc = j;
@@ -67,8 +586,10 @@ int main(int argc, char *argv[])
   //  Open DB stub file and index, load db and read records.  Confirm that the .fasta files
   //    corresponding to the command line .quiva files are in the DB and in order where the
   //    index of the first file is ofile and the index of the first read to be added is ofirst.
-  //    Record in coff the current size of the .qvs file in case an error occurs and it needs
-  //    to be truncated back to its size at the start.
+  //    An input - is taken to be the next file in order (the first without QVs if it is the
+  //    first input), and the root name of every input is recorded in names.  Record in coff
+  //    the current size of the .qvs file in case an error occurs and it needs to be truncated
+  //    back to its size at the start.
 
   { int   i, c;
     char *pwd, *root;
@@ -90,25 +611,44 @@ int main(int argc, char *argv[])
       exit (1);
     fread(reads,sizeof(HITS_READ),db.oreads,indx);
 
-    { int   first, last;
+    names = (char **) Malloc(sizeof(char *)*argc,"Allocating file names");
+    if (names == NULL)
+      exit (1);
+
+    { int   first, last, added;
       char  prolog[MAX_NAME], fname[MAX_NAME];
       char *core;
+      struct stat info;
 
-      c    = 2;
-      core = Root(argv[c],".quiva");
+      c = 2;
+      if (strcmp(argv[c],"-") == 0)
+        core = NULL;
+      else
+        core = Root(argv[c],".quiva");
+      added = (stat(Catenate(pwd,PATHSEP,root,".qvs"),&info) == 0 && info.st_size > 0);
 
       fscanf(istub,DB_NFILE,&nfiles);
       first = 0;
       for (i = 0; i < nfiles; i++)
         { fscanf(istub,DB_FDATA,&last,fname,prolog);
-          if (strcmp(core,fname) == 0)
+          if (core == NULL)
+            { if (first == 0 ? !added : reads[first].coff == 0)
+                break;
+            }
+          else if (strcmp(core,fname) == 0)
             break;
           first = last;
         }
       if (i >= nfiles)
-        { fprintf(stderr,"%s: %s.fasta has never been added to DB\n",Prog_Name,core);
+        { if (core == NULL)
+            fprintf(stderr,"%s: QVs have already been added for every file\n",Prog_Name);
+          else
+            fprintf(stderr,"%s: %s.fasta has never been added to DB\n",Prog_Name,core);
           exit (1);
         }
+      if (core == NULL)
+        core = Strdup(fname,"Allocating file name");
+      names[c] = core;
 
       ofile  = i;
       if (first > 0 && reads[first-1].coff == 0)
@@ -121,113 +661,157 @@ int main(int argc, char *argv[])
         }
 
       for (c = 3; c < argc; c++)
-        { core = Root(argv[c],".quiva");
+        { if (strcmp(argv[c],"-") == 0)
+            core = NULL;
+          else
+            core = Root(argv[c],".quiva");
           if (++i >= nfiles)
-            { fprintf(stderr,"%s: %s.fasta has never been added to DB\n",Prog_Name,core);
+            { fprintf(stderr,"%s: %s.fasta has never been added to DB\n",Prog_Name,
+                             core == NULL ? "-" : core);
               exit (1);
             }
           fscanf(istub,DB_FDATA,&last,fname,prolog);
-          if (strcmp(core,fname) != 0)
+          if (core == NULL)
+            core = Strdup(fname,"Allocating file name");
+          else if (strcmp(core,fname) != 0)
             { fprintf(stderr,"%s: Files not being added in order (expect %s, given %s)",
                              Prog_Name,fname,core);
               exit (1);
             }
+          names[c] = core;
         }
 
       if (ofile == 0)
-        quiva = Fopen(Catenate(pwd,PATHSEP,root,".qvs"),"w");
+        Quiva = Fopen(Catenate(pwd,PATHSEP,root,".qvs"),"w");
       else
-        quiva = Fopen(Catenate(pwd,PATHSEP,root,".qvs"),"r+");
-      if (quiva == NULL)
+        Quiva = Fopen(Catenate(pwd,PATHSEP,root,".qvs"),"r+");
+      if (Quiva == NULL)
         exit (1);
 
-      fseeko(quiva,0,SEEK_END);
-      coff = ftello(quiva);
+      fseeko(Quiva,0,SEEK_END);
+      coff = ftello(Quiva);
     }
 
     free(root);
     free(pwd);
   }
 
-  //  For each .quiva file, determine its compression scheme in a fast scan and append it to
-  //    the .qvs file  Then compress every .quiva entry in the file, appending its compressed
-  //    form to the .qvs file as you go and recording the offset in the .qvs in the .coff field
-  //    of each read record (*except* the first, that points at the compression scheme immediately
-  //    preceding it).  Ensure that the # of .quiva entries matches the # of .fasta entries
-  //    in each added file.
+  //  Open each .quiva file, recording the reads it should have.  Regular files are mapped
+  //    into memory, all others are streamed.
 
   { int i, c;
     int last, cur;
 
-    //  For each .quiva file do:
-
     rewind(istub);
     fscanf(istub,"files = %*d\n");
+    last = 0;
     for (i = 0; i < ofile; i++)
       fscanf(istub,"  %9d %*s %*s\n",&last);
 
-    cur = last;
-    for (c = 2; c < argc; c++)
-      { FILE     *input;
-        int64     qpos;
-        char     *pwd, *root;
-        QVcoding *coding;
-
-        //  Open next .quiva file and create its compression scheme
-
-        pwd  = PathTo(argv[c]);
-        root = Root(argv[c],".quiva");
-        if ((input = Fopen(Catenate(pwd,"/",root,".quiva"),"r")) == NULL)
-          goto error;
+    nqf   = argc-2;
+    qfile = (QV_File *) Malloc(sizeof(QV_File)*nqf,"Allocating file records");
+    if (qfile == NULL)
+      goto error;
+    bzero(qfile,sizeof(QV_File)*nqf);
 
-        if (VERBOSE)
-          { fprintf(stderr,"Analyzing '%s' ...\n",root);
-            fflush(stderr);
+    cur = last;
+    for (c = 0; c < nqf; c++)
+      { QV_File    *qf = qfile+c;
+        struct stat info;
+        char       *pwd, *path;
+
+        qf->root = names[c+2];
+        if (strcmp(argv[c+2],"-") == 0)
+          qf->input = stdin;
+        else
+          { pwd  = PathTo(argv[c+2]);
+            path = Catenate(pwd,"/",qf->root,".quiva");
+            free(pwd);
+            if (stat(path,&info) < 0)
+              { fprintf(stderr,"%s: Cannot open %s for 'r'\n",Prog_Name,path);
+                goto error;
+              }
+            if (S_ISREG(info.st_mode))
+              { if (Map_Quiva(qf,path))
+                  goto error;
+              }
+            else
+              { qf->input = Fopen(path,"r");
+                if (qf->input == NULL)
+                  goto error;
+              }
           }
 
-        QVcoding_Scan(input);
-        coding = Create_QVcoding(LOSSY);
-        coding->prefix = Strdup(".qvs","Allocating header prefix");
-
-        qpos = ftello(quiva);
-        Write_QVcoding(quiva,coding);
+        fscanf(istub,"  %9d %*s %*s\n",&last);
+        qf->first  = cur;
+        qf->nreads = last-cur;
+        cur = last;
+      }
+  }
 
-        //  Then compress and append to the .qvs each compressed QV entry
- 
-        if (VERBOSE)
-          { fprintf(stderr,"Compressing '%s' ...\n",root);
-            fflush(stderr);
+  //  Process the files in order, each maximal run of mapped files together: index their
+  //    entries and ensure that the # of .quiva entries matches the # of .fasta entries in
+  //    each, determine their compression schemes, and then compress them in chunks of at
+  //    most QV_CHUNK bytes in rounds of NTHREADS, appending the compressed chunks to the .qvs
+  //    file in order and recording the offset in the .qvs in the .coff field of each read
+  //    record (*except* the first of each file, that points at the compression scheme
+  //    immediately preceding it).  Streamed files are processed one at a time by Stream_File.
+
+  { int64 tlen, csize;
+    int   c, b, t;
+
+    Reads   = reads;
+    Space   = (Work *) Malloc(sizeof(Work)*NTHREADS,"Allocating work space");
+    Threads = (pthread_t *) Malloc(sizeof(pthread_t)*NTHREADS,"Allocating threads");
+    if (Space == NULL || Threads == NULL)
+      goto error;
+    bzero(Space,sizeof(Work)*NTHREADS);
+
+    for (b = 0; b < nqf; b = c)
+      { if (qfile[b].input != NULL)
+          { if (Stream_File(qfile+b))
+              goto error;
+            Free_QVcoding(&(qfile[b].coding));
+            c = b+1;
+            continue;
           }
 
-        rewind(input);
-        while (Read_Lines(input,1) > 0)
-          { reads[cur++].coff = qpos;
-            Compress_Next_QVentry(input,quiva,coding,LOSSY);
-            qpos = ftello(quiva);
+        tlen = 0;
+        for (c = b; c < nqf && qfile[c].input == NULL; c++)
+          { if (Index_Entries(qfile+c,1) || Check_Count(qfile+c,1))
+              goto error;
+            tlen += qfile[c].dlen;
           }
+        csize = Chunk_Size(tlen);
 
-        fscanf(istub,"  %9d %*s %*s\n",&last);
-        if (last != cur)
-          { fprintf(stderr,"%s: Number of reads in %s.quiva doesn't match number in %s.fasta\n",
-                           Prog_Name,root,root);
-            goto error;
-          }
+        if (Build_Schemes(qfile+b,c-b,csize,0) || Compress_Files(qfile+b,c-b,csize))
+          goto error;
 
-        Free_QVcoding(coding);
-        free(root);
-        free(pwd);
-    }
+        for (t = b; t < c; t++)
+          Free_QVcoding(&(qfile[t].coding));
+      }
+
+    for (c = 0; c < nqf; c++)
+      Free_Quiva(qfile+c);
+    for (t = 0; t < NTHREADS; t++)
+      { free(Space[t].buffer);
+        free(Space[t].out);
+      }
+    free(Threads);
+    free(Space);
+    free(qfile);
+    free(names);
   }
 
   //  Write the db record and read index into .idx and clean up
 
   rewind(indx);
   fwrite(&db,sizeof(HITS_DB),1,indx);
-  fwrite(reads,sizeof(HITS_DB),db.oreads,indx);
+  fwrite(reads,sizeof(HITS_READ),db.oreads,indx);
 
   fclose(istub);
   fclose(indx);
-  fclose(quiva);
+  fclose(Quiva);
 
   exit (0);
 
@@ -235,12 +819,12 @@ int main(int argc, char *argv[])
 
 error:
   if (coff != 0)
-    { fseeko(quiva,0,SEEK_SET);
-      ftruncate(fileno(quiva),coff);
+    { fseeko(Quiva,0,SEEK_SET);
+      ftruncate(fileno(Quiva),coff);
     }
   fclose(istub);
   fclose(indx);
-  fclose(quiva);
+  fclose(Quiva);
   if (coff == 0)
     { char *root = Root(argv[1],".db");
       char *pwd  = PathTo(argv[1]);